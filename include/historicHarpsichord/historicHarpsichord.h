@@ -54,10 +54,12 @@ extern "C" {
 #define gtk_hbox_new(homogeneous, spacing) gtk_box_new(GTK_ORIENTATION_HORIZONTAL, spacing)
 #endif
 #define SOUNDFONTS_DIR "soundfonts"
+#define TEMPERAMENTS_DIR "temperaments"
 
 typedef enum{
 
   HISTORICHARPSICHORD_DIR_SOUNDFONTS,
+  HISTORICHARPSICHORD_DIR_TEMPERAMENTS,
  
 } HistoricHarpsichordDirectory;
 
@@ -37,9 +37,13 @@ typedef struct HistoricHarpsichordPrefs
   GString *fluidsynth_soundfont; /**< Default soundfont for fluidsynth */
   gboolean fluidsynth_reverb; /**< Toggle if reverb is applied to fluidsynth */
   gboolean fluidsynth_chorus; /**< Toggle if chorus is applied to fluidsynth */
+  gboolean resampled_bank; /**< Play samples resampled per key to the output rate and temperament, using more memory and less CPU */
+  gboolean note_cache; /**< Serve note-ons from plucks rendered once per key of the resampled bank */
+  gboolean adaptive_tuning; /**< Retune each note-on to sound pure against the chord it completes */
+  gboolean one_string_per_key; /**< A key struck again fades out its previous stroke instead of sounding over it */
   gboolean lowpitch; //A440 or A415
   gint dynamic_compression;/**< percent compression of dynamic range desired when listening to MIDI-in */
-  gboolean damping;/**< when true notes are re-sounded when left off at a lower velocity depending on their duration */
+  gboolean damping;/**< when true notes left off soon after they are struck are damped over a longer release */
   GString *temperament; /**< Preferred temperament for tuning to */
 } HistoricHarpsichordPrefs;
 
@@ -91,8 +91,11 @@ int  ParseSoundfont(char *soundfont, int index, char **name, int *preset, int *b
 typedef struct _SFBags {
 	int nbags;
 	uint16 *bag;
+	uint16 *modbag;
 	int ngens;
 	SFGenRec *gen;
+	int nmods;
+	SFModRec *mod;
 } SFBags;
 
 static SFBags prbags, inbags;
@@ -130,6 +133,7 @@ static void load_preset_header(int size, SFInfo *sf, FILE *fd);
 static void load_inst_header(int size, SFInfo *sf, FILE *fd);
 static void load_bag(int size, SFBags *bagp, FILE *fd);
 static void load_gen(int size, SFBags *bagp, FILE *fd);
+static void load_mod(int size, SFBags *bagp, FILE *fd);
 static void load_sample_info(int size, SFInfo *sf, FILE *fd);
 static void convert_layers(SFInfo *sf);
 static void generate_layers(SFHeader *hdr, SFHeader *next, SFBags *bags);
@@ -172,9 +176,13 @@ int load_soundfont(SFInfo *sf, FILE *fd, int is_seekable)
 	sf->sample = NULL;
 	sf->inst = NULL;
 	sf->sf_name = NULL;
+	sf->infopos = sf->infosize = 0;
 
 	prbags.bag = inbags.bag = NULL;
+	prbags.modbag = inbags.modbag = NULL;
 	prbags.gen = inbags.gen = NULL;
+	prbags.mod = inbags.mod = NULL;
+	prbags.nmods = inbags.nmods = 0;
 
 	/* check RIFF file header */
 	READCHUNK(chunk, fd);
@@ -208,9 +216,13 @@ int load_soundfont(SFInfo *sf, FILE *fd, int is_seekable)
 
 	/* free private tables */
 	if (prbags.bag) free(prbags.bag);
+	if (prbags.modbag) free(prbags.modbag);
 	if (prbags.gen) free(prbags.gen);
+	if (prbags.mod) free(prbags.mod);
 	if (inbags.bag) free(inbags.bag);
+	if (inbags.modbag) free(inbags.modbag);
 	if (inbags.gen) free(inbags.gen);
+	if (inbags.mod) free(inbags.mod);
 
 	return 0;
 }
@@ -422,8 +434,12 @@ static int process_pdta(int size, SFInfo *sf, FILE *fd)
 		case SHDR_ID:
 			load_sample_info(chunk.size, sf, fd);
 			break;
-		case PMOD_ID: /* ignored */
-		case IMOD_ID: /* ingored */
+		case PMOD_ID:
+			load_mod(chunk.size, &prbags, fd);
+			break;
+		case IMOD_ID:
+			load_mod(chunk.size, &inbags, fd);
+			break;
 		default:
 			FSKIP(chunk.size, fd);
 			break;
@@ -521,9 +537,10 @@ static void load_bag(int size, SFBags *bagp, FILE *fd)
 
 	size /= 4;
 	bagp->bag = NEW(uint16, size);
+	bagp->modbag = NEW(uint16, size);
 	for (i = 0; i < size; i++) {
 		READW(bagp->bag[i], fd);
-		SKIPW(fd); /* mod; ignored */
+		READW(bagp->modbag[i], fd);
 	}
 	bagp->nbags = size;
 }
@@ -547,6 +564,27 @@ static void load_gen(int size, SFBags *bagp, FILE *fd)
 }
 
 
+/*----------------------------------------------------------------
+ * load preset/instrument modulator list on the private table
+ *----------------------------------------------------------------*/
+
+static void load_mod(int size, SFBags *bagp, FILE *fd)
+{
+	int i;
+
+	size /= 10;
+	bagp->mod = NEW(SFModRec, size);
+	for (i = 0; i < size; i++) {
+		READW(bagp->mod[i].src, fd);
+		READW(bagp->mod[i].dest, fd);
+		READW(bagp->mod[i].amount, fd);
+		READW(bagp->mod[i].amtsrc, fd);
+		READW(bagp->mod[i].trans, fd);
+	}
+	bagp->nmods = size;
+}
+
+
 /*----------------------------------------------------------------
  * load sample info list
  *----------------------------------------------------------------*/
@@ -665,6 +703,19 @@ static void generate_layers(SFHeader *hdr, SFHeader *next, SFBags *bags)
 		layp->list = (SFGenRec*)safe_malloc(sizeof(SFGenRec) * layp->nlists);
 		memcpy(layp->list, &bags->gen[genNdx],
 		       sizeof(SFGenRec) * layp->nlists);
+		/* modulators are optional; an absent or short mod chunk means none */
+		layp->nmods = 0;
+		layp->mods = NULL;
+		if (bags->mod && bags->modbag[i+1] <= bags->nmods) {
+			int modNdx = bags->modbag[i];
+			layp->nmods = bags->modbag[i+1] - modNdx;
+			if (layp->nmods > 0) {
+				layp->mods = NEW(SFModRec, layp->nmods);
+				memcpy(layp->mods, &bags->mod[modNdx],
+				       sizeof(SFModRec) * layp->nmods);
+			} else
+				layp->nmods = 0;
+		}
 	}
 }
 
@@ -679,7 +730,310 @@ static void free_layer(SFHeader *hdr)
 		SFGenLayer *layp = &hdr->layer[i];
 		if (layp->nlists > 0)
 			free(layp->list);
+		if (layp->nmods > 0)
+			free(layp->mods);
 	}
 	if (hdr->nlayers > 0)
 		free(hdr->layer);
 }
+
+
+/*================================================================
+ * save a soundfont file
+ *
+ * The INFO list is copied as it is; the sample data is streamed
+ * from fin sample by sample and the preset data list is
+ * regenerated from the layer tables.  All chunk sizes are
+ * computed beforehand, so fout needn't be seekable.
+ * Only SF2 files can be written.
+ *================================================================*/
+
+#define WRITEID(var,fd)	fwrite(var, 4, 1, fd)
+#define WRITESTR(var,fd)	fwrite(var, 20, 1, fd)
+#define WRITEDW(var,fd)	{int32 tmp = (var); fwrite(&tmp, 4, 1, fd);}
+#define WRITEW(var,fd)	{uint16 tmp = (var); fwrite(&tmp, 2, 1, fd);}
+#define WRITEB(var,fd)	{byte tmp = (var); fwrite(&tmp, 1, 1, fd);}
+#define WRITECHUNK(id,size,fd)	{WRITEID(id, fd); WRITEDW(size, fd);}
+
+/* zero sample points required after each sample */
+#define SAMPLE_GUARD	46
+
+static void count_layers(SFHeader *hdr, int nhdrs, int *nbags, int *ngens, int *nmods);
+static int copy_sample(SFInfo *sf, SFSampleInfo *sp, FILE *fin, FILE *fout);
+static void save_header_bags(SFHeader *hdr, int nhdrs, FILE *fout);
+static void save_header_mods(SFHeader *hdr, int nhdrs, FILE *fout);
+static void save_header_gens(SFHeader *hdr, int nhdrs, FILE *fout);
+
+int save_soundfont(SFInfo *sf, FILE *fin, FILE *fout)
+{
+	int i;
+	int32 pos, smplsize, sdtasize, pdtasize, infosize;
+	int npbags, npgens, npmods, nibags, nigens, nimods;
+	static char zero[20];
+
+	if (sf->version < 2) {
+		fprintf(stderr, "*** only SF2 files can be saved\n");
+		return -1;
+	}
+	if (sf->npresets < 1 || sf->ninsts < 1 || sf->nsamples < 1) {
+		fprintf(stderr, "*** no terminal preset/instrument/sample\n");
+		return -1;
+	}
+
+	/* sample data; the last sample record is the terminal one */
+	smplsize = 0;
+	for (i = 0; i < sf->nsamples - 1; i++) {
+		SFSampleInfo *sp = &sf->sample[i];
+		if (sp->endsample < sp->startsample) {
+			fprintf(stderr, "*** illegal sample range in %.20s\n",
+				sp->name);
+			return -1;
+		}
+		smplsize += (sp->endsample - sp->startsample + SAMPLE_GUARD) * 2;
+	}
+	sdtasize = 4 + 8 + smplsize;
+
+	/* preset data */
+	count_layers(&sf->preset[0].hdr, sf->npresets - 1,
+		     &npbags, &npgens, &npmods);
+	count_layers(&sf->inst[0].hdr, sf->ninsts - 1,
+		     &nibags, &nigens, &nimods);
+	pdtasize = 4 + 9 * 8 +
+		sf->npresets * 38 + (npbags + 1) * 4 +
+		(npmods + 1) * 10 + (npgens + 1) * 4 +
+		sf->ninsts * 22 + (nibags + 1) * 4 +
+		(nimods + 1) * 10 + (nigens + 1) * 4 +
+		sf->nsamples * 46;
+
+	/* info list; an empty one gets the mandatory version and name */
+	if (sf->infosize > 0)
+		infosize = 4 + sf->infosize;
+	else
+		infosize = 4 + 8 + 4 + 8 + 8 + 8 + 20;
+
+	/* RIFF header */
+	WRITECHUNK("RIFF", 4 + 8 + infosize + 8 + sdtasize + 8 + pdtasize,
+		   fout);
+	WRITEID("sfbk", fout);
+
+	/* INFO list */
+	WRITECHUNK("LIST", infosize, fout);
+	WRITEID("INFO", fout);
+	if (sf->infosize > 0) {
+		char buf[1024];
+		long left = sf->infosize;
+		if (fseek(fin, sf->infopos, SEEK_SET) < 0)
+			return -1;
+		while (left > 0) {
+			size_t n = left < sizeof(buf) ? left : sizeof(buf);
+			if (fread(buf, 1, n, fin) != n)
+				return -1;
+			fwrite(buf, 1, n, fout);
+			left -= n;
+		}
+	} else {
+		WRITECHUNK("ifil", 4, fout);
+		WRITEW(sf->version, fout);
+		WRITEW(sf->minorversion, fout);
+		WRITECHUNK("isng", 8, fout);
+		fwrite("EMU8000\0", 8, 1, fout);
+		WRITECHUNK("INAM", 20, fout);
+		strncpy(zero, "untitled", sizeof(zero));
+		WRITESTR(zero, fout);
+		memset(zero, 0, sizeof(zero));
+	}
+
+	/* sdta list */
+	WRITECHUNK("LIST", sdtasize, fout);
+	WRITEID("sdta", fout);
+	WRITECHUNK("smpl", smplsize, fout);
+	for (i = 0; i < sf->nsamples - 1; i++) {
+		if (copy_sample(sf, &sf->sample[i], fin, fout))
+			return -1;
+	}
+
+	/* pdta list */
+	WRITECHUNK("LIST", pdtasize, fout);
+	WRITEID("pdta", fout);
+
+	WRITECHUNK("phdr", sf->npresets * 38, fout);
+	pos = 0;
+	for (i = 0; i < sf->npresets; i++) {
+		SFPresetHdr *pp = &sf->preset[i];
+		WRITESTR(pp->hdr.name, fout);
+		WRITEW(pp->preset, fout);
+		WRITEW(pp->bank, fout);
+		WRITEW(pos, fout);
+		WRITEDW(0, fout); /* lib */
+		WRITEDW(0, fout); /* genre */
+		WRITEDW(0, fout); /* morph */
+		pos += pp->hdr.nlayers;
+	}
+	WRITECHUNK("pbag", (npbags + 1) * 4, fout);
+	save_header_bags(&sf->preset[0].hdr, sf->npresets - 1, fout);
+	WRITECHUNK("pmod", (npmods + 1) * 10, fout);
+	save_header_mods(&sf->preset[0].hdr, sf->npresets - 1, fout);
+	WRITECHUNK("pgen", (npgens + 1) * 4, fout);
+	save_header_gens(&sf->preset[0].hdr, sf->npresets - 1, fout);
+
+	WRITECHUNK("inst", sf->ninsts * 22, fout);
+	pos = 0;
+	for (i = 0; i < sf->ninsts; i++) {
+		WRITESTR(sf->inst[i].hdr.name, fout);
+		WRITEW(pos, fout);
+		pos += sf->inst[i].hdr.nlayers;
+	}
+	WRITECHUNK("ibag", (nibags + 1) * 4, fout);
+	save_header_bags(&sf->inst[0].hdr, sf->ninsts - 1, fout);
+	WRITECHUNK("imod", (nimods + 1) * 10, fout);
+	save_header_mods(&sf->inst[0].hdr, sf->ninsts - 1, fout);
+	WRITECHUNK("igen", (nigens + 1) * 4, fout);
+	save_header_gens(&sf->inst[0].hdr, sf->ninsts - 1, fout);
+
+	WRITECHUNK("shdr", sf->nsamples * 46, fout);
+	pos = 0;
+	for (i = 0; i < sf->nsamples; i++) {
+		SFSampleInfo *sp = &sf->sample[i];
+		int32 shift;
+		if (i == sf->nsamples - 1) {
+			/* terminal record */
+			WRITESTR(sp->name, fout);
+			for (shift = 0; shift < 5; shift++)
+				WRITEDW(0, fout);
+			WRITEB(0, fout);
+			WRITEB(0, fout);
+			WRITEW(0, fout);
+			WRITEW(0, fout);
+			break;
+		}
+		shift = pos - sp->startsample;
+		WRITESTR(sp->name, fout);
+		WRITEDW(sp->startsample + shift, fout);
+		WRITEDW(sp->endsample + shift, fout);
+		WRITEDW(sp->startloop + shift, fout);
+		WRITEDW(sp->endloop + shift, fout);
+		WRITEDW(sp->samplerate, fout);
+		WRITEB(sp->originalPitch, fout);
+		WRITEB(sp->pitchCorrection, fout);
+		WRITEW(sp->samplelink, fout);
+		WRITEW(sp->sampletype, fout);
+		pos += sp->endsample - sp->startsample + SAMPLE_GUARD;
+	}
+
+	fflush(fout);
+	return ferror(fout) ? -1 : 0;
+}
+
+
+/*----------------------------------------------------------------
+ * count the bags, generators and modulators of the headers
+ *----------------------------------------------------------------*/
+
+static void count_layers(SFHeader *hdr, int nhdrs, int *nbags, int *ngens, int *nmods)
+{
+	int i, j;
+
+	*nbags = *ngens = *nmods = 0;
+	for (i = 0; i < nhdrs; i++) {
+		*nbags += hdr[i].nlayers;
+		for (j = 0; j < hdr[i].nlayers; j++) {
+			*ngens += hdr[i].layer[j].nlists;
+			*nmods += hdr[i].layer[j].nmods;
+		}
+	}
+}
+
+
+/*----------------------------------------------------------------
+ * copy the data of one sample followed by the zero guard points
+ *----------------------------------------------------------------*/
+
+static int copy_sample(SFInfo *sf, SFSampleInfo *sp, FILE *fin, FILE *fout)
+{
+	char buf[8192];
+	long left = (long)(sp->endsample - sp->startsample) * 2;
+
+	if (sp->sampletype & 0x8000) {
+		/* ROM sample addresses can't be moved into the file */
+		fprintf(stderr, "*** can't save ROM sample %.20s\n", sp->name);
+		return -1;
+	}
+	if (sp->startsample * 2L + left > sf->samplesize) {
+		fprintf(stderr, "*** sample %.20s exceeds the data\n",
+			sp->name);
+		return -1;
+	}
+	if (fseek(fin, sf->samplepos + sp->startsample * 2L, SEEK_SET) < 0)
+		return -1;
+	while (left > 0) {
+		size_t n = left < sizeof(buf) ? left : sizeof(buf);
+		if (fread(buf, 1, n, fin) != n) {
+			fprintf(stderr, "*** can't read sample %.20s\n",
+				sp->name);
+			return -1;
+		}
+		fwrite(buf, 1, n, fout);
+		left -= n;
+	}
+	memset(buf, 0, SAMPLE_GUARD * 2);
+	fwrite(buf, 1, SAMPLE_GUARD * 2, fout);
+	return 0;
+}
+
+
+/*----------------------------------------------------------------
+ * write bag, modulator and generator lists with terminal records
+ *----------------------------------------------------------------*/
+
+static void save_header_bags(SFHeader *hdr, int nhdrs, FILE *fout)
+{
+	int i, j, gen = 0, mod = 0;
+
+	for (i = 0; i < nhdrs; i++) {
+		for (j = 0; j < hdr[i].nlayers; j++) {
+			WRITEW(gen, fout);
+			WRITEW(mod, fout);
+			gen += hdr[i].layer[j].nlists;
+			mod += hdr[i].layer[j].nmods;
+		}
+	}
+	WRITEW(gen, fout);
+	WRITEW(mod, fout);
+}
+
+static void save_header_mods(SFHeader *hdr, int nhdrs, FILE *fout)
+{
+	int i, j, k;
+
+	for (i = 0; i < nhdrs; i++) {
+		for (j = 0; j < hdr[i].nlayers; j++) {
+			SFGenLayer *layp = &hdr[i].layer[j];
+			for (k = 0; k < layp->nmods; k++) {
+				WRITEW(layp->mods[k].src, fout);
+				WRITEW(layp->mods[k].dest, fout);
+				WRITEW(layp->mods[k].amount, fout);
+				WRITEW(layp->mods[k].amtsrc, fout);
+				WRITEW(layp->mods[k].trans, fout);
+			}
+		}
+	}
+	for (k = 0; k < 5; k++)
+		WRITEW(0, fout);
+}
+
+static void save_header_gens(SFHeader *hdr, int nhdrs, FILE *fout)
+{
+	int i, j, k;
+
+	for (i = 0; i < nhdrs; i++) {
+		for (j = 0; j < hdr[i].nlayers; j++) {
+			SFGenLayer *layp = &hdr[i].layer[j];
+			for (k = 0; k < layp->nlists; k++) {
+				WRITEW(layp->list[k].oper, fout);
+				WRITEW(layp->list[k].amount, fout);
+			}
+		}
+	}
+	WRITEW(0, fout);
+	WRITEW(0, fout);
+}
@@ -37,10 +37,30 @@ typedef struct _SFGenRec {
 	int16 amount;
 } SFGenRec;
 
+/* generator operators we look at (SF2.01 section 8.1.2) */
+enum {
+	SF_GEN_KEYRANGE = 43,
+	SF_GEN_INSTRUMENT = 41,
+	SF_GEN_SAMPLEID = 53,
+};
+
+/* low and high byte of a range amount (keyRange, velRange) */
+#define SF_RANGE_LO(amount)	((amount) & 0xff)
+#define SF_RANGE_HI(amount)	(((amount) >> 8) & 0xff)
+
+/* modulator record */
+typedef struct _SFModRec {
+	uint16 src, dest;
+	int16 amount;
+	uint16 amtsrc, trans;
+} SFModRec;
+
 /* layered generators record */
 typedef struct _SFGenLayer {
 	int nlists;
 	SFGenRec *list;
+	int nmods;
+	SFModRec *mods;
 } SFGenLayer;
 
 /* header record */
@@ -120,9 +140,16 @@ typedef struct _SFInfo {
 /* sffile.c */
 int load_soundfont(SFInfo *sf, FILE *fp, int is_seekable);
 void free_soundfont(SFInfo *sf);
-void save_soundfont(SFInfo *sf, FILE *fin, FILE *fout);
+int save_soundfont(SFInfo *sf, FILE *fin, FILE *fout);
 void load_textinfo(SFInfo *sf, FILE *fp);
 
+/* sfsubset.c */
+typedef struct _SFPresetId {
+	int bank, preset;
+} SFPresetId;
+
+int subset_soundfont(SFInfo *sf, SFPresetId *keep, int nkeep);
+
 
 /* sample.c */
 void correct_samples(SFInfo *sf);
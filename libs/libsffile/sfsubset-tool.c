@@ -0,0 +1,88 @@
+/*================================================================
+ * sfsubset-tool.c
+ *	write a soundfont containing only the given presets
+ *
+ *	usage: historicHarpsichord-sfsubset INPUT OUTPUT [BANK:PROGRAM...]
+ *	without a preset list only bank 0 program 0 is kept.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *================================================================*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "sffile.h"
+#include "sf_util.h"
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s INPUT OUTPUT [BANK:PROGRAM...]\n", prog);
+	fprintf(stderr, "  keeps only the given presets (default 0:0) and\n");
+	fprintf(stderr, "  the instruments and samples they use\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	SFInfo sf;
+	SFPresetId *keep;
+	int i, nkeep, kept, nsamples;
+	FILE *fin, *fout;
+
+	if (argc < 3)
+		usage(argv[0]);
+	if (strcmp(argv[1], argv[2]) == 0) {
+		fprintf(stderr, "%s: input and output must differ\n", argv[0]);
+		return 1;
+	}
+
+	nkeep = argc > 3 ? argc - 3 : 1;
+	keep = (SFPresetId*)safe_malloc(sizeof(SFPresetId) * nkeep);
+	for (i = 3; i < argc; i++) {
+		if (sscanf(argv[i], "%d:%d", &keep[i-3].bank,
+			   &keep[i-3].preset) != 2)
+			usage(argv[0]);
+	}
+
+	if ((fin = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (load_soundfont(&sf, fin, TRUE)) {
+		fprintf(stderr, "%s: can't load soundfont\n", argv[1]);
+		return 1;
+	}
+	nsamples = sf.nsamples;
+	kept = subset_soundfont(&sf, keep, nkeep);
+	if (kept < 0) {
+		fprintf(stderr, "%s: none of the presets found\n", argv[1]);
+		return 1;
+	}
+
+	if ((fout = fopen(argv[2], "wb")) == NULL) {
+		perror(argv[2]);
+		return 1;
+	}
+	if (save_soundfont(&sf, fin, fout)) {
+		fprintf(stderr, "%s: can't write soundfont\n", argv[2]);
+		fclose(fout);
+		remove(argv[2]);
+		return 1;
+	}
+	fclose(fout);
+	fclose(fin);
+
+	printf("%s: %d presets, %d instruments, %d of %d samples kept\n",
+	       argv[2], kept, sf.ninsts - 1, sf.nsamples - 1, nsamples - 1);
+	free_soundfont(&sf);
+	free(keep);
+	return 0;
+}
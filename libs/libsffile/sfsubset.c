@@ -0,0 +1,236 @@
+/*================================================================
+ * sfsubset.c
+ *	reduce a loaded soundfont to a list of presets
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *================================================================*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "sffile.h"
+#include "sf_util.h"
+
+#define NEW(type,nums)	(type*)safe_malloc(sizeof(type) * (nums))
+
+/* sample types which refer to another sample through samplelink */
+#define LINKED_SAMPLE	(2|4|8)
+
+static int preset_wanted(SFPresetHdr *pp, SFPresetId *keep, int nkeep);
+static void mark_layers(SFHeader *hdr, int oper, int *map, int nmap);
+static void remap_layers(SFHeader *hdr, int oper, int *map, int nmap);
+static int number_marks(int *map, int nmap);
+static void drop_layers(SFHeader *hdr);
+
+
+/*================================================================
+ * drop everything not needed by the given presets
+ *
+ * The instruments referenced by the kept presets and the samples
+ * referenced by those instruments (with their stereo partners)
+ * survive; all indices are renumbered.  The terminal records stay
+ * at the end of each table.  The sample positions still refer to
+ * the original file, so save_soundfont() must be given that file
+ * as input.  Returns the number of kept presets, or -1 if none of
+ * the given presets exists.
+ *================================================================*/
+
+int subset_soundfont(SFInfo *sf, SFPresetId *keep, int nkeep)
+{
+	int *presetmap, *instmap, *samplemap;
+	int i, n, npresets, ninsts, nsamples, changed;
+	SFPresetHdr *preset;
+	SFInstHdr *inst;
+	SFSampleInfo *sample;
+
+	if (sf->npresets < 1 || sf->ninsts < 1 || sf->nsamples < 1)
+		return -1;
+
+	/* mark the wanted presets and what they refer to;
+	 * the terminal records are never marked */
+	presetmap = NEW(int, sf->npresets);
+	instmap = NEW(int, sf->ninsts);
+	samplemap = NEW(int, sf->nsamples);
+	for (i = 0; i < sf->npresets - 1; i++) {
+		if (preset_wanted(&sf->preset[i], keep, nkeep)) {
+			presetmap[i] = 1;
+			mark_layers(&sf->preset[i].hdr, SF_GEN_INSTRUMENT,
+				    instmap, sf->ninsts - 1);
+		}
+	}
+	for (i = 0; i < sf->ninsts - 1; i++) {
+		if (instmap[i])
+			mark_layers(&sf->inst[i].hdr, SF_GEN_SAMPLEID,
+				    samplemap, sf->nsamples - 1);
+	}
+	/* a stereo sample is useless without its partner */
+	do {
+		changed = 0;
+		for (i = 0; i < sf->nsamples - 1; i++) {
+			SFSampleInfo *sp = &sf->sample[i];
+			if (samplemap[i] && (sp->sampletype & LINKED_SAMPLE) &&
+			    sp->samplelink < sf->nsamples - 1 &&
+			    !samplemap[sp->samplelink]) {
+				samplemap[sp->samplelink] = 1;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	npresets = number_marks(presetmap, sf->npresets - 1);
+	if (npresets == 0) {
+		free(presetmap);
+		free(instmap);
+		free(samplemap);
+		return -1;
+	}
+	ninsts = number_marks(instmap, sf->ninsts - 1);
+	nsamples = number_marks(samplemap, sf->nsamples - 1);
+
+	/* compact the tables, moving the layers of the kept headers */
+	preset = NEW(SFPresetHdr, npresets + 1);
+	for (i = 0; i < sf->npresets - 1; i++) {
+		if (presetmap[i] < 0) {
+			drop_layers(&sf->preset[i].hdr);
+			continue;
+		}
+		preset[presetmap[i]] = sf->preset[i];
+		remap_layers(&preset[presetmap[i]].hdr, SF_GEN_INSTRUMENT,
+			     instmap, sf->ninsts - 1);
+	}
+	preset[npresets] = sf->preset[sf->npresets - 1];
+
+	inst = NEW(SFInstHdr, ninsts + 1);
+	for (i = 0; i < sf->ninsts - 1; i++) {
+		if (instmap[i] < 0) {
+			drop_layers(&sf->inst[i].hdr);
+			continue;
+		}
+		inst[instmap[i]] = sf->inst[i];
+		remap_layers(&inst[instmap[i]].hdr, SF_GEN_SAMPLEID,
+			     samplemap, sf->nsamples - 1);
+	}
+	inst[ninsts] = sf->inst[sf->ninsts - 1];
+
+	sample = NEW(SFSampleInfo, nsamples + 1);
+	for (i = 0; i < sf->nsamples - 1; i++) {
+		SFSampleInfo *sp;
+		if (samplemap[i] < 0)
+			continue;
+		sp = &sample[samplemap[i]];
+		*sp = sf->sample[i];
+		if (sp->sampletype & LINKED_SAMPLE) {
+			n = sp->samplelink < sf->nsamples - 1 ?
+				samplemap[sp->samplelink] : -1;
+			sp->samplelink = n < 0 ? 0 : n;
+		}
+	}
+	sample[nsamples] = sf->sample[sf->nsamples - 1];
+
+	free(sf->preset);
+	free(sf->inst);
+	free(sf->sample);
+	sf->preset = preset;
+	sf->npresets = npresets + 1;
+	sf->inst = inst;
+	sf->ninsts = ninsts + 1;
+	sf->sample = sample;
+	sf->nsamples = nsamples + 1;
+
+	free(presetmap);
+	free(instmap);
+	free(samplemap);
+	return npresets;
+}
+
+
+/*----------------------------------------------------------------
+ * is the preset in the keep list?
+ *----------------------------------------------------------------*/
+
+static int preset_wanted(SFPresetHdr *pp, SFPresetId *keep, int nkeep)
+{
+	int i;
+	for (i = 0; i < nkeep; i++) {
+		if (keep[i].bank == pp->bank && keep[i].preset == pp->preset)
+			return 1;
+	}
+	return 0;
+}
+
+
+/*----------------------------------------------------------------
+ * mark the indices the given generator refers to
+ *----------------------------------------------------------------*/
+
+static void mark_layers(SFHeader *hdr, int oper, int *map, int nmap)
+{
+	int i, j;
+	for (i = 0; i < hdr->nlayers; i++) {
+		SFGenLayer *layp = &hdr->layer[i];
+		for (j = 0; j < layp->nlists; j++) {
+			uint16 ndx = layp->list[j].amount;
+			if (layp->list[j].oper == oper && ndx < nmap)
+				map[ndx] = 1;
+		}
+	}
+}
+
+
+/*----------------------------------------------------------------
+ * replace the indices the given generator refers to
+ *----------------------------------------------------------------*/
+
+static void remap_layers(SFHeader *hdr, int oper, int *map, int nmap)
+{
+	int i, j;
+	for (i = 0; i < hdr->nlayers; i++) {
+		SFGenLayer *layp = &hdr->layer[i];
+		for (j = 0; j < layp->nlists; j++) {
+			uint16 ndx = layp->list[j].amount;
+			if (layp->list[j].oper == oper && ndx < nmap)
+				layp->list[j].amount = map[ndx];
+		}
+	}
+}
+
+
+/*----------------------------------------------------------------
+ * turn marks into new indices; unmarked entries become -1
+ *----------------------------------------------------------------*/
+
+static int number_marks(int *map, int nmap)
+{
+	int i, n = 0;
+	for (i = 0; i < nmap; i++)
+		map[i] = map[i] ? n++ : -1;
+	return n;
+}
+
+
+/*----------------------------------------------------------------
+ * free the layers of a dropped header
+ *----------------------------------------------------------------*/
+
+static void drop_layers(SFHeader *hdr)
+{
+	int i;
+	for (i = 0; i < hdr->nlayers; i++) {
+		if (hdr->layer[i].nlists > 0)
+			free(hdr->layer[i].list);
+		if (hdr->layer[i].nmods > 0)
+			free(hdr->layer[i].mods);
+	}
+	if (hdr->nlayers > 0)
+		free(hdr->layer);
+	hdr->nlayers = 0;
+	hdr->layer = NULL;
+}
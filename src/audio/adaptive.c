@@ -0,0 +1,261 @@
+/*
+ * adaptive.c
+ * Adaptive just intonation: retuning keys to the chord being played.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include "audio/adaptive.h"
+#include "audio/fluid.h"
+#include "audio/midi.h"
+
+#define BIT(pc) (1 << (pc))
+#define ALL_PITCH_CLASSES (0xFFF)
+#define NO_ROOT (0xFF)
+/* how far a pitch class may drift from the static tuning, about a syntonic comma */
+#define MAX_DRIFT_CENTS (22.0)
+
+#define BENCH_EVENTS (100000)
+#define BENCH_POLYPHONY (6)
+/* the voices are rendered a block every so many events, so that they end */
+#define BENCH_BLOCK_EVENTS (8)
+#define BENCH_BLOCK_FRAMES (64)
+#define BENCH_RATE (44100)
+
+/* the chords recognised, as intervals above the root, the simpler first */
+static guint16 const chord_templates[] = {
+  BIT (0) | BIT (4) | BIT (7),                  /* major */
+  BIT (0) | BIT (3) | BIT (7),                  /* minor */
+  BIT (0) | BIT (5) | BIT (7),                  /* suspended fourth */
+  BIT (0) | BIT (3) | BIT (6),                  /* diminished */
+  BIT (0) | BIT (4) | BIT (7) | BIT (10),       /* dominant seventh */
+  BIT (0) | BIT (3) | BIT (7) | BIT (10),       /* minor seventh */
+  BIT (0) | BIT (4) | BIT (7) | BIT (11),       /* major seventh */
+};
+
+/* the 5-limit just intervals above the root */
+static gint const just_ratios[12][2] = {
+  {1, 1}, {16, 15}, {9, 8}, {6, 5}, {5, 4}, {4, 3},
+  {45, 32}, {3, 2}, {8, 5}, {5, 3}, {16, 9}, {15, 8}
+};
+
+/* for each set of pitch classes, the root of the chord it is part of */
+static guint8 chord_root[ALL_PITCH_CLASSES + 1];
+/* for each set of pitch classes, the lowest */
+static guint8 lowest_pitch_class[ALL_PITCH_CLASSES + 1];
+/* the deviation from equal temperament of each just interval */
+static gdouble just_cents[12];
+
+static gdouble base_pitch[128];
+static gdouble pitch_class_cents[12];   /* the deviation from equal temperament each pitch class is tuned to */
+static guint8 key_count[128];
+static guint16 pitch_class_count[12];
+static guint16 sounding;                /* the set of sounding pitch classes */
+
+static guint16
+rotate (guint16 set, gint by)
+{
+  return ((set << by) | (set >> (12 - by))) & ALL_PITCH_CLASSES;
+}
+
+static gint
+count_bits (guint16 set)
+{
+  gint n = 0;
+  for (; set; set &= set - 1)
+    n++;
+  return n;
+}
+
+/* the set belongs to the smallest chord containing it, preferring chords
+ * whose root is in the set, then the simpler chords */
+static guint8
+classify (guint16 set)
+{
+  gint best = G_MAXINT, root = NO_ROOT, t, r;
+  for (t = 0; t < (gint) G_N_ELEMENTS (chord_templates); t++)
+    for (r = 0; r < 12; r++)
+      {
+        gint score;
+        if (set & ~rotate (chord_templates[t], r))
+          continue;
+        score = (count_bits (chord_templates[t]) * 2 + !(set & BIT (r))) * 16 + t;
+        if (score < best)
+          {
+            best = score;
+            root = r;
+          }
+      }
+  return root;
+}
+
+void
+adaptive_tuning_init (void)
+{
+  gint set, pc, key;
+  for (set = 1; set <= ALL_PITCH_CLASSES; set++)
+    {
+      chord_root[set] = classify (set);
+      for (pc = 0; !(set & BIT (pc)); pc++)
+        ;
+      lowest_pitch_class[set] = pc;
+    }
+  chord_root[0] = lowest_pitch_class[0] = NO_ROOT;
+  for (pc = 0; pc < 12; pc++)
+    just_cents[pc] = 1200.0 * log2 ((gdouble) just_ratios[pc][0] / just_ratios[pc][1]) - 100.0 * pc;
+  for (key = 0; key < 128; key++)
+    base_pitch[key] = 100.0 * key;
+  adaptive_tuning_reset ();
+}
+
+static gdouble
+base_cents (gint pc)
+{
+  return base_pitch[60 + pc] - 100.0 * (60 + pc);
+}
+
+void
+adaptive_tuning_reset (void)
+{
+  gint pc;
+  memset (key_count, 0, sizeof (key_count));
+  memset (pitch_class_count, 0, sizeof (pitch_class_count));
+  sounding = 0;
+  for (pc = 0; pc < 12; pc++)
+    pitch_class_cents[pc] = base_cents (pc);
+}
+
+void
+adaptive_tuning_set_base (gdouble const pitch[128])
+{
+  memcpy (base_pitch, pitch, sizeof (base_pitch));
+  adaptive_tuning_reset ();
+}
+
+gdouble
+adaptive_tuning_note_on (gint key)
+{
+  gint pc, root, ref;
+  guint16 others;
+
+  if (key < 0 || key > 127)
+    return 0.0;
+  pc = key % 12;
+  others = sounding & ~BIT (pc);
+  if (key_count[key] < G_MAXUINT8)
+    key_count[key]++;
+  /* a pitch class that sounds already stays pure against its octaves */
+  if (pitch_class_count[pc]++ == 0)
+    {
+      sounding |= BIT (pc);
+      root = chord_root[others | BIT (pc)];
+      if (others == 0 || root == NO_ROOT)
+        pitch_class_cents[pc] = base_cents (pc);
+      else
+        {
+          gdouble cents;
+          ref = (others & BIT (root)) ? root : lowest_pitch_class[others];
+          cents = pitch_class_cents[ref] + just_cents[(pc - root + 12) % 12] - just_cents[(ref - root + 12) % 12];
+          pitch_class_cents[pc] = CLAMP (cents, base_cents (pc) - MAX_DRIFT_CENTS, base_cents (pc) + MAX_DRIFT_CENTS);
+        }
+    }
+  return pitch_class_cents[pc] - base_cents (pc);
+}
+
+void
+adaptive_tuning_note_off (gint key)
+{
+  gint pc;
+  if (key < 0 || key > 127 || key_count[key] == 0)
+    return;
+  key_count[key]--;
+  pc = key % 12;
+  if (--pitch_class_count[pc] == 0)
+    sounding &= ~BIT (pc);
+}
+
+#ifdef _HAVE_FLUIDSYNTH_
+/* plays the events, timing each; returns the total time in seconds */
+static gdouble
+bench_pass (gint const *events, gdouble * slowest)
+{
+  float left[BENCH_BLOCK_FRAMES], right[BENCH_BLOCK_FRAMES];
+  GTimer *timer = g_timer_new ();
+  gdouble total = 0.0;
+  gint i;
+
+  *slowest = 0.0;
+  for (i = 0; i < BENCH_EVENTS; i++)
+    {
+      guchar event[] = { events[i] < 0 ? MIDI_NOTE_OFF : MIDI_NOTE_ON, events[i] < 0 ? -1 - events[i] : events[i], 100 };
+      gdouble t;
+      if (i % BENCH_BLOCK_EVENTS == 0)
+        fluidsynth_process_block (BENCH_BLOCK_FRAMES, G_MAXDOUBLE, left, right);
+      g_timer_start (timer);
+      fluidsynth_feed_midi (event, sizeof (event));
+      t = g_timer_elapsed (timer, NULL);
+      total += t;
+      *slowest = MAX (*slowest, t);
+    }
+  fluidsynth_all_notes_off ();
+  g_timer_destroy (timer);
+  return total;
+}
+#endif
+
+gint
+adaptive_tuning_benchmark (HistoricHarpsichordPrefs * prefs)
+{
+#ifdef _HAVE_FLUIDSYNTH_
+  gint *events = g_new (gint, BENCH_EVENTS);
+  gint held[BENCH_POLYPHONY];
+  gdouble plain, plain_slowest, adaptive, adaptive_slowest;
+  GRand *rand = g_rand_new_with_seed (1);
+  gint i, nheld = 0, oldest = 0;
+
+  /* up to BENCH_POLYPHONY notes sound; a negative event releases key -1 - event */
+  for (i = 0; i < BENCH_EVENTS; i++)
+    if (nheld == BENCH_POLYPHONY)
+      {
+        events[i] = -1 - held[oldest];
+        held[oldest] = -1;
+        oldest = (oldest + 1) % BENCH_POLYPHONY;
+        nheld--;
+      }
+    else
+      {
+        events[i] = g_rand_int_range (rand, 36, 85);
+        held[(oldest + nheld++) % BENCH_POLYPHONY] = events[i];
+      }
+
+  /* the live synth is what adaptive tuning retunes */
+  prefs->resampled_bank = prefs->note_cache = FALSE;
+  if (fluidsynth_init (prefs, BENCH_RATE))
+    {
+      g_free (events);
+      g_rand_free (rand);
+      return 1;
+    }
+  prefs->adaptive_tuning = FALSE;
+  plain = bench_pass (events, &plain_slowest);
+  prefs->adaptive_tuning = TRUE;
+  adaptive = bench_pass (events, &adaptive_slowest);
+
+  g_print ("Without adaptive tuning: %d events in %.3f s, %.0f events/s, slowest event %.2f us\n", BENCH_EVENTS, plain, BENCH_EVENTS / MAX (plain, 1e-9), plain_slowest * 1e6);
+  g_print ("With adaptive tuning: %d events in %.3f s, %.0f events/s, slowest event %.2f us\n", BENCH_EVENTS, adaptive, BENCH_EVENTS / MAX (adaptive, 1e-9), adaptive_slowest * 1e6);
+  g_rand_free (rand);
+  g_free (events);
+  return 0;
+#else
+  g_warning ("Adaptive tuning needs FluidSynth");
+  return 1;
+#endif
+}
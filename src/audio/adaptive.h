@@ -0,0 +1,70 @@
+/*
+ * adaptive.h
+ * Adaptive just intonation: retuning keys to the chord being played.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <glib.h>
+#include <historicHarpsichord/historicHarpsichord_types.h>
+
+/**
+ * Builds the chord classification table. Call once before anything else.
+ */
+void adaptive_tuning_init (void);
+
+/*
+ * The following are called by the audio thread only, and neither allocate
+ * nor take time that depends on what is sounding.
+ */
+
+/**
+ * Sets the static tuning the adaptive one starts from whenever nothing
+ * sounds, and forgets the sounding notes.
+ *
+ * @param pitch  the pitch of each key, see tuning_build_table()
+ */
+void adaptive_tuning_set_base (gdouble const pitch[128]);
+
+/**
+ * Forgets the sounding notes, as when all notes are turned off.
+ */
+void adaptive_tuning_reset (void);
+
+/**
+ * Accounts for a note-on and works out the tuning the new note's pitch
+ * class needs to sound pure against the chord it completes. The chord is
+ * classified by looking up the set of sounding pitch classes; the new
+ * note is tuned by a just interval from its root, or from the lowest
+ * sounding pitch class if the root does not sound. A pitch class already
+ * sounding keeps its tuning, and notes already sounding are not retuned:
+ * the caller detunes the voices of the new note alone.
+ *
+ * @param key  the key struck
+ * @return  the cents to add to the static tuning of the key
+ */
+gdouble adaptive_tuning_note_on (gint key);
+
+/**
+ * Accounts for a note-off.
+ */
+void adaptive_tuning_note_off (gint key);
+
+/**
+ * Plays a stream of random chords through the synth, note-ons and
+ * note-offs as the audio thread handles them, with adaptive tuning and
+ * without, and prints the events handled per second and the slowest event.
+ *
+ * @return  an exit status
+ */
+gint adaptive_tuning_benchmark (HistoricHarpsichordPrefs * prefs);
+
+#endif // ADAPTIVE_H
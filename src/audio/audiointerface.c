@@ -23,10 +23,20 @@
 #include "audio/audiointerface.h"
 #include "audio/eventqueue.h"
 #include "audio/dummybackend.h"
+#include "audio/latency.h"
+#include "audio/trace.h"
+#include "audio/metrics.h"
+#include "audio/midirecord.h"
+#include "audio/startprofile.h"
+#include "audio/rtlog.h"
 
 #ifdef _HAVE_PORTAUDIO_
 #include "audio/portaudiobackend.h"
 #endif
+#ifdef _HAVE_FLUIDSYNTH_
+#include "audio/nullbackend.h"
+#include "audio/fluid.h"
+#endif
 #ifdef _HAVE_PORTMIDI_
 #include "audio/portmidibackend.h"
 #endif
@@ -35,6 +45,7 @@
 #endif
 
 #include "audio/midi.h"
+#include "audio/miditransform.h"
 #include "audio/temperament.h"
 
 #include <glib.h>
@@ -123,6 +134,14 @@ initialize_audio (HistoricHarpsichordPrefs * config)
       backends[AUDIO_BACKEND] = &portaudio_backend;
 #else
       g_warning ("PortAudio backend is not enabled");
+#endif
+    }
+  else if (strcmp (driver, "null") == 0)
+    {
+#ifdef _HAVE_FLUIDSYNTH_
+      backends[AUDIO_BACKEND] = &null_backend;
+#else
+      g_warning ("Null audio backend is not enabled");
 #endif
     }
   else if (strcmp (driver, "dummy") == 0)
@@ -141,7 +160,9 @@ initialize_audio (HistoricHarpsichordPrefs * config)
 
   //event_queues[AUDIO_BACKEND] = event_queue_new(PLAYBACK_QUEUE_SIZE, IMMEDIATE_QUEUE_SIZE, 0);
 
+  startup_phase_begin ("audio backend");
   int ret = get_backend (AUDIO_BACKEND)->initialize (config);
+  startup_phase_end ();
 
   if (ret)
     {
@@ -194,7 +215,9 @@ initialize_midi (HistoricHarpsichordPrefs * config)
 
   //event_queues[MIDI_BACKEND] = event_queue_new(PLAYBACK_QUEUE_SIZE, IMMEDIATE_QUEUE_SIZE, INPUT_QUEUE_SIZE);
 
+  startup_phase_begin ("MIDI backend");
   int ret = get_backend (MIDI_BACKEND)->initialize (config);
+  startup_phase_end ();
 
   if (ret)
     {
@@ -210,8 +233,10 @@ initialize_midi (HistoricHarpsichordPrefs * config)
 int
 audio_initialize (HistoricHarpsichordPrefs * config)
 {
+  rtlog_start ();
   queue_thread = NULL;
   quit_thread = FALSE;
+  midi_transform_compile (config);
  
 
   //&queue_cond = g_cond_new (); since GLib 2.32 no longer needed, static declaration is enough
@@ -228,7 +253,7 @@ audio_initialize (HistoricHarpsichordPrefs * config)
 );
   if (initialize_audio (config) || initialize_midi(config))
     {
-      audio_shutdown ();
+      audio_close ();
       return -1;
     }
 
@@ -236,7 +261,7 @@ audio_initialize (HistoricHarpsichordPrefs * config)
 
   if (queue_thread == NULL)
     {
-      audio_shutdown();
+      audio_close ();
       return -1;
     }
 
@@ -250,13 +275,14 @@ destroy (backend_type_t backend)
   backends[backend] = NULL;
 
   event_queue_free (event_queues[backend]);
+  event_queues[backend] = NULL;
 
   return 0;
 }
 
 
 int
-audio_shutdown ()
+audio_close ()
 {
   g_atomic_int_set (&quit_thread, TRUE);
 
@@ -276,6 +302,7 @@ audio_shutdown ()
     {
       destroy (MIDI_BACKEND);
     }
+  rtlog_stop ();
 
  //g_cond_free (&queue_cond); since GLib 2.32 no longer needed, static declaration is enough
  //g_mutex_free (&queue_mutex); since GLib 2.32 no longer needed, static declaration is enough
@@ -283,9 +310,22 @@ audio_shutdown ()
   return 0;
 }
 
-static gboolean do_handle_midi_event (gchar *data) {
-  handle_midi_event (data);
-  g_free(data);
+int
+audio_shutdown ()
+{
+  audio_close ();
+#ifdef _HAVE_FLUIDSYNTH_
+  fluidsynth_shutdown ();
+#endif
+  return 0;
+}
+
+static gboolean do_handle_midi_event (midi_event_t *ev) {
+  latency_mark_event (LATENCY_MAIN, ev->data);
+  TRACE_BEGIN ("handle_midi_event");
+  handle_midi_event ((gchar *) ev->data, ev->length);
+  TRACE_END ("handle_midi_event");
+  g_free (ev);
   return FALSE;
 }
 static gboolean
@@ -295,11 +335,7 @@ handle_midi_event_callback (gpointer data)
   midi_event_t *ev = (midi_event_t *) data;
 
   // TODO: handle backend type and port
-  gchar *evdata = g_malloc (sizeof (ev->data));
-  memcpy (evdata, ev->data, sizeof (ev->data));
-  g_main_context_invoke (NULL, (GSourceFunc)do_handle_midi_event, evdata);
-
-  g_free (ev);
+  g_main_context_invoke (NULL, (GSourceFunc)do_handle_midi_event, ev);
 
   return FALSE;
 }
@@ -341,10 +377,14 @@ queue_thread_func (gpointer data)
 
       midi_event_t *ev;
 
+      TRACE_BEGIN ("queue_thread_func");
       while ((ev = event_queue_read_input (get_event_queue (MIDI_BACKEND))) != NULL)
         {
+          latency_mark_event (LATENCY_QUEUE, ev->data);
           g_idle_add_full (G_PRIORITY_HIGH_IDLE, handle_midi_event_callback, (gpointer) ev, NULL);
         }
+      TRACE_END ("queue_thread_func");
+      metrics_thread_cpu (METRICS_THREAD_QUEUE);
 
     }
 
@@ -402,7 +442,7 @@ update_playback_time (backend_timebase_prio_t prio, double new_time)
       // queue thread wakes up on its own
       if (!try_signal_queue ())
         {
-          ;//this is continuously emitted by windows which has debug on. g_debug ("Couldn't signal playback time update to queue");
+          rtlog (RTLOG_DEBUG, "Couldn't signal playback time update to queue");
         }
     }
 }
@@ -438,22 +478,23 @@ midi_stop (void)
 #define MIDI_EOX (0xF7)
 
 int
-play_midi_event (backend_type_t backend, int port, unsigned char *buffer)
+play_midi_event (backend_type_t backend, int port, unsigned char *buffer, int length)
 {
-  guchar ev[1 + 255];           /* 1 length byte plus up to 255 data bytes */
-  gint i = 3;
+  gboolean written;
+  if (length <= 0 || length > MIDI_EVENT_MAX_LENGTH)
+    return FALSE;
+  /* a SysEx message is passed on up to but not including its EOX */
   if (buffer[0] == SYS_EXCLUSIVE_MESSAGE1)
     {
-      for (i = 0; i < 255; i++)
-        if (buffer[i] == MIDI_EOX)
-          break;
-      if (i == 255)
+      if (buffer[length - 1] != MIDI_EOX)
         return FALSE;
+      length--;
     }
-  *ev = i;
-  memcpy (ev + 1, buffer, i);//g_print (" %d midibytes 0x%hhX 0x%hhX 0x%hhX\n", i,  *(buffer+0), *(buffer+1), *(buffer+2));
-
-  return event_queue_write_immediate (get_event_queue (backend), ev, i + 1);
+  //g_print (" %d midibytes 0x%hhX 0x%hhX 0x%hhX\n", length,  *(buffer+0), *(buffer+1), *(buffer+2));
+  TRACE_BEGIN ("play_midi_event");
+  written = event_queue_write_immediate (get_event_queue (backend), buffer, length);
+  TRACE_END ("play_midi_event");
+  return written;
 }
 
 
@@ -467,26 +508,48 @@ panic (backend_type_t backend)
 
 
 void
-input_midi_event (backend_type_t backend, int port, unsigned char *buffer)
+input_midi_event (backend_type_t backend, int port, unsigned char const *buffer, int length)
 {
   midi_event_t ev;
+  unsigned char status = buffer[0];
+  latency_mark_event (LATENCY_INPUT, buffer);
+  midi_record_event (buffer, length);
+  TRACE_BEGIN ("input_midi_event");
   ev.backend = backend;
   ev.port = port;
-  // FIXME: size might be less than 3
-  memcpy (&ev.data, buffer, 3);
+  ev.length = length;
 
   // normalize events: replace note-on with zero velocity by note-off
-  if ((ev.data[0] & 0xf0) == MIDI_NOTE_ON && ev.data[2] == 0)
+  if ((status & 0xf0) == MIDI_NOTE_ON && length == 3 && buffer[2] == 0)
     {
-      ev.data[0] = (ev.data[0] & 0x0f) | MIDI_NOTE_OFF;
+      status = (status & 0x0f) | MIDI_NOTE_OFF;
     }
 
-  event_queue_write_input (get_event_queue (backend), &ev);
+  event_queue_write_input (get_event_queue (backend), &ev, status, buffer + 1);
   // if the lock fails, processing of the event will be delayed until the
   // queue thread wakes up on its own
   if (!try_signal_queue ())
     {
-      g_debug ("Couldn't signal MIDI event input to queue");
+      rtlog (RTLOG_DEBUG, "Couldn't signal MIDI event input to queue");
+    }
+  TRACE_END ("input_midi_event");
+}
+
+
+void
+get_event_counts (guint * input_written, guint * input_dropped, guint * immediate_written, guint * immediate_dropped)
+{
+  int i;
+  *input_written = *input_dropped = *immediate_written = *immediate_dropped = 0;
+  for (i = 0; i < NUM_BACKENDS; i++)
+    {
+      event_queue_t *queue = event_queues[i];
+      if (queue == NULL)
+        continue;
+      *input_written += g_atomic_int_get (&queue->input_written);
+      *input_dropped += g_atomic_int_get (&queue->input_dropped);
+      *immediate_written += g_atomic_int_get (&queue->immediate_written);
+      *immediate_dropped += g_atomic_int_get (&queue->immediate_dropped);
     }
 }
 
@@ -131,12 +131,21 @@ typedef enum backend_timebase_prio_t
 } backend_timebase_prio_t;
 
 
+/**
+ * The longest event the queues carry, room for a MIDI Tuning Standard bulk
+ * dump.
+ */
+#define MIDI_EVENT_MAX_LENGTH (512)
+
 typedef struct midi_event_t
 {
   backend_type_t backend;
   int port;
   int length;
-  unsigned char data[3];
+  /**
+   * The length bytes of the event, stored inline after the structure.
+   */
+  unsigned char data[];
 } midi_event_t;
 
 
@@ -148,7 +157,16 @@ typedef struct midi_event_t
 int audio_initialize (HistoricHarpsichordPrefs * config);
 
 /**
- * Destroys and cleans up the audio/MIDI subsystem.
+ * Destroys and cleans up the audio/MIDI subsystem, leaving the user's
+ * preferences alone, for the runs of the test tools.
+ *
+ * @return        zero on success, a negative error code on failure
+ */
+int audio_close ();
+
+/**
+ * Destroys and cleans up the audio/MIDI subsystem as audio_close() does,
+ * and deletes the user's preferences file with fluidsynth_shutdown().
  *
  * @return        zero on success, a negative error code on failure
  */
@@ -161,8 +179,9 @@ int audio_shutdown ();
  * @param port      the number of the backend's output port to be used. ignored
  *                  by most backends.
  * @param buffer    the MIDI data to be sent
+ * @param length    the number of bytes in buffer
  */
-int play_midi_event (backend_type_t backend, int port, unsigned char *buffer);
+int play_midi_event (backend_type_t backend, int port, unsigned char *buffer, int length);
 
 int panic (backend_type_t backend);
 
@@ -190,7 +209,14 @@ gboolean read_event_from_queue (backend_type_t backend, unsigned char *event_buf
  * @param port      the port that received the event (zero if there is only
  *                  one port)
  * @param buffer    the MIDI event data
+ * @param length    the length of the event, at most MIDI_EVENT_MAX_LENGTH
+ */
+void input_midi_event (backend_type_t backend, int port, unsigned char const *buffer, int length);
+
+/**
+ * Counts the events written to the input and immediate playback queues of
+ * both backends, and those dropped because a queue was full.
  */
-void input_midi_event (backend_type_t backend, int port, unsigned char *buffer);
+void get_event_counts (guint * input_written, guint * input_dropped, guint * immediate_written, guint * immediate_dropped);
 
 #endif // AUDIOINTERFACE_H
@@ -0,0 +1,111 @@
+/*
+ * audiostats.c
+ * How close the audio callback comes to its deadline.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "audio/audiostats.h"
+
+/* written by the audio thread only, a field at a time, read by anyone */
+static audio_stats_t counters;
+static gint reset_requested = FALSE;
+
+#define SET(field, value) g_atomic_int_set (&counters.field, (value))
+#define GET(field) g_atomic_int_get (&counters.field)
+
+void
+audio_stats_record (guint frames, guint rate, gint64 elapsed, guint events, guint voices, gboolean underflow, gboolean overflow)
+{
+  guint load, bucket;
+  if (g_atomic_int_get (&reset_requested))
+    {
+      memset (&counters, 0, sizeof (counters));
+      g_atomic_int_set (&reset_requested, FALSE);
+    }
+  /* the time taken over the period, both in microseconds */
+  load = frames && rate ? (guint) (elapsed * 1000 * (gint64) rate / (frames * (gint64) 1000000)) : 0;
+
+  SET (blocks, GET (blocks) + 1);
+  SET (period_frames, frames);
+  if (underflow)
+    SET (underflows, GET (underflows) + 1);
+  if (overflow)
+    SET (overflows, GET (overflows) + 1);
+  bucket = MIN (load / 50, AUDIO_STATS_LOAD_BUCKETS - 1);
+  SET (load_histogram[bucket], GET (load_histogram[bucket]) + 1);
+  if (load > GET (max_load_permille))
+    SET (max_load_permille, load);
+  SET (events, GET (events) + events);
+  if (events > GET (max_events))
+    SET (max_events, events);
+  if (voices > GET (max_voices))
+    SET (max_voices, voices);
+  SET (voices, voices);
+}
+
+void
+audio_stats_get (audio_stats_t * stats)
+{
+  gint i;
+  stats->blocks = GET (blocks);
+  stats->period_frames = GET (period_frames);
+  stats->underflows = GET (underflows);
+  stats->overflows = GET (overflows);
+  for (i = 0; i < AUDIO_STATS_LOAD_BUCKETS; i++)
+    stats->load_histogram[i] = GET (load_histogram[i]);
+  stats->max_load_permille = GET (max_load_permille);
+  stats->events = GET (events);
+  stats->max_events = GET (max_events);
+  stats->max_voices = GET (max_voices);
+  stats->voices = GET (voices);
+}
+
+void
+audio_stats_reset (void)
+{
+  g_atomic_int_set (&reset_requested, TRUE);
+}
+
+gdouble
+audio_stats_load_quantile (audio_stats_t const *stats, gdouble q)
+{
+  guint total = 0, seen = 0, i;
+  for (i = 0; i < AUDIO_STATS_LOAD_BUCKETS; i++)
+    total += stats->load_histogram[i];
+  if (total == 0)
+    return 0.0;
+  for (i = 0; i < AUDIO_STATS_LOAD_BUCKETS - 1; i++)
+    {
+      seen += stats->load_histogram[i];
+      if (seen >= q * total)
+        return (i + 1) * 0.05;
+    }
+  return stats->max_load_permille / 1000.0;
+}
+
+gchar *
+audio_stats_format (audio_stats_t const *stats)
+{
+  GString *text = g_string_new ("");
+  gint i, last = 0;
+  g_string_append_printf (text, "%u blocks of %u frames, %u underflows, %u overflows, peak load %.1f%%\n",
+                          stats->blocks, stats->period_frames, stats->underflows, stats->overflows, stats->max_load_permille / 10.0);
+  g_string_append_printf (text, "%u events, at most %u in a block, at most %u voices\n", stats->events, stats->max_events, stats->max_voices);
+  for (i = 0; i < AUDIO_STATS_LOAD_BUCKETS; i++)
+    if (stats->load_histogram[i])
+      last = i;
+  for (i = 0; i <= last; i++)
+    if (i < AUDIO_STATS_LOAD_BUCKETS - 1)
+      g_string_append_printf (text, "  load %3d-%3d%%: %u\n", i * 5, i * 5 + 5, stats->load_histogram[i]);
+    else
+      g_string_append_printf (text, "  load  >=100%%: %u\n", stats->load_histogram[i]);
+  return g_string_free (text, FALSE);
+}
@@ -0,0 +1,74 @@
+/*
+ * audiostats.h
+ * How close the audio callback comes to its deadline.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef AUDIOSTATS_H
+#define AUDIOSTATS_H
+
+#include <glib.h>
+
+/**
+ * The load histogram has a bucket for each 5% of the period, the last for
+ * blocks that took the whole period or more.
+ */
+#define AUDIO_STATS_LOAD_BUCKETS (21)
+
+typedef struct audio_stats_t
+{
+  guint blocks;
+  guint period_frames;          /**< the frames in the last block */
+  guint underflows;             /**< blocks the backend reported the output ran dry before */
+  guint overflows;
+  /**
+   * Blocks by the time they took to render as a fraction of their period.
+   */
+  guint load_histogram[AUDIO_STATS_LOAD_BUCKETS];
+  guint max_load_permille;
+  guint events;                 /**< MIDI events fed to the synth */
+  guint max_events;             /**< the most in one block */
+  guint max_voices;             /**< the most voices sounding at the end of a block */
+  guint voices;                 /**< the voices sounding at the end of the last block */
+} audio_stats_t;
+
+/**
+ * Records a block. Called by the audio thread at the end of each callback;
+ * takes no locks.
+ *
+ * @param frames  the frames in the block
+ * @param rate  the sample rate
+ * @param elapsed  the time the callback took in microseconds
+ */
+void audio_stats_record (guint frames, guint rate, gint64 elapsed, guint events, guint voices, gboolean underflow, gboolean overflow);
+
+/**
+ * Copies the counters without disturbing the audio thread. They are read
+ * one by one, so may be a block apart from each other.
+ */
+void audio_stats_get (audio_stats_t * stats);
+
+/**
+ * Has the audio thread zero the counters at its next block.
+ */
+void audio_stats_reset (void);
+
+/**
+ * Returns the load below which the given fraction of the blocks fell, as
+ * a fraction of the period rounded up to the histogram's 5%, or the peak
+ * load for the blocks in the last bucket.
+ */
+gdouble audio_stats_load_quantile (audio_stats_t const *stats, gdouble q);
+
+/**
+ * Returns a summary of the counters for printing, to be freed with g_free().
+ */
+gchar *audio_stats_format (audio_stats_t const *stats);
+
+#endif // AUDIOSTATS_H
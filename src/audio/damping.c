@@ -0,0 +1,55 @@
+/*
+ * damping.c
+ * The harpsichord's damper, modelled as a release envelope that depends on
+ * how long the note has sounded.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include "audio/damping.h"
+
+/* the release of a note let off as soon as it is struck is this many times
+ * that of the SoundFont, falling to 1 as the string decays */
+#define MAX_RELEASE_STRETCH (8.0)
+/* the string decays by a factor of e every this many seconds */
+#define DECAY_SECONDS (1.0)
+#define DECAY_TABLE_STEPS_PER_SECOND (100)
+#define DECAY_TABLE_SIZE (512)
+
+static gfloat decay_table[DECAY_TABLE_SIZE];    /* the release offset, by time held */
+static guint64 frames_per_step = 1;
+static guint64 struck[16][128];
+
+void
+damping_init (guint sample_rate)
+{
+  gint i;
+  frames_per_step = MAX (sample_rate / DECAY_TABLE_STEPS_PER_SECOND, 1);
+  for (i = 0; i < DECAY_TABLE_SIZE; i++)
+    {
+      gdouble held = (gdouble) i / DECAY_TABLE_STEPS_PER_SECOND;
+      decay_table[i] = (gfloat) (1200.0 * log2 (1.0 + (MAX_RELEASE_STRETCH - 1.0) * exp (-held / DECAY_SECONDS)));
+    }
+  memset (struck, 0, sizeof (struck));
+}
+
+void
+damping_note_on (gint chan, gint key, guint64 now)
+{
+  struck[chan & 0x0F][key & 0x7F] = now;
+}
+
+gfloat
+damping_release_offset (gint chan, gint key, guint64 now)
+{
+  guint64 step = (now - struck[chan & 0x0F][key & 0x7F]) / frames_per_step;
+  return decay_table[MIN (step, DECAY_TABLE_SIZE - 1)];
+}
@@ -0,0 +1,45 @@
+/*
+ * damping.h
+ * The harpsichord's damper, modelled as a release envelope that depends on
+ * how long the note has sounded.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef DAMPING_H
+#define DAMPING_H
+
+#include <glib.h>
+
+/**
+ * Builds the decay table for the sample rate. Call before the audio thread
+ * starts.
+ */
+void damping_init (guint sample_rate);
+
+/*
+ * The following are called by the audio thread only; time is counted in
+ * frames rendered.
+ */
+
+/**
+ * Records when a note was struck.
+ */
+void damping_note_on (gint chan, gint key, guint64 now);
+
+/**
+ * Returns how much the release of a note let off now is to be lengthened.
+ * A freshly plucked string is still ringing strongly when the damper falls
+ * on it, so it dies away over a longer time than one that has already
+ * decayed.
+ *
+ * @return  an offset to the volume envelope release, in timecents
+ */
+gfloat damping_release_offset (gint chan, gint key, guint64 now);
+
+#endif // DAMPING_H
@@ -61,7 +61,7 @@ process_thread_func (gpointer data)
       double now = (double) tv.tv_sec + tv.tv_usec / 1000000.0;
       double playback_time = now - playback_start_time;
 
-      unsigned char event_data[3];
+      unsigned char event_data[MIDI_EVENT_MAX_LENGTH];
       size_t event_length;
       double event_time;
 
@@ -33,15 +33,16 @@ event_queue_new (size_t playback_queue_size, size_t immediate_queue_size, size_t
 {
   event_queue_t *queue = g_malloc0 (sizeof (event_queue_t));
 
+  /* room for the given number of short events and then one of the longest */
   if (immediate_queue_size)
     {
-      queue->immediate = jack_ringbuffer_create (immediate_queue_size * sizeof (midi_event_t));
+      queue->immediate = jack_ringbuffer_create (immediate_queue_size * (sizeof (guint16) + 3) + sizeof (guint16) + MIDI_EVENT_MAX_LENGTH);
       jack_ringbuffer_reset (queue->immediate);
     }
 
   if (input_queue_size)
     {
-      queue->input = jack_ringbuffer_create (input_queue_size * sizeof (midi_event_t));
+      queue->input = jack_ringbuffer_create ((input_queue_size + 1) * sizeof (midi_event_t) + input_queue_size * 3 + MIDI_EVENT_MAX_LENGTH);
       jack_ringbuffer_reset (queue->input);
     }
 
@@ -73,11 +74,15 @@ event_queue_free (event_queue_t * queue)
 gboolean
 event_queue_write_immediate (event_queue_t * queue, guchar * data, guint length)
 {
-  if (!queue->immediate || jack_ringbuffer_write_space (queue->immediate) < length)
+  guint16 prefix = length;
+  if (!queue->immediate || length > MIDI_EVENT_MAX_LENGTH || jack_ringbuffer_write_space (queue->immediate) < sizeof (prefix) + length)
     {
+      g_atomic_int_inc (&queue->immediate_dropped);
       return FALSE;
     }
+  jack_ringbuffer_write (queue->immediate, (char const *) &prefix, sizeof (prefix));
   size_t n = jack_ringbuffer_write (queue->immediate, (char const *) data, length);
+  g_atomic_int_inc (&queue->immediate_written);
 
   return n == length;
 
@@ -87,36 +92,37 @@ event_queue_write_immediate (event_queue_t * queue, guchar * data, guint length)
 gboolean
 event_queue_read_output (event_queue_t * queue, unsigned char *event_buffer, size_t * event_length, double *event_time, double until_time)
 {
-  if (jack_ringbuffer_read_space (queue->immediate))
+  guint16 length;
+  /* the writer puts the length first, so the event may not all be there yet */
+  if (jack_ringbuffer_peek (queue->immediate, (char*) &length, sizeof (length)) == sizeof (length)
+      && jack_ringbuffer_read_space (queue->immediate) >= sizeof (length) + length)
     {
-      jack_ringbuffer_data_t vec[2];
-      jack_ringbuffer_get_read_vector (queue->immediate, vec);
-      if (vec[0].len)
-        {
-          guchar length;
-          jack_ringbuffer_read (queue->immediate, (char*) &length, 1);
-          //g_assert (length < 255);
-          jack_ringbuffer_read (queue->immediate, (char*) event_buffer, length);
-          *event_length = length;
-          *event_time = 0.0;
-          return TRUE;
-        }
+      jack_ringbuffer_read_advance (queue->immediate, sizeof (length));
+      jack_ringbuffer_read (queue->immediate, (char*) event_buffer, length);
+      *event_length = length;
+      *event_time = 0.0;
+      return TRUE;
     }
- 
+  return FALSE;
 }
 
 
 gboolean
-event_queue_write_input (event_queue_t * queue, midi_event_t const *event)
+event_queue_write_input (event_queue_t * queue, midi_event_t const *event, unsigned char status, unsigned char const *data)
 {
-  if (!queue->input || jack_ringbuffer_write_space (queue->input) < sizeof (midi_event_t))
+  if (!queue->input || event->length < 1 || event->length > MIDI_EVENT_MAX_LENGTH
+      || jack_ringbuffer_write_space (queue->input) < sizeof (midi_event_t) + event->length)
     {
+      g_atomic_int_inc (&queue->input_dropped);
       return FALSE;
     }
 
-  size_t n = jack_ringbuffer_write (queue->input, (char *) event, sizeof (midi_event_t));
+  jack_ringbuffer_write (queue->input, (char const *) event, sizeof (midi_event_t));
+  jack_ringbuffer_write (queue->input, (char const *) &status, 1);
+  size_t n = jack_ringbuffer_write (queue->input, (char const *) data, event->length - 1);
+  g_atomic_int_inc (&queue->input_written);
 
-  return n == sizeof (midi_event_t);
+  return n == (size_t) event->length - 1;
 }
 
 
@@ -128,10 +134,13 @@ event_queue_read_input (event_queue_t * queue)
       return NULL;
     }
 
-  if (jack_ringbuffer_read_space (queue->input))
+  midi_event_t header;
+  /* the writer puts the header first, so the data may not all be there yet */
+  if (jack_ringbuffer_peek (queue->input, (char *) &header, sizeof (header)) == sizeof (header)
+      && jack_ringbuffer_read_space (queue->input) >= sizeof (header) + header.length)
     {
-      midi_event_t *ev = g_malloc (sizeof (midi_event_t));
-      jack_ringbuffer_read (queue->input, (char *) ev, sizeof (midi_event_t));
+      midi_event_t *ev = g_malloc (sizeof (midi_event_t) + header.length);
+      jack_ringbuffer_read (queue->input, (char *) ev, sizeof (midi_event_t) + header.length);
       return ev;
     }
   else
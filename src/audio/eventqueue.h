@@ -49,7 +49,15 @@ typedef struct event_queue_t
    */
   jack_ringbuffer_t *input;
 
-
+  /**
+   * The events written to each queue and those dropped because it was full
+   * or they were too long, counted for monitoring. Read them with
+   * g_atomic_int_get().
+   */
+  guint immediate_written;
+  guint immediate_dropped;
+  guint input_written;
+  guint input_dropped;
 
 } event_queue_t;
 
@@ -87,11 +95,12 @@ void event_queue_reset_playback (event_queue_t * queue);
 void event_queue_reset_mixer (event_queue_t * queue);
 
 /**
- * Writes an event to the immmediate playback queue.
+ * Writes an event to the immmediate playback queue, preceded by its length.
  *
  * @param data   the event or extended_event to be written to the queue. The event data will be
  *                copied.
- * @param length  length of the event or extended_event to be written to the queue.
+ * @param length  length of the event or extended_event to be written to the queue,
+ *                at most MIDI_EVENT_MAX_LENGTH.
  *
  * @return        TRUE if the event was successfully written to the queue
  */
@@ -115,19 +124,23 @@ gboolean event_queue_read_output (event_queue_t * queue, unsigned char *event_bu
 
 
 /**
- * Writes an event to the input queue.
+ * Writes an event to the input queue, its data inline after the header.
+ * Does not allocate, so backends may call it from their MIDI callbacks.
  *
- * @param event   the event to be written to the queue. The event data will be
- *                copied.
+ * @param event   the header of the event to be written to the queue, with
+ *                the length of its data
+ * @param status  the first byte of the data
+ * @param data    the rest of the data. The event data will be copied.
  *
  * @return        TRUE if the event was successfully written to the queue
  */
-gboolean event_queue_write_input (event_queue_t * queue, midi_event_t const *event);
+gboolean event_queue_write_input (event_queue_t * queue, midi_event_t const *event, unsigned char status, unsigned char const *data);
 
 /**
  * Reads an event from the input queue.
  *
- * @return  a pointer to a newly allocated structure containing the event data.
+ * @return  a pointer to a newly allocated structure containing the event data,
+ *          or NULL if no whole event is queued.
  *          The caller is responsible for calling g_free() on this pointer.
  */
 midi_event_t *event_queue_read_input (event_queue_t * queue);
@@ -24,33 +24,539 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "audio/fluid.h"
 #include "audio/midi.h"
 #include "audio/temperament.h"
+#include "audio/sfcatalog.h"
+#include "audio/sfcache.h"
+#include "audio/sfresample.h"
+#include "audio/notecache.h"
+#include "audio/adaptive.h"
+#include "audio/damping.h"
+#include "audio/voicepolicy.h"
+#include "audio/ringbuffer.h"
+#include "audio/audiointerface.h"
+#include "audio/latency.h"
+#include "audio/startprofile.h"
+#include "audio/rtlog.h"
 
 #include <fluidsynth.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "core/utils.h"
 
 static fluid_settings_t *settings = NULL;
 static fluid_synth_t *synth = NULL;
 static int sfont_id = -1;
 
-void reset_synth_channels (void)
+/*
+ * With the resampled_bank preference a second synth plays a bank resampled
+ * for the current tuning and output rate, see sfresample.h. It is built in
+ * a background thread; the audio thread switches to whichever synth is
+ * requested at the next block, and a synth it has let go of is freed on the
+ * main thread.
+ */
+static fluid_synth_t *base_synth = NULL;        /* plays the SoundFont the user chose, tuned live */
+static fluid_synth_t *bank_synth = NULL;        /* plays the resampled bank */
+static int bank_sfont_id = -1;
+static guint64 bank_bytes = 0;                  /* the sample data of the bank */
+static gdouble bank_cents[128];                 /* the tuning built into the bank */
+static fluid_synth_t *requested_synth = NULL;   /* the synth the audio thread is to play */
+static fluid_synth_t *acked_synth = NULL;       /* the synth the audio thread last switched to */
+static GList *retired_synths = NULL;
+static gchar *user_soundfont = NULL;            /* the SoundFont as chosen, for the cache */
+static gchar *playback_soundfont = NULL;        /* the file base_synth loaded */
+static unsigned int synth_rate = 0;
+static guint bank_request = 0;                  /* counts the banks asked for */
+static gint jobs_running = 0;                   /* the bank and cache jobs not yet handed back */
+
+/*
+ * With the note_cache preference the plucks of the resampled bank are then
+ * rendered in another background thread, see notecache.h. The cache is
+ * handed to the audio thread and let go of in the same way as the synths,
+ * always after the bank synth has been requested and before it is retired.
+ */
+static note_cache *bank_cache = NULL;           /* the cache of the bank_synth */
+static note_cache *requested_cache = NULL;
+static note_cache *acked_cache = NULL;
+static note_cache *playing_cache = NULL;        /* the cache the audio thread mixes from */
+static GList *retired_caches = NULL;
+
+/*
+ * The base synth is tuned by a table of the pitch of every key. The main
+ * thread builds the synth's tuning from it in a tuning program of bank 0,
+ * since FluidSynth allocates as it does so, and sends the program with a
+ * CONTROL_TUNING command; the audio thread only selects it. The programs
+ * are used in turn, so one is rebuilt only after more tunings than the
+ * control queue holds have been sent since, by when the audio thread has
+ * moved off it. The audio thread lets go of the old table in the same way
+ * as of the synths.
+ */
+#define TUNING_PROGRAMS (128)
+static gdouble *requested_tuning = NULL;        /* the table last sent */
+static gdouble *acked_tuning = NULL;            /* the table the audio thread tunes by */
+static GList *retired_tunings = NULL;
+static gint sent_program = 0;                   /* main thread: the tuning program last built */
+static gint tuning_program = 0;                 /* audio thread: the tuning program selected */
+static gboolean adapted = FALSE;                /* whether adaptive tuning has retuned keys */
+static guint64 frame_clock = 0;                 /* the frames rendered, the audio thread's time */
+
+/*
+ * The keys held on each channel, a bit for each. The audio thread sets and
+ * clears them as it plays the events; anyone may read them.
+ */
+static guint active_notes[16][4];
+
+/*
+ * Changes to the synth are sent by the main thread, which prepares any
+ * heavy state beforehand, and applied by the audio thread at the start of
+ * the next block, each at a bounded cost, so that none can cause an xrun.
+ */
+typedef enum
+{
+  CONTROL_PANIC,                /* let off the keys held and reselect the presets and tuning */
+  CONTROL_TUNING,               /* retune the base synth by a prepared table */
+} control_type;
+
+typedef struct control_command
+{
+  control_type type;
+  gdouble *tuning;
+  gint program;                 /* the tuning program built from the table */
+} control_command;
+
+#define CONTROL_QUEUE_COMMANDS (64)
+static jack_ringbuffer_t *control_queue = NULL;
+
+typedef struct bank_job
+{
+  guint request;
+  gchar *source;
+  gchar *dest;
+  guint rate;
+  gdouble key_cents[128];
+  fluid_synth_t *synth;
+  int sfont_id;
+} bank_job;
+
+typedef struct cache_job
+{
+  guint request;
+  gchar *bank;
+  note_cache *cache;
+} cache_job;
+
+static void fluid_all_notes_off (void);
+
+/* main thread: builds a tuning program of the base synth from a table,
+ * or equal temperament if pitch is NULL */
+static void
+build_tuning (gint program, gdouble const *pitch)
+{
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+  fluid_synth_activate_key_tuning (base_synth, 0, program, "HistoricHarpsichord", pitch, FALSE);
+#else
+  fluid_synth_create_key_tuning (base_synth, 0, program, "HistoricHarpsichord", (double *) pitch);
+#endif
+}
+
+/* audio thread: selects the current tuning program on every channel,
+ * retuning the notes sounding if apply */
+static void
+select_tuning (fluid_synth_t * s, gboolean apply)
 {
-  // select bank 0 and preset 0 in the soundfont we just loaded on channel 0
-  fluid_synth_program_select (synth, 0, sfont_id, 0, 0);
   gint i;
   for (i = 0; i < 16; i++)
-    fluid_synth_program_change (synth, i, 0);
-  set_tuning ();
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+    fluid_synth_activate_tuning (s, i, 0, tuning_program, apply);
+#else
+    fluid_synth_select_tuning (s, i, 0, tuning_program);
+#endif
+}
+
+/* called by the audio thread before it touches the synth */
+static fluid_synth_t *
+current_synth (void)
+{
+  fluid_synth_t *requested = g_atomic_pointer_get (&requested_synth);
+  if (requested != synth)
+    {
+      /* notes still sounding on the old synth are cut off */
+      fluid_all_notes_off ();
+      voice_policy_reset ();
+      synth = requested;
+      g_atomic_pointer_set (&acked_synth, synth);
+    }
+  if (g_atomic_pointer_get (&requested_cache) != playing_cache)
+    {
+      note_cache_stop ();
+      playing_cache = g_atomic_pointer_get (&requested_cache);
+      g_atomic_pointer_set (&acked_cache, playing_cache);
+    }
+  return synth;
+}
+
+static void
+select_program (fluid_synth_t * s, int id)
+{
+  gint i;
+  // select bank 0 and preset 0 in the soundfont we loaded on every channel,
+  // the note cache's continuation channels included
+  for (i = 0; i < NOTE_CACHE_SYNTH_CHANNELS; i++)
+    fluid_synth_program_select (s, i, id, 0, 0);
+}
+
+void reset_synth_channels (void)
+{
+  fluid_synth_t *s = current_synth ();
+  select_program (s, s == base_synth ? sfont_id : bank_sfont_id);
+  select_tuning (base_synth, FALSE);
+}
+
+/* main thread: queues a command for the start of the next block */
+static gboolean
+send_control (control_type type, gdouble * tuning, gint program)
+{
+  control_command command = { type, tuning, program };
+  if (control_queue == NULL || jack_ringbuffer_write_space (control_queue) < sizeof (command))
+    {
+      g_warning ("The audio thread is not taking up changes to the synth");
+      return FALSE;
+    }
+  jack_ringbuffer_write (control_queue, (char const *) &command, sizeof (command));
+  return TRUE;
+}
+
+/* audio thread: applies one command */
+static void
+apply_control (control_command const *command)
+{
+  switch (command->type)
+    {
+    case CONTROL_PANIC:
+      fluid_all_notes_off ();
+      reset_synth_channels ();
+      break;
+    case CONTROL_TUNING:
+      /* the base synth keeps in tune while the bank plays */
+      tuning_program = command->program;
+      select_tuning (base_synth, TRUE);
+      adaptive_tuning_set_base (command->tuning);
+      adapted = FALSE;
+      g_atomic_pointer_set (&acked_tuning, command->tuning);
+      break;
+    }
+}
+
+void
+fluidsynth_start_block (void)
+{
+  control_command command;
+  current_synth ();
+  while (control_queue && jack_ringbuffer_read_space (control_queue) >= sizeof (command))
+    {
+      jack_ringbuffer_read (control_queue, (char *) &command, sizeof (command));
+      apply_control (&command);
+    }
+}
+
+void
+fluidsynth_panic (void)
+{
+  send_control (CONTROL_PANIC, NULL, 0);
+}
+
+static gboolean
+free_retired (gpointer data)
+{
+  /* the audio thread has let go of everything but the requested ones */
+  if (g_atomic_pointer_get (&acked_synth) != g_atomic_pointer_get (&requested_synth)
+      || g_atomic_pointer_get (&acked_cache) != g_atomic_pointer_get (&requested_cache)
+      || g_atomic_pointer_get (&acked_tuning) != g_atomic_pointer_get (&requested_tuning))
+    return TRUE;
+  g_list_free_full (retired_synths, (GDestroyNotify) delete_fluid_synth);
+  retired_synths = NULL;
+  g_list_free_full (retired_caches, (GDestroyNotify) note_cache_free);
+  retired_caches = NULL;
+  g_list_free_full (retired_tunings, g_free);
+  retired_tunings = NULL;
+  return FALSE;
+}
+
+static void
+schedule_free_retired (void)
+{
+  if (retired_synths == NULL && retired_caches == NULL && retired_tunings == NULL)
+    g_timeout_add (100, free_retired, NULL);
+}
+
+static void
+retire_synth (fluid_synth_t * s)
+{
+  schedule_free_retired ();
+  retired_synths = g_list_prepend (retired_synths, s);
+}
+
+static void
+retire_cache (note_cache * cache)
+{
+  schedule_free_retired ();
+  retired_caches = g_list_prepend (retired_caches, cache);
+}
+
+static void
+retire_tuning (gdouble * tuning)
+{
+  schedule_free_retired ();
+  retired_tunings = g_list_prepend (retired_tunings, tuning);
+}
+
+void
+fluidsynth_set_key_tuning (gdouble const *pitch)
+{
+  gdouble *tuning, *old = requested_tuning;
+  gint program = (sent_program + 1) % TUNING_PROGRAMS;
+  if (base_synth == NULL)
+    return;
+  tuning = g_new (gdouble, 128);
+  memcpy (tuning, pitch, 128 * sizeof (gdouble));
+  build_tuning (program, tuning);
+  if (!send_control (CONTROL_TUNING, tuning, program))
+    {
+      g_free (tuning);
+      return;
+    }
+  sent_program = program;
+  g_atomic_pointer_set (&requested_tuning, tuning);
+  if (old)
+    retire_tuning (old);
+}
+
+void
+fluidsynth_get_key_tuning (gdouble pitch[128])
+{
+  gint key;
+  if (requested_tuning)
+    {
+      memcpy (pitch, requested_tuning, 128 * sizeof (gdouble));
+      return;
+    }
+  for (key = 0; key < 128; key++)
+    pitch[key] = 100.0 * key;
+}
+
+/* main thread: hands a finished cache to the audio thread */
+static gboolean
+cache_ready (cache_job * job)
+{
+  if (job->cache == NULL)
+    g_warning ("Could not render the notes of %s, playing them live", job->bank);
+  else if (job->request != bank_request || bank_synth == NULL)
+    note_cache_free (job->cache);
+  else
+    {
+      bank_cache = job->cache;
+      g_atomic_pointer_set (&requested_cache, bank_cache);
+    }
+  g_free (job->bank);
+  g_free (job);
+  g_atomic_int_add (&jobs_running, -1);
+  return FALSE;
+}
+
+/* background thread: renders the plucks of the bank */
+static gpointer
+render_cache (cache_job * job)
+{
+  job->cache = note_cache_render (job->bank, settings);
+  g_idle_add ((GSourceFunc) cache_ready, job);
+  return NULL;
+}
+
+static void
+request_note_cache (gchar const *bank)
+{
+  cache_job *job;
+  GThread *thread;
+
+  /* the cached plucks are dry */
+  if (!HistoricHarpsichord.prefs.note_cache || HistoricHarpsichord.prefs.fluidsynth_reverb || HistoricHarpsichord.prefs.fluidsynth_chorus)
+    return;
+  job = g_malloc0 (sizeof (cache_job));
+  job->request = bank_request;
+  job->bank = g_strdup (bank);
+  g_atomic_int_inc (&jobs_running);
+  thread = g_thread_try_new ("Render notes", (GThreadFunc) render_cache, job, NULL);
+  if (thread)
+    g_thread_unref (thread);
+  else
+    {
+      g_free (job->bank);
+      g_free (job);
+      g_atomic_int_add (&jobs_running, -1);
+    }
+}
+
+/* the memory a synth takes for the samples of a SoundFont, which it loads whole */
+static guint64
+soundfont_sample_bytes (gchar const *path)
+{
+  sf_catalog_entry_t const *entry = sf_catalog_lookup (path);
+  GStatBuf info;
+  if (entry && entry->sample_bytes)
+    return entry->sample_bytes;
+  return g_stat (path, &info) == 0 ? (guint64) info.st_size : 0;
+}
+
+static void
+free_bank_job (bank_job * job)
+{
+  g_free (job->source);
+  g_free (job->dest);
+  g_free (job);
+}
+
+/* main thread: hands a finished bank to the audio thread */
+static gboolean
+bank_ready (bank_job * job)
+{
+  if (job->synth == NULL)
+    g_warning ("Could not resample %s, tuning it live", job->source);
+  else if (job->request != bank_request || base_synth == NULL)
+    delete_fluid_synth (job->synth);
+  else
+    {
+      g_message ("Playing the bank resampled to %u Hz from %s", job->rate, job->dest);
+      bank_synth = job->synth;
+      bank_sfont_id = job->sfont_id;
+      bank_bytes = soundfont_sample_bytes (job->dest);
+      memcpy (bank_cents, job->key_cents, sizeof (bank_cents));
+      g_atomic_pointer_set (&requested_synth, bank_synth);
+      sf_cache_forget_resampled_banks (user_soundfont, job->dest);
+      request_note_cache (job->dest);
+    }
+  free_bank_job (job);
+  g_atomic_int_add (&jobs_running, -1);
+  return FALSE;
+}
+
+/* background thread: resamples the bank unless it is cached, then loads it
+ * into a synth of its own */
+static gpointer
+build_bank (bank_job * job)
+{
+  if (g_file_test (job->dest, G_FILE_TEST_EXISTS) || sf_resample_bank (job->source, job->dest, job->rate, job->key_cents) == 0)
+    {
+      job->synth = new_fluid_synth (settings);
+      if (job->synth)
+        {
+          job->sfont_id = fluid_synth_sfload (job->synth, job->dest, FALSE);
+          if (job->sfont_id == -1)
+            {
+              delete_fluid_synth (job->synth);
+              job->synth = NULL;
+              g_remove (job->dest);
+            }
+          else
+            {
+              /* the bank plays at exactly the output rate */
+              fluid_synth_set_interp_method (job->synth, -1, FLUID_INTERP_NONE);
+              select_program (job->synth, job->sfont_id);
+            }
+        }
+    }
+  g_idle_add ((GSourceFunc) bank_ready, job);
+  return NULL;
+}
+
+void
+fluidsynth_request_resampled_bank (gdouble const *pitch)
+{
+  bank_job *job;
+  GThread *thread;
+  gint key;
+
+  if (!HistoricHarpsichord.prefs.resampled_bank || base_synth == NULL)
+    return;
+  job = g_malloc0 (sizeof (bank_job));
+  for (key = 0; key < 128; key++)
+    job->key_cents[key] = pitch[key] - 100.0 * key;
+  if (bank_synth && !memcmp (bank_cents, job->key_cents, sizeof (bank_cents)))
+    {
+      g_free (job);
+      return;
+    }
+  if (bank_synth)
+    {
+      /* tune the SoundFont live until the new bank is ready */
+      if (bank_cache)
+        {
+          g_atomic_pointer_set (&requested_cache, NULL);
+          retire_cache (bank_cache);
+          bank_cache = NULL;
+        }
+      g_atomic_pointer_set (&requested_synth, base_synth);
+      retire_synth (bank_synth);
+      bank_synth = NULL;
+      bank_bytes = 0;
+    }
+  job->dest = sf_cache_get_resampled_bank (user_soundfont, synth_rate, job->key_cents);
+  if (job->dest == NULL)
+    {
+      g_free (job);
+      return;
+    }
+  job->request = ++bank_request;
+  job->source = g_strdup (playback_soundfont);
+  job->rate = synth_rate;
+  g_atomic_int_inc (&jobs_running);
+  thread = g_thread_try_new ("Resample bank", (GThreadFunc) build_bank, job, NULL);
+  if (thread)
+    g_thread_unref (thread);
+  else
+    {
+      free_bank_job (job);
+      g_atomic_int_add (&jobs_running, -1);
+    }
+}
+
+/* FluidSynth logs from the audio thread too, voices running out say */
+static void
+log_fluidsynth (int level,
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+                const char *message,
+#else
+                char *message,
+#endif
+                void *data)
+{
+  switch (level)
+    {
+    case FLUID_PANIC:
+    case FLUID_ERR:
+    case FLUID_WARN:
+      rtlog (RTLOG_WARNING, "FluidSynth: %s", message);
+      break;
+    case FLUID_INFO:
+      rtlog (RTLOG_INFO, "FluidSynth: %s", message);
+      break;
+    default:
+      rtlog (RTLOG_DEBUG, "FluidSynth: %s", message);
+      break;
+    }
 }
 
 int
 fluidsynth_init (HistoricHarpsichordPrefs * config, unsigned int samplerate)
 {
+  gint level;
+
   g_debug ("Starting FLUIDSYNTH");
 
+  for (level = FLUID_PANIC; level < LAST_LOG_LEVEL; level++)
+    fluid_set_log_function (level, log_fluidsynth, NULL);
+
   settings = new_fluid_settings ();
   if (!settings)
     {
@@ -59,104 +565,267 @@ fluidsynth_init (HistoricHarpsichordPrefs * config, unsigned int samplerate)
     }
 
   fluid_settings_setnum (settings, "synth.sample-rate", (double) samplerate);
+  fluid_settings_setint (settings, "synth.midi-channels", NOTE_CACHE_SYNTH_CHANNELS);
 
   fluid_settings_setint (settings, "synth.reverb.active", config->fluidsynth_reverb ? 1 : 0);
   fluid_settings_setint (settings, "synth.chorus.active", config->fluidsynth_chorus ? 1 : 0);
 
   // create the synthesizer
+  startup_phase_begin ("new_fluid_synth");
   synth = new_fluid_synth (settings);
+  startup_phase_end ();
   if (!synth)
     {
       g_warning ("Failed to create the settings");
-      fluidsynth_shutdown ();
+      fluidsynth_close ();
       return -1;
     }
 
+  g_free (playback_soundfont);
+  playback_soundfont = NULL;
   if(g_file_test(config->fluidsynth_soundfont->str, G_FILE_TEST_EXISTS))
-    sfont_id = fluid_synth_sfload (synth, config->fluidsynth_soundfont->str, FALSE);
+    {
+      startup_phase_begin ("sf_cache_get_playback_soundfont");
+      playback_soundfont = sf_cache_get_playback_soundfont (config->fluidsynth_soundfont->str);
+      startup_phase_end ();
+      startup_phase_begin ("fluid_synth_sfload");
+      sfont_id = fluid_synth_sfload (synth, playback_soundfont, FALSE);
+      if (sfont_id == -1 && strcmp (playback_soundfont, config->fluidsynth_soundfont->str))
+        {
+          g_free (playback_soundfont);
+          playback_soundfont = g_strdup (config->fluidsynth_soundfont->str);
+          sfont_id = fluid_synth_sfload (synth, playback_soundfont, FALSE);
+        }
+      startup_phase_end ();
+    }
 
   if (sfont_id == -1)
     {
       g_print ("Failed to load the user soundfont %s. Now trying the default soundfont.", config->fluidsynth_soundfont->str);
       gchar *default_soundfont = g_build_filename (get_system_data_dir (), "soundfonts", "HarpsichordSoundfont.sf2", NULL);
+      startup_phase_begin ("fluid_synth_sfload");
       if(default_soundfont)
         sfont_id = fluid_synth_sfload (synth, default_soundfont, FALSE);
+      startup_phase_end ();
       g_string_assign (HistoricHarpsichord.prefs.fluidsynth_soundfont, default_soundfont);
-      g_free (default_soundfont);
+      g_free (playback_soundfont);
+      playback_soundfont = default_soundfont;
     }
   else
      g_print ("Using soundfont %s.\n", config->fluidsynth_soundfont->str);
   if (sfont_id == -1)
     {
-      fluidsynth_shutdown ();
+      fluidsynth_close ();
       g_warning ("The Harpsichord Synthesizer will not work!!!!\n\n\n");
       return -1;
     }
 
+  /* equal temperament until set_tuning() */
+  base_synth = synth;
+  build_tuning (0, NULL);
+  sent_program = tuning_program = 0;
+  requested_tuning = acked_tuning = NULL;
+  if (control_queue == NULL)
+    control_queue = jack_ringbuffer_create (CONTROL_QUEUE_COMMANDS * sizeof (control_command));
+  jack_ringbuffer_reset (control_queue);
+  adaptive_tuning_init ();
+  adapted = FALSE;
+  damping_init (samplerate);
+  frame_clock = 0;
+  memset (active_notes, 0, sizeof (active_notes));
+
+  base_synth = requested_synth = acked_synth = synth;
+  bank_synth = NULL;
+  bank_bytes = 0;
+  bank_cache = requested_cache = acked_cache = playing_cache = NULL;
+  bank_request++;
+  g_free (user_soundfont);
+  user_soundfont = g_strdup (HistoricHarpsichord.prefs.fluidsynth_soundfont->str);
+  synth_rate = samplerate;
  reset_synth_channels ();
 
   return 0;
 }
 
 
+void
+fluidsynth_close (void)
+{
+  /* the jobs make synths from the settings; those still running are let
+   * go of when they are handed back */
+  bank_request++;
+  while (g_atomic_int_get (&jobs_running))
+    g_main_context_iteration (NULL, TRUE);
+
+  note_cache_stop ();
+  g_list_free_full (retired_synths, (GDestroyNotify) delete_fluid_synth);
+  retired_synths = NULL;
+  g_list_free_full (retired_caches, (GDestroyNotify) note_cache_free);
+  retired_caches = NULL;
+  g_list_free_full (retired_tunings, g_free);
+  retired_tunings = NULL;
+  if (bank_cache)
+    note_cache_free (bank_cache);
+  bank_cache = requested_cache = acked_cache = playing_cache = NULL;
+  if (bank_synth)
+    delete_fluid_synth (bank_synth);
+  bank_synth = NULL;
+  bank_sfont_id = -1;
+  bank_bytes = 0;
+  /* synth is the base synth until fluidsynth_init() has finished */
+  if (base_synth == NULL)
+    base_synth = synth;
+  if (base_synth)
+    delete_fluid_synth (base_synth);
+  base_synth = synth = requested_synth = acked_synth = NULL;
+  sfont_id = -1;
+  g_free (requested_tuning);
+  requested_tuning = acked_tuning = NULL;
+  if (settings)
+    delete_fluid_settings (settings);
+  settings = NULL;
+  g_free (playback_soundfont);
+  playback_soundfont = NULL;
+  g_free (user_soundfont);
+  user_soundfont = NULL;
+}
+
 void
 fluidsynth_shutdown ()
 {
-    g_unlink (g_build_filename (get_user_data_dir (TRUE), PREFS_FILE, NULL));
+  gchar *prefs = g_build_filename (get_user_data_dir (TRUE), PREFS_FILE, NULL);
+  fluidsynth_close ();
+  g_unlink (prefs);
+  g_free (prefs);
+}
+
+
+/* audio thread: how far from the static tuning key is to sound for its
+ * pitch class to be pure against the chord it completes */
+static gdouble
+adapt_tuning (fluid_synth_t * s, gint key)
+{
+  if (!HistoricHarpsichord.prefs.adaptive_tuning)
+    {
+      if (adapted)
+        {
+          adaptive_tuning_reset ();
+          adapted = FALSE;
+        }
+      return 0.0;
+    }
+  /* the resampled bank has its tuning built in */
+  if (s != base_synth)
+    return 0.0;
+  adapted = TRUE;
+  return adaptive_tuning_note_on (key);
+}
+
+/* audio thread: detunes the voices of a note just started, and those
+ * alone, which costs neither a new tuning nor an allocation */
+static void
+detune_voices (fluid_voice_t * voices[], gint n, gdouble cents)
+{
+  gint i;
+  if (cents == 0.0)
+    return;
+  for (i = 0; i < n; i++)
+    {
+      fluid_voice_gen_set (voices[i], GEN_FINETUNE, fluid_voice_gen_get (voices[i], GEN_FINETUNE) + (float) cents);
+      fluid_voice_update_param (voices[i], GEN_FINETUNE);
+    }
+}
+
+/* audio thread: marks key held or let off */
+static void
+set_active (gint chan, gint key, gboolean on)
+{
+  guint *word = &active_notes[chan & 0x0F][(key & 0x7F) >> 5];
+  guint bit = 1u << (key & 31);
+  guint bits = g_atomic_int_get (word);
+  g_atomic_int_set (word, on ? bits | bit : bits & ~bit);
 }
 
+/* lets key off, the damper falling on the string as gently as the time it
+ * has sounded asks for */
+static void
+release_note (fluid_synth_t * s, gint chan, gint key)
+{
+  gfloat release = HistoricHarpsichord.prefs.damping ? damping_release_offset (chan, key, frame_clock) : 0.0;
+  set_active (chan, key, FALSE);
+  adaptive_tuning_note_off (key);
+  if (playing_cache)
+    note_cache_note_off (s, chan, key, release);
+  /* only the key's own voices, so that each key of a chord let off in
+   * turn keeps the release it was given */
+  voice_policy_note_off (s, chan, key, release);
+}
 
 void
 fluidsynth_feed_midi (unsigned char *event_data, size_t event_length)
 {
   int channel = (event_data[0] & 0x0f);
   int type = (event_data[0] & 0xf0);
+  fluid_synth_t *s = current_synth ();
 //g_print("length of %d message %x\n", event_length, type);
   switch (type)
     {
     case MIDI_NOTE_ON:
       {
+        int key = event_data[1];
         int velocity = ((int) (event_data[2]));
+        fluid_voice_t *voices[VOICE_POLICY_MAX_VOICES];
+        gdouble cents;
+        gint n;
         if (velocity > 0x7F)
           velocity = 0x7F;
-        fluid_synth_noteon (synth, channel, event_data[1] - HistoricHarpsichord.prefs.lowpitch, velocity);
+        if (velocity == 0)
+          {
+            release_note (s, channel, key);
+            break;
+          }
+        set_active (channel, key, TRUE);
+        cents = adapt_tuning (s, key);
+        damping_note_on (channel, key, frame_clock);
+        if (playing_cache && note_cache_note_on (playing_cache, s, channel, key, velocity, HistoricHarpsichord.prefs.one_string_per_key))
+          break;
+        n = voice_policy_note_on (s, channel, key, velocity, HistoricHarpsichord.prefs.one_string_per_key, voices);
+        detune_voices (voices, n, cents);
       }
       break;
     case MIDI_NOTE_OFF:
-      fluid_synth_noteoff (synth, channel, event_data[1] - HistoricHarpsichord.prefs.lowpitch);
-      break;
-    case SYS_EXCLUSIVE_MESSAGE1:
-      
-      fluid_synth_sysex (synth, (const char*) event_data + 1, event_length - 1, NULL, 0, NULL, FALSE);
+      release_note (s, channel, event_data[1]);
       break;
     }
 }
 
 
-static void
-fluid_all_notes_off_channel (gint chan)
-{
-//      fluid_event_all_sounds_off (fluid_event_t *evt, int channel)!!!!!!!!!!!
-//      fluid_event_t evt;
-//      fluid_event_all_notes_off (&evt, chan)
-  gint i;
-  for (i = 0; i < 128; i++)
-    fluid_synth_noteoff (synth, chan, i);
-}
-
+/* lets off only the keys held, so that a panic costs the audio thread
+ * little more than the notes it ends */
 static void
 fluid_all_notes_off (void)
 {
-  gint chan;
+  gint chan, word;
   for (chan = 0; chan < 16; chan++)
-    fluid_all_notes_off_channel (chan);
+    for (word = 0; word < 4; word++)
+      {
+        guint bits = g_atomic_int_get (&active_notes[chan][word]);
+        for (; bits; bits &= bits - 1)
+          {
+            gint key = word * 32 + g_bit_nth_lsf (bits, -1);
+            if (playing_cache)
+              note_cache_note_off (synth, chan, key, 0.0);
+            fluid_synth_noteoff (synth, chan, key);
+          }
+        g_atomic_int_set (&active_notes[chan][word], 0);
+      }
+  adaptive_tuning_reset ();
 }
 
 
 void
 fluidsynth_all_notes_off ()
 {
-  // FIXME: this call has the potential to cause an xrun and/or disconnect us from JACK
   //FIXME: this unsets the channel settings for immediate playback (fixed below) and more ...????
   //fluid_synth_system_reset(synth);
   fluid_all_notes_off ();
@@ -164,11 +833,101 @@ fluidsynth_all_notes_off ()
   //  fluid_synth_program_change(synth, HistoricHarpsichord.prefs.pitchspellingchannel, HistoricHarpsichord.prefs.pitchspellingprogram);
 }
 
+int
+fluidsynth_get_active_voices (void)
+{
+  return synth ? fluid_synth_get_active_voice_count (synth) : 0;
+}
+
+guint64
+fluidsynth_get_sample_bytes (void)
+{
+  guint64 bytes = bank_bytes;
+  gint key;
+  if (base_synth && playback_soundfont)
+    bytes += soundfont_sample_bytes (playback_soundfont);
+  if (bank_cache)
+    for (key = 0; key < 128; key++)
+      if (bank_cache->left[key])
+        bytes += 2 * bank_cache->frames * sizeof (gfloat);
+  return bytes;
+}
+
+void
+fluidsynth_get_active_notes (guint32 notes[16][4])
+{
+  gint chan, word;
+  for (chan = 0; chan < 16; chan++)
+    for (word = 0; word < 4; word++)
+      notes[chan][word] = g_atomic_int_get (&active_notes[chan][word]);
+}
+
 void
 fluidsynth_render_audio (unsigned int nframes, float *left_channel, float *right_channel)
 {
   //printf("\nsynth == %d, nframes == %d, left_channel == %f right_channel == %f\n",synth, nframes, left_channel, right_channel);
-  fluid_synth_write_float (synth, nframes, left_channel, 0, 1, right_channel, 0, 1);
+  fluid_synth_t *s = current_synth ();
+  if (playing_cache)
+    note_cache_hand_off (playing_cache, s, nframes);
+  fluid_synth_write_float (s, nframes, left_channel, 0, 1, right_channel, 0, 1);
+  if (playing_cache)
+    note_cache_mix (playing_cache, nframes, left_channel, right_channel);
+  frame_clock += nframes;
+}
+
+guint
+fluidsynth_process_block (unsigned int nframes, double until_time, float *left_channel, float *right_channel)
+{
+  unsigned char event_data[MIDI_EVENT_MAX_LENGTH];
+  size_t event_length = MIDI_EVENT_MAX_LENGTH;
+  double event_time;
+  guint events = 0;
+
+  fluidsynth_start_block ();
+  while (read_event_from_queue (AUDIO_BACKEND, event_data, &event_length, &event_time, until_time))
+    {
+      latency_mark_event (LATENCY_IMMEDIATE, event_data);
+      fluidsynth_feed_midi (event_data, event_length);
+      events++;
+    }
+  fluidsynth_render_audio (nframes, left_channel, right_channel);
+  return events;
+}
+
+#define MAX_PREVIEW_PRESETS (24)
+
+/* shows what the catalogue knows about the highlighted file, without parsing it */
+static void
+update_soundfont_preview (GtkFileChooser * chooser, GtkWidget * preview)
+{
+  gchar *filename = gtk_file_chooser_get_preview_filename (chooser);
+  sf_catalog_entry_t const *entry = sf_catalog_lookup (filename);
+  g_free (filename);
+  gtk_file_chooser_set_preview_widget_active (chooser, entry != NULL);
+  if (entry == NULL)
+    return;
+
+  GString *text = g_string_new ("");
+  gchar *escaped = g_markup_escape_text (entry->name && *entry->name ? entry->name : _("Unnamed SoundFont"), -1);
+  g_string_append_printf (text, "<b>%s</b>\n%.1f MB %s\n\n", escaped, entry->sample_bytes / (1024.0 * 1024.0), _("of samples"));
+  g_free (escaped);
+
+  GList *g;
+  gint i = 0;
+  for (g = entry->presets; g && i < MAX_PREVIEW_PRESETS; g = g->next, i++)
+    {
+      sf_catalog_preset_t *preset = g->data;
+      escaped = g_markup_escape_text (preset->name, -1);
+      g_string_append_printf (text, "%s%03u:%03u %s  [%u-%u]%s\n", (preset->bank == 0 && preset->program == 0) ? "<b>" : "", preset->bank, preset->program, escaped, preset->key_lo, preset->key_hi, (preset->bank == 0 && preset->program == 0) ? "</b>" : "");
+      g_free (escaped);
+    }
+  if (g)
+    g_string_append_printf (text, _("... and %u more presets"), g_list_length (g));
+  if (!sf_catalog_find_preset (entry, 0, 0))
+    g_string_append_printf (text, "\n<span foreground=\"red\">%s</span>", _("No bank 0 program 0 preset, nothing will sound!"));
+
+  gtk_label_set_markup (GTK_LABEL (preview), text->str);
+  g_string_free (text, TRUE);
 }
 
 /**
@@ -179,6 +938,9 @@ choose_sound_font (GtkWidget * widget, GtkWidget * fluidsynth_soundfont)
 {
   GtkWidget *sf;
   GtkFileFilter *filter;
+  GtkWidget *preview;
+
+  sf_catalog_rescan ();
 
   sf = gtk_file_chooser_dialog_new (_("Choose SoundFont File"), GTK_WINDOW (NULL), GTK_FILE_CHOOSER_ACTION_OPEN, _("_Cancel"), GTK_RESPONSE_REJECT, _("_Open"), GTK_RESPONSE_ACCEPT, NULL);
 
@@ -188,6 +950,10 @@ choose_sound_font (GtkWidget * widget, GtkWidget * fluidsynth_soundfont)
   gtk_file_filter_add_pattern (filter, "*.sf2");
   gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (sf), filter);
   gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (sf), get_system_dir(HISTORICHARPSICHORD_DIR_SOUNDFONTS));
+  preview = gtk_label_new ("");
+  gtk_label_set_use_markup (GTK_LABEL (preview), TRUE);
+  gtk_file_chooser_set_preview_widget (GTK_FILE_CHOOSER (sf), preview);
+  g_signal_connect (G_OBJECT (sf), "update-preview", G_CALLBACK (update_soundfont_preview), preview);
             
   gtk_widget_show_all (sf);
   if (gtk_dialog_run (GTK_DIALOG (sf)) == GTK_RESPONSE_ACCEPT)
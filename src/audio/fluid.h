@@ -18,6 +18,17 @@
 
 
 int fluidsynth_init (HistoricHarpsichordPrefs * config, unsigned int samplerate);
+
+/**
+ * Deletes the synths and their settings, with the audio thread stopped.
+ * fluidsynth_init() may be called again afterwards.
+ */
+void fluidsynth_close (void);
+
+/**
+ * Closes the synth as fluidsynth_close() does and deletes the user's
+ * preferences file.
+ */
 void fluidsynth_shutdown ();
 
 
@@ -27,18 +38,82 @@ void fluidsynth_shutdown ();
 void fluidsynth_feed_midi (unsigned char *event_data, size_t event_length);
 
 /**
- * Sends an all-notes-off event to the synth engine.
+ * Sends an all-notes-off event to the synth engine, for the keys held only.
  */
 void fluidsynth_all_notes_off ();
 
+/**
+ * Copies the keys held on each channel without locking, for showing them
+ * or spotting stuck notes: key k of channel c is held if bit k % 32 of
+ * notes[c][k / 32] is set.
+ */
+void fluidsynth_get_active_notes (guint32 notes[16][4]);
+
+/**
+ * Applies the changes to the synth sent since the last block. Called by the
+ * audio thread before it feeds the events of a block.
+ */
+void fluidsynth_start_block (void);
+
+/**
+ * Lets off the keys held and reselects the presets and tuning at the start
+ * of the next block.
+ */
+void fluidsynth_panic (void);
+
+/**
+ * Returns the voices the synth is playing. Called by the audio thread.
+ */
+int fluidsynth_get_active_voices (void);
+
+/**
+ * Returns the memory taken by the samples the synths play from: the
+ * SoundFont, and the resampled bank and its note cache if there are any.
+ * Called by the main thread.
+ */
+guint64 fluidsynth_get_sample_bytes (void);
+
 /**
  * Renders the given number of audio frames into a buffer.
  */
 void fluidsynth_render_audio (unsigned int nframes, float *left_channel, float *right_channel);
 
+/**
+ * Does all an audio backend's callback does for a block: applies the
+ * changes sent, feeds the events queued for playback up to until_time and
+ * renders the given number of frames.
+ *
+ * @return  the number of events fed
+ */
+guint fluidsynth_process_block (unsigned int nframes, double until_time, float *left_channel, float *right_channel);
+
 /**
  * Select the soundfont to use for playback
  */
 void choose_sound_font (GtkWidget * widget, GtkWidget * fluidsynth_soundfont);
 void reset_synth_channels (void);
+
+/**
+ * Retunes the synth at the start of the next block of audio.
+ *
+ * @param pitch  the pitch of each of the 128 keys in cents, see
+ *   tuning_build_table()
+ */
+void fluidsynth_set_key_tuning (gdouble const *pitch);
+
+/**
+ * Copies the tuning last sent to the synth, equal temperament at modern
+ * pitch if none has been. Called by the main thread.
+ */
+void fluidsynth_get_key_tuning (gdouble pitch[128]);
+
+/**
+ * Asks for a bank resampled to the given tuning if the resampled_bank
+ * preference is set. The bank is built in the background; until it is ready
+ * the SoundFont is tuned live.
+ *
+ * @param pitch  the pitch of each of the 128 keys in cents, see
+ *   tuning_build_table()
+ */
+void fluidsynth_request_resampled_bank (gdouble const *pitch);
 #endif // FLUID_H
@@ -0,0 +1,207 @@
+/*
+ * latency.c
+ * Measuring the time from a key being struck to its sound.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "audio/latency.h"
+#include "audio/audiointerface.h"
+#include "audio/midi.h"
+#ifdef _HAVE_FLUIDSYNTH_
+#include "audio/nullbackend.h"
+#endif
+
+#define PROBES (200)
+#define PROBE_KEY (69)
+#define PROBE_VELOCITY (127)
+/* the level the output must pass for a note to be heard */
+#define ONSET_THRESHOLD (1e-3)
+/* how long the output must stay below it before a key is struck */
+#define QUIET_TIME (50000)
+/* how long to wait for the output to fall quiet or a note to be heard */
+#define PROBE_TIMEOUT (2 * G_USEC_PER_SEC)
+
+static gint running = FALSE;
+static gint reached;                    /* a bit for each hop the probe has reached */
+static gint64 stamps[LATENCY_HOPS];
+static gint64 start_time;
+static gint quiet_since;                /* when the output last passed the threshold, in us from start_time */
+static GMainLoop *loop;
+static gboolean failed;
+
+static gchar const *const hop_names[LATENCY_HOPS] = {
+  "input", "queue thread", "main loop", "immediate queue", "render"
+};
+
+void
+latency_mark_event (latency_hop hop, unsigned char const *event)
+{
+  if (!g_atomic_int_get (&running))
+    return;
+  if ((event[0] & 0xF0) != MIDI_NOTE_ON || event[2] == 0 || (g_atomic_int_get (&reached) & (1 << hop)))
+    return;
+  stamps[hop] = g_get_monotonic_time ();
+  g_atomic_int_or (&reached, 1 << hop);
+}
+
+#ifdef _HAVE_FLUIDSYNTH_
+/* called by the null backend's audio thread with each block as it will sound */
+static void
+capture (float const *left, float const *right, guint frames, guint rate, gint64 time)
+{
+  guint i, onset = frames, last = frames;
+  for (i = 0; i < frames; i++)
+    if (fabsf (left[i]) > ONSET_THRESHOLD || fabsf (right[i]) > ONSET_THRESHOLD)
+      {
+        if (onset == frames)
+          onset = i;
+        last = i;
+      }
+  if (last == frames)
+    return;
+  g_atomic_int_set (&quiet_since, time - start_time + (gint64) (last + 1) * G_USEC_PER_SEC / rate);
+  if ((g_atomic_int_get (&reached) & (1 << LATENCY_IMMEDIATE)) && !(g_atomic_int_get (&reached) & (1 << LATENCY_RENDER)))
+    {
+      stamps[LATENCY_RENDER] = time + (gint64) onset * G_USEC_PER_SEC / rate;
+      g_atomic_int_or (&reached, 1 << LATENCY_RENDER);
+    }
+}
+#endif
+
+/* waits until the test returns TRUE, or the timeout passes */
+static gboolean
+wait_until (gboolean (*test) (void))
+{
+  gint64 end = g_get_monotonic_time () + PROBE_TIMEOUT;
+  while (!test ())
+    {
+      if (g_get_monotonic_time () > end)
+        return FALSE;
+      g_usleep (200);
+    }
+  return TRUE;
+}
+
+static gboolean
+output_quiet (void)
+{
+  return g_get_monotonic_time () - start_time - g_atomic_int_get (&quiet_since) > QUIET_TIME;
+}
+
+static gboolean
+probe_heard (void)
+{
+  return (g_atomic_int_get (&reached) & (1 << LATENCY_RENDER)) != 0;
+}
+
+static gboolean
+quit_loop (gpointer data)
+{
+  g_main_loop_quit (loop);
+  return FALSE;
+}
+
+static int
+compare_spans (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(gint64 const *) a, y = *(gint64 const *) b;
+  return (x > y) - (x < y);
+}
+
+static void
+print_spans (gchar const *name, gint64 * spans, gint n)
+{
+  qsort (spans, n, sizeof (gint64), compare_spans);
+  g_print ("%-16s %8.3f %8.3f %8.3f %8.3f\n", name, spans[0] / 1000.0, spans[n / 2] / 1000.0, spans[MIN (n - 1, n * 99 / 100)] / 1000.0, spans[n - 1] / 1000.0);
+}
+
+/* strikes the key over and over from a thread of its own, as a MIDI driver
+ * would, while the main loop handles the events */
+static gpointer
+inject_func (gpointer data)
+{
+  gint64 (*spans)[PROBES] = data;
+  unsigned char note_on[] = { MIDI_NOTE_ON, PROBE_KEY, PROBE_VELOCITY };
+  unsigned char note_off[] = { MIDI_NOTE_OFF, PROBE_KEY, 0 };
+  gint i, hop, heard = 0;
+
+  for (i = 0; i < PROBES; i++)
+    {
+      if (!wait_until (output_quiet))
+        g_warning ("The output has not fallen quiet before probe %d", i);
+      /* strike at a random point within a period, not in step with the audio thread */
+      g_usleep (g_random_int_range (0, 10000));
+      g_atomic_int_set (&reached, 0);
+      g_atomic_int_set (&running, TRUE);
+      input_midi_event (MIDI_BACKEND, 0, note_on, sizeof (note_on));
+      if (wait_until (probe_heard))
+        {
+          for (hop = LATENCY_QUEUE; hop < LATENCY_HOPS; hop++)
+            spans[hop][heard] = stamps[hop] - stamps[hop - 1];
+          spans[LATENCY_INPUT][heard] = stamps[LATENCY_RENDER] - stamps[LATENCY_INPUT];
+          heard++;
+        }
+      else
+        g_warning ("Probe %d was not heard, it reached hops 0x%x", i, g_atomic_int_get (&reached));
+      g_atomic_int_set (&running, FALSE);
+      input_midi_event (MIDI_BACKEND, 0, note_off, sizeof (note_off));
+    }
+
+  if (heard)
+    {
+      g_print ("%d of %d notes heard; time to each hop from the last, in ms\n", heard, PROBES);
+      g_print ("%-16s %8s %8s %8s %8s\n", "", "min", "median", "p99", "max");
+      for (hop = LATENCY_QUEUE; hop < LATENCY_HOPS; hop++)
+        print_spans (hop_names[hop], spans[hop], heard);
+      print_spans ("total", spans[LATENCY_INPUT], heard);
+    }
+  failed = heard < PROBES;
+  g_idle_add (quit_loop, NULL);
+  return NULL;
+}
+
+gint
+latency_test_run (HistoricHarpsichordPrefs * prefs)
+{
+#ifdef _HAVE_FLUIDSYNTH_
+  gint64 (*spans)[PROBES] = g_malloc0 (sizeof (gint64) * LATENCY_HOPS * PROBES);
+  GThread *thread;
+
+  g_string_assign (prefs->audio_driver, "null");
+  g_string_assign (prefs->midi_driver, "dummy");
+  /* each of these would hide or delay the onset, or keep the output from falling quiet */
+  prefs->resampled_bank = prefs->note_cache = prefs->adaptive_tuning = FALSE;
+  prefs->fluidsynth_reverb = prefs->fluidsynth_chorus = FALSE;
+
+  start_time = g_get_monotonic_time ();
+  quiet_since = 0;
+  null_backend_set_capture (capture);
+  if (audio_initialize (prefs))
+    {
+      g_warning ("Could not start the audio for the latency test");
+      return 1;
+    }
+  loop = g_main_loop_new (NULL, FALSE);
+  thread = g_thread_new ("Latency probe", inject_func, spans);
+  g_main_loop_run (loop);
+  g_thread_join (thread);
+  g_main_loop_unref (loop);
+  null_backend_set_capture (NULL);
+  audio_close ();
+  g_free (spans);
+  return failed;
+#else
+  g_warning ("The latency test needs FluidSynth");
+  return 1;
+#endif
+}
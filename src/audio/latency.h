@@ -0,0 +1,49 @@
+/*
+ * latency.h
+ * Measuring the time from a key being struck to its sound.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <historicHarpsichord/historicHarpsichord_types.h>
+
+/**
+ * The points a note-on passes on its way from the MIDI input to the sound.
+ */
+typedef enum latency_hop
+{
+  LATENCY_INPUT,                /**< handed to input_midi_event() */
+  LATENCY_QUEUE,                /**< read from the input queue by the queue thread */
+  LATENCY_MAIN,                 /**< handled on the main loop */
+  LATENCY_IMMEDIATE,            /**< read from the immediate queue by the audio thread */
+  LATENCY_RENDER,               /**< first heard in the output */
+  LATENCY_HOPS
+} latency_hop;
+
+/**
+ * Notes the time a note-on reaches a hop. Does nothing unless a latency
+ * test is running, and costs a load and a branch when none is.
+ */
+void latency_mark_event (latency_hop hop, unsigned char const *event);
+
+/**
+ * Strikes a key repeatedly through the MIDI input, renders with the null
+ * audio backend, so that no sound card is needed, and prints the minimum,
+ * median, 99th percentile and maximum time taken to each hop. Needs no
+ * window but runs the main loop.
+ *
+ * @param prefs  the preferences to play with; the audio and MIDI drivers
+ *   and the features that would hide the onset are overridden
+ * @return  an exit status, nonzero if any note was not heard
+ */
+gint latency_test_run (HistoricHarpsichordPrefs * prefs);
+
+#endif // LATENCY_H
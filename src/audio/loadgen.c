@@ -0,0 +1,291 @@
+/*
+ * loadgen.c
+ * Finding how much playing the machine sustains before it drops out.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "audio/loadgen.h"
+#include "audio/audiointerface.h"
+#include "audio/audiostats.h"
+#include "audio/miditransform.h"
+#include "audio/nullbackend.h"
+#include "audio/midi.h"
+
+/* how long each step of load is played for, in us */
+#define STEP_TIME (3 * G_USEC_PER_SEC)
+/* how much each step adds to the last */
+#define STEP_GROWTH (1.5)
+#define CHORDS_PER_SECOND (4)
+#define LOWEST_KEY (21)
+#define HIGHEST_KEY (108)
+#define STORM_HELD (16)
+
+typedef enum pattern
+{
+  PATTERN_CHORDS,
+  PATTERN_TRILL,
+  PATTERN_GLISSANDO,
+  PATTERN_STORM,
+  PATTERN_CLUSTER,
+  PATTERNS
+} pattern;
+
+/* the first step of each pattern and the most it is taken to */
+static struct
+{
+  gchar const *name;
+  gchar const *unit;
+  gdouble start;
+  gdouble limit;
+} const patterns[PATTERNS] = {
+  {"chords", "notes a chord", 2, 88},
+  {"trill", "notes/s", 4, 2000},
+  {"glissando", "notes/s", 8, 4000},
+  {"storm", "notes/s", 16, 8000},
+  {"cluster", "keys, damped", 2, 88},
+};
+
+typedef struct step_result
+{
+  gdouble intensity;            /* 0 if not even the first step was sustained */
+  guint voices;
+  gdouble event_rate;
+  gdouble load;
+} step_result;
+
+typedef struct load_job
+{
+  HistoricHarpsichordPrefs *prefs;
+  gdouble threshold;
+  step_result results[PATTERNS];
+  GMainLoop *loop;
+  GMutex lock;
+  GCond applied_cond;
+  gboolean damping;             /* the damping to set */
+  gboolean applied;             /* whether the main thread has set it */
+} load_job;
+
+static gboolean held[128];
+
+static void
+send (guchar status, gint key, guchar velocity)
+{
+  guchar event[] = { status, key, velocity };
+  held[key] = status == MIDI_NOTE_ON;
+  input_midi_event (MIDI_BACKEND, 0, event, sizeof (event));
+}
+
+static void
+release_all (void)
+{
+  gint key;
+  for (key = 0; key < 128; key++)
+    if (held[key])
+      send (MIDI_NOTE_OFF, key, 0);
+}
+
+/* waits for the next event, not trying to catch up if it has fallen behind */
+static void
+wait_until (gint64 * due, gint64 interval)
+{
+  gint64 now = g_get_monotonic_time ();
+  *due += interval;
+  if (*due > now)
+    g_usleep (*due - now);
+  else if (now - *due > G_USEC_PER_SEC / 10)
+    *due = now;
+}
+
+/* plays the pattern at the given intensity until the end time */
+static void
+play_step (pattern p, gdouble intensity, gint64 end)
+{
+  gint n = (gint) intensity, count = 0, key = 60, i;
+  gint64 due = g_get_monotonic_time ();
+  gint64 interval = (gint64) (G_USEC_PER_SEC / intensity);
+  gint storm[STORM_HELD];
+
+  memset (storm, -1, sizeof (storm));
+  while (g_get_monotonic_time () < end)
+    {
+      switch (p)
+        {
+        case PATTERN_CHORDS:
+          release_all ();
+          /* spread over the compass, shifted a little each time */
+          for (i = 0; i < n; i++)
+            send (MIDI_NOTE_ON, LOWEST_KEY + (i * (HIGHEST_KEY - LOWEST_KEY + 1) / n + count % 3) % (HIGHEST_KEY - LOWEST_KEY + 1), 100);
+          wait_until (&due, G_USEC_PER_SEC / CHORDS_PER_SECOND);
+          break;
+        case PATTERN_TRILL:
+          send (MIDI_NOTE_OFF, count % 2 ? 60 : 62, 0);
+          send (MIDI_NOTE_ON, count % 2 ? 62 : 60, 90);
+          wait_until (&due, interval);
+          break;
+        case PATTERN_GLISSANDO:
+          /* up and down the keys from 36 to 96 */
+          send (MIDI_NOTE_OFF, key, 0);
+          key = 36 + ABS ((count % 120) - 60);
+          send (MIDI_NOTE_ON, key, 80);
+          wait_until (&due, interval);
+          break;
+        case PATTERN_STORM:
+          if (storm[count % STORM_HELD] >= 0)
+            send (MIDI_NOTE_OFF, storm[count % STORM_HELD], 0);
+          storm[count % STORM_HELD] = g_random_int_range (LOWEST_KEY, HIGHEST_KEY + 1);
+          send (MIDI_NOTE_ON, storm[count % STORM_HELD], g_random_int_range (1, 128));
+          wait_until (&due, interval);
+          break;
+        case PATTERN_CLUSTER:
+          /* held for a second, then let off and struck again */
+          release_all ();
+          for (i = 0; i < n; i++)
+            send (MIDI_NOTE_ON, CLAMP (60 - n / 2, LOWEST_KEY, HIGHEST_KEY + 1 - n) + i, 100);
+          wait_until (&due, G_USEC_PER_SEC);
+          break;
+        default:
+          return;
+        }
+      count++;
+    }
+}
+
+static gboolean
+quit_loop (GMainLoop * loop)
+{
+  g_main_loop_quit (loop);
+  return FALSE;
+}
+
+/* main thread: sets the damping preference, as the preferences dialog
+ * does, and recompiles the transform that depends on it */
+static gboolean
+apply_damping (load_job * job)
+{
+  g_mutex_lock (&job->lock);
+  job->prefs->damping = job->damping;
+  midi_transform_compile (job->prefs);
+  job->applied = TRUE;
+  g_cond_signal (&job->applied_cond);
+  g_mutex_unlock (&job->lock);
+  return FALSE;
+}
+
+/* load thread: has the main thread set the damping and waits for it */
+static void
+set_damping (load_job * job, gboolean damping)
+{
+  g_mutex_lock (&job->lock);
+  job->damping = damping;
+  job->applied = FALSE;
+  g_idle_add ((GSourceFunc) apply_damping, job);
+  while (!job->applied)
+    g_cond_wait (&job->applied_cond, &job->lock);
+  g_mutex_unlock (&job->lock);
+}
+
+static gpointer
+load_func (load_job * job)
+{
+  pattern p;
+  gboolean damping = job->damping;
+
+  for (p = 0; p < PATTERNS; p++)
+    {
+      gdouble intensity = patterns[p].start;
+      if (p == PATTERN_CLUSTER)
+        set_damping (job, TRUE);
+      for (;;)
+        {
+          guint input_written, input_dropped, immediate_written, immediate_dropped, dropped;
+          audio_stats_t stats;
+          gdouble load;
+          gboolean tipped;
+
+          get_event_counts (&input_written, &input_dropped, &immediate_written, &immediate_dropped);
+          dropped = input_dropped + immediate_dropped;
+          audio_stats_reset ();
+          play_step (p, intensity, g_get_monotonic_time () + STEP_TIME);
+          audio_stats_get (&stats);
+          get_event_counts (&input_written, &input_dropped, &immediate_written, &immediate_dropped);
+          dropped = input_dropped + immediate_dropped - dropped;
+
+          load = audio_stats_load_quantile (&stats, 0.99);
+          tipped = stats.underflows > 0 || dropped > 0 || load > job->threshold;
+          g_print ("%-10s %7.1f %-13s load %3.0f%% (99th percentile), %3u voices, %u xruns, %u dropped%s\n",
+                   patterns[p].name, intensity, patterns[p].unit, load * 100, stats.max_voices, stats.underflows, dropped,
+                   tipped ? ": too much" : "");
+          if (tipped)
+            break;
+          job->results[p].intensity = intensity;
+          job->results[p].voices = stats.max_voices;
+          job->results[p].event_rate = stats.events * (gdouble) G_USEC_PER_SEC / STEP_TIME;
+          job->results[p].load = load;
+          if (intensity >= patterns[p].limit)
+            break;
+          intensity = MIN (intensity * STEP_GROWTH, patterns[p].limit);
+        }
+      release_all ();
+      if (p == PATTERN_CLUSTER)
+        set_damping (job, damping);
+      /* lets the last notes die away before the next pattern */
+      g_usleep (G_USEC_PER_SEC);
+    }
+  g_idle_add ((GSourceFunc) quit_loop, job->loop);
+  return NULL;
+}
+
+gint
+load_test_run (HistoricHarpsichordPrefs * prefs, gchar const *driver, gdouble threshold)
+{
+  load_job job;
+  GThread *thread;
+  audio_stats_t stats;
+  pattern p;
+
+  memset (&job, 0, sizeof (job));
+  job.prefs = prefs;
+  job.threshold = threshold;
+  job.damping = prefs->damping;
+  if (driver)
+    g_string_assign (prefs->audio_driver, driver);
+  /* only the generated notes are to be heard */
+  g_string_assign (prefs->midi_driver, "dummy");
+  if (audio_initialize (prefs))
+    {
+      g_warning ("Could not start the audio for the load test");
+      return 1;
+    }
+
+  g_mutex_init (&job.lock);
+  g_cond_init (&job.applied_cond);
+  job.loop = g_main_loop_new (NULL, FALSE);
+  thread = g_thread_new ("Load generator", (GThreadFunc) load_func, &job);
+  g_main_loop_run (job.loop);
+  g_thread_join (thread);
+  g_main_loop_unref (job.loop);
+  g_mutex_clear (&job.lock);
+  g_cond_clear (&job.applied_cond);
+  audio_stats_get (&stats);
+  audio_close ();
+
+  g_print ("\nSustained with the %s driver, %u-frame periods at %u Hz, SoundFont %s, below %.0f%% load:\n",
+           prefs->audio_driver->str, stats.period_frames,
+           strcmp (prefs->audio_driver->str, "null") ? prefs->portaudio_sample_rate : NULL_BACKEND_SAMPLE_RATE,
+           prefs->fluidsynth_soundfont->str, threshold * 100);
+  for (p = 0; p < PATTERNS; p++)
+    if (job.results[p].intensity > 0)
+      g_print ("%-10s %7.1f %-13s %3u voices, %7.1f events/s, load %3.0f%%\n", patterns[p].name, job.results[p].intensity,
+               patterns[p].unit, job.results[p].voices, job.results[p].event_rate, job.results[p].load * 100);
+    else
+      g_print ("%-10s not even %.0f %s\n", patterns[p].name, patterns[p].start, patterns[p].unit);
+  return 0;
+}
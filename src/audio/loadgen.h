@@ -0,0 +1,32 @@
+/*
+ * loadgen.h
+ * Finding how much playing the machine sustains before it drops out.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <historicHarpsichord/historicHarpsichord_types.h>
+
+/**
+ * Plays dense chords, trills, glissandi, random storms and damped
+ * clusters through input_midi_event(), each growing step by step until
+ * the audio callback reports an xrun, a queue drops events, or the load
+ * of the slowest 1% of blocks crosses the threshold. Then prints the
+ * polyphony and event rate each pattern sustained with this machine,
+ * period size and SoundFont.
+ *
+ * @param driver  the audio driver, or NULL for that of the preferences
+ * @param threshold  the load to stop at, as a fraction of the period
+ * @return  an exit status
+ */
+gint load_test_run (HistoricHarpsichordPrefs * prefs, gchar const *driver, gdouble threshold);
+
+#endif // LOADGEN_H
@@ -0,0 +1,118 @@
+/*
+ * metrics.c
+ * Exporting the health of the audio and MIDI threads for monitoring.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <time.h>
+#include <glib.h>
+#include "audio/metrics.h"
+#include "audio/audiostats.h"
+#include "audio/audiointerface.h"
+#include "audio/fluid.h"
+
+#define METRICS_INTERVAL (5)
+#define METRIC_PREFIX "historic_harpsichord_"
+
+static gboolean metrics_on = FALSE;
+static gchar *metrics_filename;
+/* the CPU time each thread has used, in milliseconds, written by that thread */
+static guint cpu_msec[METRICS_THREADS];
+
+static gchar const *const thread_names[METRICS_THREADS] = { "audio", "midi", "queue", "main" };
+
+void
+metrics_thread_cpu (metrics_thread thread)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec now;
+  if (!metrics_on || clock_gettime (CLOCK_THREAD_CPUTIME_ID, &now))
+    return;
+  g_atomic_int_set (&cpu_msec[thread], (guint) (now.tv_sec * 1000 + now.tv_nsec / 1000000));
+#endif
+}
+
+static void
+append_header (GString * text, gchar const *name, gchar const *type, gchar const *help)
+{
+  g_string_append_printf (text, "# HELP " METRIC_PREFIX "%s %s\n# TYPE " METRIC_PREFIX "%s %s\n", name, help, name, type);
+}
+
+gchar *
+metrics_format (void)
+{
+  GString *text = g_string_new ("");
+  audio_stats_t stats;
+  guint input_written, input_dropped, immediate_written, immediate_dropped;
+  gdouble quantiles[] = { 0.5, 0.9, 0.99 };
+  guint i;
+
+  audio_stats_get (&stats);
+  get_event_counts (&input_written, &input_dropped, &immediate_written, &immediate_dropped);
+  metrics_thread_cpu (METRICS_THREAD_MAIN);
+
+  append_header (text, "audio_blocks_total", "counter", "Blocks the audio callback has rendered.");
+  g_string_append_printf (text, METRIC_PREFIX "audio_blocks_total %u\n", stats.blocks);
+  append_header (text, "audio_xruns_total", "counter", "Blocks the audio backend reported an underflow or overflow before.");
+  g_string_append_printf (text, METRIC_PREFIX "audio_xruns_total{kind=\"underflow\"} %u\n", stats.underflows);
+  g_string_append_printf (text, METRIC_PREFIX "audio_xruns_total{kind=\"overflow\"} %u\n", stats.overflows);
+  append_header (text, "audio_load", "gauge", "Time taken to render a block as a fraction of its period, to the nearest 5% above.");
+  for (i = 0; i < G_N_ELEMENTS (quantiles); i++)
+    g_string_append_printf (text, METRIC_PREFIX "audio_load{quantile=\"%g\"} %g\n", quantiles[i], audio_stats_load_quantile (&stats, quantiles[i]));
+  g_string_append_printf (text, METRIC_PREFIX "audio_load{quantile=\"1\"} %g\n", stats.max_load_permille / 1000.0);
+  append_header (text, "synth_events_total", "counter", "MIDI events fed to the synth.");
+  g_string_append_printf (text, METRIC_PREFIX "synth_events_total %u\n", stats.events);
+  append_header (text, "queue_events_total", "counter", "MIDI events written to the queues.");
+  g_string_append_printf (text, METRIC_PREFIX "queue_events_total{queue=\"input\"} %u\n", input_written);
+  g_string_append_printf (text, METRIC_PREFIX "queue_events_total{queue=\"immediate\"} %u\n", immediate_written);
+  append_header (text, "queue_events_dropped_total", "counter", "MIDI events dropped because a queue was full.");
+  g_string_append_printf (text, METRIC_PREFIX "queue_events_dropped_total{queue=\"input\"} %u\n", input_dropped);
+  g_string_append_printf (text, METRIC_PREFIX "queue_events_dropped_total{queue=\"immediate\"} %u\n", immediate_dropped);
+  append_header (text, "voices", "gauge", "Voices sounding at the end of the last block.");
+  g_string_append_printf (text, METRIC_PREFIX "voices %u\n", stats.voices);
+  append_header (text, "voices_max", "gauge", "The most voices sounding at the end of a block.");
+  g_string_append_printf (text, METRIC_PREFIX "voices_max %u\n", stats.max_voices);
+#ifdef _HAVE_FLUIDSYNTH_
+  append_header (text, "sample_memory_bytes", "gauge", "Memory taken by the samples the synths play from.");
+  g_string_append_printf (text, METRIC_PREFIX "sample_memory_bytes %" G_GUINT64_FORMAT "\n", fluidsynth_get_sample_bytes ());
+#endif
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  append_header (text, "thread_cpu_seconds_total", "counter", "CPU time used by each thread.");
+  for (i = 0; i < METRICS_THREADS; i++)
+    g_string_append_printf (text, METRIC_PREFIX "thread_cpu_seconds_total{thread=\"%s\"} %.3f\n", thread_names[i], g_atomic_int_get (&cpu_msec[i]) / 1000.0);
+#endif
+  return g_string_free (text, FALSE);
+}
+
+/* g_file_set_contents() writes aside and renames over the old file, so a
+ * reader never sees half of it */
+static gboolean
+write_metrics (gpointer data)
+{
+  gchar *text = metrics_format ();
+  GError *error = NULL;
+  if (!g_file_set_contents (metrics_filename, text, -1, &error))
+    {
+      g_warning ("Could not write the metrics: %s", error->message);
+      g_error_free (error);
+    }
+  g_free (text);
+  return TRUE;
+}
+
+void
+metrics_enable (gchar const *filename)
+{
+  if (metrics_on)
+    return;
+  metrics_filename = g_strdup (filename);
+  metrics_on = TRUE;
+  write_metrics (NULL);
+  g_timeout_add_seconds (METRICS_INTERVAL, write_metrics, NULL);
+}
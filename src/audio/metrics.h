@@ -0,0 +1,50 @@
+/*
+ * metrics.h
+ * Exporting the health of the audio and MIDI threads for monitoring.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+/**
+ * The threads whose CPU time is exported.
+ */
+typedef enum metrics_thread
+{
+  METRICS_THREAD_AUDIO,
+  METRICS_THREAD_MIDI,
+  METRICS_THREAD_QUEUE,
+  METRICS_THREAD_MAIN,
+  METRICS_THREADS
+} metrics_thread;
+
+/**
+ * Starts rewriting the given file every few seconds with the metrics in
+ * Prometheus text format, as the node exporter's textfile collector reads
+ * them. The file is replaced whole, so a reader never sees half of it.
+ */
+void metrics_enable (gchar const *filename);
+
+/**
+ * Notes the CPU time the calling thread has used so far. Called by each
+ * thread as it finishes a pass; takes no locks and does nothing unless
+ * metrics are enabled.
+ */
+void metrics_thread_cpu (metrics_thread thread);
+
+/**
+ * Returns the metrics in Prometheus text format, to be freed with g_free().
+ * Called by the main thread.
+ */
+gchar *metrics_format (void);
+
+#endif // METRICS_H
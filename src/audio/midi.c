@@ -25,6 +25,9 @@
 #include "audio/midi.h"
 #include "audio/audiointerface.h"
 #include "audio/temperament.h"
+#include "audio/miditransform.h"
+#include "audio/tuning.h"
+#include "audio/fluid.h"
 
 #include <glib.h>
 #include <math.h>
@@ -33,115 +36,38 @@
 
 
 
-gdouble
-get_time ()
-{
-  GTimeVal tv;
-  double seconds;
-
-  g_get_current_time (&tv);
-
-  seconds = tv.tv_sec + tv.tv_usec / 1000000.0;
-  return seconds;
-}
-
-
-
-#define command ((*buf)&0xF0)
-#define notenumber ((*(buf+1))&0x7F)
-#define velocity ((*(buf+2))&0x7F)
+//Event generated by MIDI controller or Scheme script
+//applies the transform compiled from the preferences and plays the passed event on default backend
 void
-adjust_midi_velocity (gchar * buf, gint percent)
-{
-  if ((command == MIDI_NOTE_ON) && buf[2])
-    buf[2] = 127 - (gint) ((127 - buf[2]) * percent / 100.0);
-}
-
-void add_after_touch (gchar * buf)
+play_adjusted_midi_event (gchar * buf, gint length)
 {
-   if (HistoricHarpsichord.prefs.damping)
+  if (!midi_transform_apply ((guchar *) buf, length))
+    return;
+#ifdef _HAVE_FLUIDSYNTH_
+  /* a tuning message retunes the synth the way a temperament does rather
+   * than going to the audio thread */
+  if ((guchar) buf[0] == SYS_EXCLUSIVE_MESSAGE1)
     {
-      static gdouble times[0x7F]; //takes no account of channel, really only good for one channel.
-      //HACK IN kill pitch bend and "modulation" wheel here
-      if (command == MIDI_PITCH_BEND)
-        {g_print ("Dropping pitch bend\n"); *buf=0; return;} 
-      if (command == 0xB0)
-        {g_print ("Dropping controller change message\n"); *buf=0;  return;} 
-        
-        
-      if (command == MIDI_NOTE_ON)
+      gdouble pitch[128];
+      fluidsynth_get_key_tuning (pitch);
+      if (tuning_apply_mts ((guchar *) buf, length, pitch))
         {
-          times[notenumber] = get_time ();
-        }
-      if (command == MIDI_NOTE_OFF)
-        {
-          //g_debug("after %f seconds\n", get_time()-times[notenumber]);
-
-          buf[0] = MIDI_NOTE_ON;        //or the channel here
-          buf[2] = 60 / exp ((get_time () - times[notenumber]) * 1);    //scale according to the time
+          fluidsynth_set_key_tuning (pitch);
           return;
         }
     }
-}
-
-
-//Event generated by MIDI controller or Scheme script
-//adjusts the note-on volume by preferred dynamic compression and plays the passed event on default backend
-void
-play_adjusted_midi_event (gchar * buf)
-{
-  adjust_midi_velocity (buf, 100 - HistoricHarpsichord.prefs.dynamic_compression);
-  add_after_touch (buf);
+#endif
   //g_print ("play adj midibytes 0x%hhX 0x%hhX 0x%hhX\n", *(buf+0), *(buf+1), *(buf+2));
-  play_midi_event (DEFAULT_BACKEND, 0, (guchar*) buf);
+  play_midi_event (DEFAULT_BACKEND, 0, (guchar*) buf, length);
 }
 
 #define EDITING_MASK (GDK_SHIFT_MASK)
 //these are event generated by a MIDI controller or Scheme script
 void
-handle_midi_event (gchar * buf)
+handle_midi_event (gchar * buf, gint length)
 {
 
  
-          play_adjusted_midi_event (buf);
+          play_adjusted_midi_event (buf, length);
         
 }
-
-
-/* change the MIDI output tuning */
-void
-change_tuning (gdouble * cents)
-{
-  guchar buffer[] = {
-    0xF0, 0x7F,                 //               Universal Real-Time SysEx header
-
-    0x7F,                       //<device ID>         ID of target device (7F = all devices)
-
-    0x08,                       //             sub-ID#1 = "MIDI Tuning Standard"
-
-    0x08,                       //             sub-ID#2 = "scale/octave tuning 1-byte form (Real-Time)"
-
-    0x03,                       /*            channel/options byte 1
-                                   bits 0 to 1 = channel 15 to 16
-                                   bit 2 to 6 = reserved for future expansion */
-
-    0x7F,                       //            channel byte 2 - bits 0 to 6 = channel 8 to 14
-
-    0x7F,                       //            channel byte 3 - bits 0 to 6 = channel 1 to 7
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    /*  [ss]            12 byte tuning offset of 12 semitones from C to B
-       00H means -64 cents
-       40H means 0 cents (equal temperament)
-       7FH means +63 cents */
-
-    0xF7                        //      EOX
-  };
-  gint i;
-  for (i = 0; i < 12; i++)
-  // g_print("%d %f\n", i, cents[i]), 
-   buffer[i + 8] = 64 + (cents[HistoricHarpsichord.prefs.lowpitch? (i+1)%12 : i] + 0.5);
-   //);
-  play_midi_event (DEFAULT_BACKEND, 0, buffer);
-}
-
-
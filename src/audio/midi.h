@@ -36,11 +36,7 @@
 
 
 void generate_midi (void);
-gdouble get_time (void);
 gdouble get_playuntil (void);
-void adjust_midi_velocity (gchar * buf, gint percent);
-void add_after_touch (gchar * buf);
-void change_tuning (gdouble * cents);
 gdouble get_midi_on_time (GList * events);
 gdouble get_midi_off_time (GList * events);
 
@@ -58,16 +54,15 @@ void update_start_time (double adjust);
 void initialize_until_time (void);
 
 
-void handle_midi_event (gchar * buf);
+void handle_midi_event (gchar * buf, gint length);
 
 
 gboolean intercept_midi_event (gint * midi);
 
 
 
-void change_tuning (gdouble * cents);
 void toggle_paused ();
-void play_adjusted_midi_event (gchar * buf);
+void play_adjusted_midi_event (gchar * buf, gint length);
 gboolean set_midi_capture (gboolean set);
 void process_midi_event (gchar * buf);
 
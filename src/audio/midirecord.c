@@ -0,0 +1,280 @@
+/*
+ * midirecord.c
+ * Recording the MIDI input with its timing, and replaying it.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "audio/midirecord.h"
+#include "audio/audiointerface.h"
+#include "audio/audiostats.h"
+#include "audio/ringbuffer.h"
+
+#define MAGIC "HHMIDI"
+#define VERSION_BYTE (1)
+#define HEADER_BYTES (16)
+/* room for the events of a fast passage between two writes */
+#define RECORD_BUFFER_BYTES (65536)
+/* how often the main loop writes the events out, in ms */
+#define RECORD_FLUSH_INTERVAL (100)
+/* the time left after a replay for the last notes to sound, in us */
+#define REPLAY_TAIL (G_USEC_PER_SEC)
+
+static jack_ringbuffer_t *record_buffer = NULL;
+static FILE *record_file = NULL;
+static gint64 last_time;
+static guint record_dropped = 0;        /* events there was no room for */
+
+/* what the MIDI thread puts in the ring buffer ahead of each event */
+typedef struct recorded_event
+{
+  gint64 time;
+  guint16 length;
+} recorded_event;
+
+static void
+write_leb128 (FILE * fp, guint64 value)
+{
+  do
+    {
+      guchar byte = value & 0x7F;
+      value >>= 7;
+      fputc (byte | (value ? 0x80 : 0), fp);
+    }
+  while (value);
+}
+
+static gboolean
+read_leb128 (guchar const **p, guchar const *end, guint64 * value)
+{
+  gint shift = 0;
+  *value = 0;
+  while (*p < end && shift < 64)
+    {
+      guchar byte = *(*p)++;
+      *value |= (guint64) (byte & 0x7F) << shift;
+      if (!(byte & 0x80))
+        return TRUE;
+      shift += 7;
+    }
+  return FALSE;
+}
+
+/* main thread: writes out the events the MIDI thread has recorded */
+static gboolean
+flush_recording (gpointer data)
+{
+  recorded_event event;
+  guchar bytes[MIDI_EVENT_MAX_LENGTH];
+  if (record_file == NULL)
+    return FALSE;
+  while (jack_ringbuffer_read_space (record_buffer) >= sizeof (event))
+    {
+      jack_ringbuffer_peek (record_buffer, (char *) &event, sizeof (event));
+      if (jack_ringbuffer_read_space (record_buffer) < sizeof (event) + event.length)
+        break;
+      jack_ringbuffer_read_advance (record_buffer, sizeof (event));
+      jack_ringbuffer_read (record_buffer, (char *) bytes, event.length);
+      write_leb128 (record_file, event.time - last_time);
+      write_leb128 (record_file, event.length);
+      fwrite (bytes, 1, event.length, record_file);
+      last_time = event.time;
+    }
+  fflush (record_file);
+  return TRUE;
+}
+
+gboolean
+midi_record_start (gchar const *filename)
+{
+  gint64 now = g_get_real_time ();
+  gint i;
+  if (record_file)
+    return TRUE;
+  record_file = g_fopen (filename, "wb");
+  if (record_file == NULL)
+    {
+      g_warning ("Could not record the MIDI input to %s", filename);
+      return FALSE;
+    }
+  fwrite (MAGIC, 1, strlen (MAGIC), record_file);
+  fputc (VERSION_BYTE, record_file);
+  fputc (0, record_file);
+  for (i = 0; i < 8; i++)
+    fputc ((now >> (8 * i)) & 0xFF, record_file);
+  record_buffer = jack_ringbuffer_create (RECORD_BUFFER_BYTES);
+  last_time = g_get_monotonic_time ();
+  g_timeout_add (RECORD_FLUSH_INTERVAL, flush_recording, NULL);
+  atexit (midi_record_stop);
+  g_message ("Recording the MIDI input to %s", filename);
+  return TRUE;
+}
+
+void
+midi_record_event (unsigned char const *buffer, int length)
+{
+  recorded_event event;
+  if (G_LIKELY (record_buffer == NULL))
+    return;
+  if (jack_ringbuffer_write_space (record_buffer) < sizeof (event) + length)
+    {
+      g_atomic_int_inc (&record_dropped);
+      return;
+    }
+  event.time = g_get_monotonic_time ();
+  event.length = length;
+  jack_ringbuffer_write (record_buffer, (char const *) &event, sizeof (event));
+  jack_ringbuffer_write (record_buffer, (char const *) buffer, length);
+}
+
+void
+midi_record_stop (void)
+{
+  if (record_file == NULL)
+    return;
+  flush_recording (NULL);
+  fclose (record_file);
+  record_file = NULL;
+  if (g_atomic_int_get (&record_dropped))
+    g_warning ("%u MIDI events came too fast to be recorded", g_atomic_int_get (&record_dropped));
+}
+
+typedef struct replay_job
+{
+  guchar *contents;
+  gsize length;
+  gboolean fast;
+  guint events;
+  gint64 elapsed;
+  gboolean malformed;
+  GMainLoop *loop;
+} replay_job;
+
+static gboolean
+quit_loop (GMainLoop * loop)
+{
+  g_main_loop_quit (loop);
+  return FALSE;
+}
+
+/* sends the events from a thread of its own, as a MIDI driver would */
+static gpointer
+replay_func (replay_job * job)
+{
+  guchar const *p = job->contents + HEADER_BYTES, *end = job->contents + job->length;
+  gint64 start = g_get_monotonic_time (), due = start;
+  guint64 delta, length;
+
+  while (p < end)
+    {
+      if (!read_leb128 (&p, end, &delta) || !read_leb128 (&p, end, &length) || length == 0 || length > MIDI_EVENT_MAX_LENGTH
+          || length > (guint64) (end - p))
+        {
+          job->malformed = TRUE;
+          break;
+        }
+      /* the silence before the first event is left out */
+      if (job->events)
+        due += delta;
+      if (job->fast)
+        {
+          guint input_written, input_dropped, immediate_written, immediate_dropped, dropped;
+          /* the input queue is only so long: send again whatever it had no room for */
+          do
+            {
+              get_event_counts (&input_written, &dropped, &immediate_written, &immediate_dropped);
+              input_midi_event (MIDI_BACKEND, 0, p, length);
+              get_event_counts (&input_written, &input_dropped, &immediate_written, &immediate_dropped);
+              if (input_dropped != dropped)
+                g_usleep (1000);
+            }
+          while (input_dropped != dropped);
+        }
+      else
+        {
+          gint64 now = g_get_monotonic_time ();
+          if (due > now)
+            g_usleep (due - now);
+          input_midi_event (MIDI_BACKEND, 0, p, length);
+        }
+      p += length;
+      job->events++;
+    }
+  job->elapsed = g_get_monotonic_time () - start;
+  g_usleep (REPLAY_TAIL);
+  g_idle_add ((GSourceFunc) quit_loop, job->loop);
+  return NULL;
+}
+
+gint
+midi_replay_run (HistoricHarpsichordPrefs * prefs, gchar const *filename, gchar const *driver, gboolean fast)
+{
+  replay_job job;
+  GError *error = NULL;
+  GThread *thread;
+  audio_stats_t stats;
+  guint input_written, input_dropped, immediate_written, immediate_dropped;
+  gchar *summary;
+
+  memset (&job, 0, sizeof (job));
+  if (!g_file_get_contents (filename, (gchar **) & job.contents, &job.length, &error))
+    {
+      g_warning ("Could not read the recording: %s", error->message);
+      g_error_free (error);
+      return 1;
+    }
+  if (job.length < HEADER_BYTES || memcmp (job.contents, MAGIC, strlen (MAGIC)) || job.contents[strlen (MAGIC)] != VERSION_BYTE)
+    {
+      g_warning ("%s is not a MIDI recording", filename);
+      g_free (job.contents);
+      return 1;
+    }
+  job.fast = fast;
+
+  if (driver)
+    g_string_assign (prefs->audio_driver, driver);
+  /* only the recording is to be heard */
+  g_string_assign (prefs->midi_driver, "dummy");
+  if (audio_initialize (prefs))
+    {
+      g_warning ("Could not start the audio to replay %s", filename);
+      g_free (job.contents);
+      return 1;
+    }
+  audio_stats_reset ();
+
+  job.loop = g_main_loop_new (NULL, FALSE);
+  thread = g_thread_new ("MIDI replay", (GThreadFunc) replay_func, &job);
+  g_main_loop_run (job.loop);
+  g_thread_join (thread);
+  g_main_loop_unref (job.loop);
+
+  get_event_counts (&input_written, &input_dropped, &immediate_written, &immediate_dropped);
+  audio_stats_get (&stats);
+  audio_close ();
+  g_print ("Replayed %u events %s in %.3f s\n", job.events, fast ? "as fast as possible" : "in real time", job.elapsed / 1e6);
+  if (fast)
+    g_print ("%u events resent when the input queue was full, %u dropped by the immediate queue\n", input_dropped, immediate_dropped);
+  else
+    g_print ("%u events dropped by the input queue, %u by the immediate queue\n", input_dropped, immediate_dropped);
+  summary = audio_stats_format (&stats);
+  g_print ("%s", summary);
+  g_free (summary);
+  g_free (job.contents);
+  if (job.malformed)
+    {
+      g_warning ("%s is cut short or corrupt after %u events", filename, job.events);
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * midirecord.h
+ * Recording the MIDI input with its timing, and replaying it.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDIRECORD_H
+#define MIDIRECORD_H
+
+#include <historicHarpsichord/historicHarpsichord_types.h>
+
+/*
+ * A recording starts with the eight bytes "HHMIDI", a version byte and a
+ * zero byte, then the wall-clock time it started in microseconds, eight
+ * bytes little-endian. Each event follows as the microseconds since the
+ * one before and its length, both unsigned LEB128, then its bytes.
+ */
+
+/**
+ * Starts recording each event input_midi_event() is given to the file,
+ * until exit. The events are written out from the main loop.
+ *
+ * @return  FALSE if the file could not be opened
+ */
+gboolean midi_record_start (gchar const *filename);
+
+/**
+ * Records an event if recording. Called by input_midi_event() on the MIDI
+ * thread; takes no locks and does not allocate.
+ */
+void midi_record_event (unsigned char const *buffer, int length);
+
+/**
+ * Writes out the events recorded and closes the file.
+ */
+void midi_record_stop (void);
+
+/**
+ * Plays a recording through input_midi_event() with the given audio driver
+ * and no MIDI driver, then prints what the queues dropped and how the audio
+ * callback fared.
+ *
+ * @param driver  the audio driver, or NULL for that of the preferences
+ * @param fast  TRUE to send the events as fast as the input queue takes
+ *   them, FALSE to keep their timing
+ * @return  an exit status
+ */
+gint midi_replay_run (HistoricHarpsichordPrefs * prefs, gchar const *filename, gchar const *driver, gboolean fast);
+
+#endif // MIDIRECORD_H
@@ -0,0 +1,96 @@
+/*
+ * miditransform.c
+ * The changes made to MIDI events on their way in, compiled into tables.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <glib.h>
+#include "audio/midi.h"
+#include "audio/miditransform.h"
+
+#define BIT(status) (1 << ((status) >> 4))
+#define HAS_KEY(status) (BIT (status) & (BIT (MIDI_NOTE_OFF) | BIT (MIDI_NOTE_ON) | BIT (MIDI_KEY_PRESSURE)))
+
+typedef struct midi_transform
+{
+  guint8 velocity[128];         /* the velocity played for each note-on velocity */
+  guint8 key[128];              /* the key played for each key */
+  guint16 dropped;              /* a bit for each message type, by the status byte's upper nibble */
+} midi_transform;
+
+/* compiling writes the table not published and then publishes it. A
+ * reader counts itself in on the table it reads, and backs off if the table
+ * is no longer the one published, so a compile waits only for readers that
+ * took up the old table before the last publish to be done with it. Readers
+ * never wait. */
+static midi_transform tables[2];
+static midi_transform *current = NULL;
+static gint readers[2];
+
+void
+midi_transform_compile (HistoricHarpsichordPrefs * prefs)
+{
+  midi_transform *t = (current == &tables[0]) ? &tables[1] : &tables[0];
+  gint percent = 100 - prefs->dynamic_compression;
+  gint i;
+
+  /* a table is read in constant time, so this is brief */
+  while (g_atomic_int_get (&readers[t - tables]))
+    g_thread_yield ();
+
+  /* velocities are drawn towards the top by the compression, 0 stays a note-off */
+  t->velocity[0] = 0;
+  for (i = 1; i < 128; i++)
+    t->velocity[i] = 127 - (gint) ((127 - i) * percent / 100.0);
+
+  for (i = 0; i < 128; i++)
+    t->key[i] = i;
+
+  /* pitch bend and the modulation wheel have no place on a harpsichord,
+   * and damping is done by the synth as the keys are let off */
+  t->dropped = prefs->damping ? BIT (MIDI_PITCH_BEND) | BIT (MIDI_CONTROL_CHANGE) : 0;
+
+  g_atomic_pointer_set (&current, t);
+}
+
+gboolean
+midi_transform_apply (guchar * buf, gint length)
+{
+  midi_transform const *t;
+  guchar status;
+  gboolean keep = TRUE;
+
+  if (length < 1 || buf[0] < 0x80)
+    return TRUE;
+  status = buf[0];
+  /* counts in on the published table, taking it up again if it changed
+   * in between */
+  for (;;)
+    {
+      t = g_atomic_pointer_get (&current);
+      if (t == NULL)
+        return TRUE;
+      g_atomic_int_inc (&readers[t - tables]);
+      if (g_atomic_pointer_get (&current) == t)
+        break;
+      g_atomic_int_add (&readers[t - tables], -1);
+    }
+
+  if (t->dropped & BIT (status))
+    keep = FALSE;
+  else
+    {
+      if (HAS_KEY (status) && length > 1)
+        buf[1] = t->key[buf[1] & 0x7F];
+      if ((status & 0xF0) == MIDI_NOTE_ON && length > 2)
+        buf[2] = t->velocity[buf[2] & 0x7F];
+    }
+  g_atomic_int_add (&readers[t - tables], -1);
+  return keep;
+}
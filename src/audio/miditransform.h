@@ -0,0 +1,34 @@
+/*
+ * miditransform.h
+ * The changes made to MIDI events on their way in, compiled into tables.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MIDITRANSFORM_H
+#define MIDITRANSFORM_H
+
+#include <historicHarpsichord/historicHarpsichord.h>
+
+/**
+ * Compiles the preferences into the tables midi_transform_apply() uses.
+ * Call on the main thread at start-up and whenever the preferences change.
+ */
+void midi_transform_compile (HistoricHarpsichordPrefs * prefs);
+
+/**
+ * Applies the compiled velocity curve, message filter and key map to an
+ * event, in place and in constant time. Safe on any thread.
+ *
+ * @param buf  a MIDI event, status byte first
+ * @param length  the bytes in buf
+ * @return  FALSE if the event is to be dropped
+ */
+gboolean midi_transform_apply (guchar * buf, gint length);
+
+#endif // MIDITRANSFORM_H
@@ -0,0 +1,365 @@
+#ifdef _HAVE_FLUIDSYNTH_
+/*
+ * notecache.c
+ * Plucks rendered once per key and mixed from memory.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+#include <fluidsynth.h>
+#include "audio/notecache.h"
+#include "audio/voicepolicy.h"
+
+/* the rendered note is compared with the live continuation over this many frames */
+#define HANDOFF_FRAMES (1024)
+/* a released voice ends when it has fallen by 60 dB */
+#define RELEASE_FLOOR (1e-3)
+#define MAX_RELEASE_SECONDS (2.0)
+/* below this the default velocity to filter cutoff modulator makes softer
+ * notes duller as well as quieter, so they are left to the live synth */
+#define MIN_CACHED_VELOCITY (64)
+#define SILENCE (1e-6)
+#define MAX_CACHED_VOICES (64)
+/* a cached voice fades out over this many frames as the live synth's
+ * continuation fades in, so that the two need not match sample for sample */
+#define CROSSFADE_FRAMES (1024)
+/* a cached voice re-plucked fades out over this time, as a live one does */
+#define REPLUCK_SECONDS (0.03)
+
+typedef struct cached_voice
+{
+  gint key;                     /* -1 for a free voice */
+  gint chan;
+  gint velocity;
+  glong pos;                    /* the next frame of the rendered note */
+  gboolean released;
+  gfloat fade;                  /* the release envelope, 1.0 while held */
+  gfloat fade_step;
+  gfloat release_offset;        /* the damping given to the release, in timecents */
+  gboolean handed_off;          /* the live synth's continuation has started */
+  gfloat crossfade;             /* the level left to the cached voice, 1.0 until it is handed off */
+} cached_voice;
+
+static cached_voice voices[MAX_CACHED_VOICES] = {[0 ... MAX_CACHED_VOICES - 1] = {-1} };
+/* for each channel and key, whether the live synth has taken the note over
+ * on the continuation channel */
+static gboolean live_owner[16][128];
+
+static gdouble
+rms (gfloat const *left, gfloat const *right, glong n)
+{
+  gdouble sum = 0.0;
+  glong i;
+  for (i = 0; i < n; i++)
+    sum += left[i] * left[i] + right[i] * right[i];
+  return n ? sqrt (sum / (2 * n)) : 0.0;
+}
+
+/* sets the sample start offset of notes started on chan */
+static void
+set_start_offset (fluid_synth_t * synth, gint chan, glong frames)
+{
+  fluid_synth_set_gen (synth, chan, GEN_STARTADDROFS, (float) (frames % 32768));
+  fluid_synth_set_gen (synth, chan, GEN_STARTADDRCOARSEOFS, (float) (frames / 32768));
+}
+
+/* plays key at full velocity from the given frame of its sample */
+static void
+start_note (fluid_synth_t * synth, gint sfont_id, gint key, glong offset)
+{
+  /* clears the voices of the previous key and the generator offsets */
+  fluid_synth_system_reset (synth);
+  fluid_synth_program_select (synth, 0, sfont_id, 0, 0);
+  set_start_offset (synth, 0, offset);
+  fluid_synth_noteon (synth, 0, key, 127);
+}
+
+/* renders one key into the cache; returns FALSE if the key is silent */
+static gboolean
+render_key (note_cache * cache, fluid_synth_t * synth, gint sfont_id, gint key, gdouble rate)
+{
+  glong frames = cache->frames, max_release = (glong) (MAX_RELEASE_SECONDS * rate), n;
+  gfloat *left = g_malloc (frames * sizeof (gfloat));
+  gfloat *right = g_malloc (frames * sizeof (gfloat));
+  gfloat tail_left[HANDOFF_FRAMES], tail_right[HANDOFF_FRAMES];
+  gdouble level, live;
+
+  start_note (synth, sfont_id, key, 0);
+  fluid_synth_write_float (synth, frames, left, 0, 1, right, 0, 1);
+  level = rms (left + frames - HANDOFF_FRAMES, right + frames - HANDOFF_FRAMES, HANDOFF_FRAMES);
+  if (level < SILENCE)
+    {
+      g_free (left);
+      g_free (right);
+      return FALSE;
+    }
+
+  /* how long the release takes from the end of the rendered start */
+  fluid_synth_noteoff (synth, 0, key);
+  for (n = 0; n < max_release; n += 64)
+    {
+      fluid_synth_write_float (synth, 64, tail_left, 0, 1, tail_right, 0, 1);
+      if (rms (tail_left, tail_right, 64) < level * RELEASE_FLOOR)
+        break;
+    }
+  cache->release_frames[key] = MAX (n, 64);
+
+  /* the live synth restarts the envelopes when it takes a note over, so
+   * its level there is measured to match it to the rendered note */
+  start_note (synth, sfont_id, key, frames - HANDOFF_FRAMES);
+  fluid_synth_write_float (synth, HANDOFF_FRAMES, tail_left, 0, 1, tail_right, 0, 1);
+  live = rms (tail_left, tail_right, HANDOFF_FRAMES);
+  cache->handoff_gain[key] = live > SILENCE ? level / live : 0.0;
+
+  cache->left[key] = left;
+  cache->right[key] = right;
+  return TRUE;
+}
+
+note_cache *
+note_cache_render (gchar const *bank, fluid_settings_t * settings)
+{
+  fluid_synth_t *synth;
+  note_cache *cache;
+  gdouble rate = 0.0;
+  gint sfont_id, key, keys = 0;
+
+  fluid_settings_getnum (settings, "synth.sample-rate", &rate);
+  synth = new_fluid_synth (settings);
+  if (synth == NULL)
+    return NULL;
+  sfont_id = fluid_synth_sfload (synth, bank, FALSE);
+  if (sfont_id == -1)
+    {
+      delete_fluid_synth (synth);
+      return NULL;
+    }
+  fluid_synth_set_interp_method (synth, -1, FLUID_INTERP_NONE);
+  fluid_synth_set_reverb_on (synth, FALSE);
+  fluid_synth_set_chorus_on (synth, FALSE);
+
+  cache = g_malloc0 (sizeof (note_cache));
+  cache->frames = (glong) (NOTE_CACHE_SECONDS * rate);
+  cache->rate = rate;
+  if (cache->frames > HANDOFF_FRAMES + CROSSFADE_FRAMES)
+    for (key = 0; key < 128; key++)
+      if (render_key (cache, synth, sfont_id, key, rate))
+        keys++;
+  delete_fluid_synth (synth);
+
+  if (keys == 0)
+    {
+      note_cache_free (cache);
+      return NULL;
+    }
+  g_message ("Rendered %d keys, %.1f MB", keys, keys * cache->frames * 2 * sizeof (gfloat) / (1024.0 * 1024.0));
+  return cache;
+}
+
+void
+note_cache_free (note_cache * cache)
+{
+  gint key;
+  if (cache == NULL)
+    return;
+  for (key = 0; key < 128; key++)
+    {
+      g_free (cache->left[key]);
+      g_free (cache->right[key]);
+    }
+  g_free (cache);
+}
+
+/* fades out quickly the cached voices of the key and the live synth's
+ * continuation of them */
+static void
+repluck (note_cache * cache, fluid_synth_t * synth, gint chan, gint key)
+{
+  gint i;
+  for (i = 0; i < MAX_CACHED_VOICES; i++)
+    if (voices[i].key == key && voices[i].chan == chan)
+      {
+        voices[i].released = TRUE;
+        voices[i].fade_step = (gfloat) pow (RELEASE_FLOOR, 1.0 / (REPLUCK_SECONDS * cache->rate));
+      }
+  if (live_owner[chan & 0x0F][key])
+    {
+      voice_policy_repluck (synth, NOTE_CACHE_CHANNEL (chan), key);
+      live_owner[chan & 0x0F][key] = FALSE;
+    }
+}
+
+gboolean
+note_cache_note_on (note_cache * cache, fluid_synth_t * synth, gint chan, gint key, gint velocity, gboolean one_string)
+{
+  gint i;
+  if (key < 0 || key > 127)
+    return FALSE;
+  if (one_string)
+    {
+      /* the live synth's last stroke too, whichever plays this one */
+      repluck (cache, synth, chan, key);
+      voice_policy_repluck (synth, chan, key);
+    }
+  if (velocity < MIN_CACHED_VELOCITY || cache->left[key] == NULL)
+    return FALSE;
+  for (i = 0; i < MAX_CACHED_VOICES; i++)
+    if (voices[i].key < 0)
+      {
+        cached_voice *v = &voices[i];
+        v->key = key;
+        v->chan = chan;
+        v->velocity = velocity;
+        v->pos = 0;
+        v->released = FALSE;
+        v->fade = 1.0;
+        v->fade_step = (gfloat) pow (RELEASE_FLOOR, 1.0 / cache->release_frames[key]);
+        v->release_offset = 0.0;
+        v->handed_off = FALSE;
+        v->crossfade = 1.0;
+        return TRUE;
+      }
+  return FALSE;
+}
+
+void
+note_cache_note_off (fluid_synth_t * synth, gint chan, gint key, gfloat release_offset)
+{
+  /* the offset scales the release time by 2^(offset/1200), so the fall of
+   * each frame by the inverse */
+  gdouble scale = exp2 (-release_offset / 1200.0);
+  gint i;
+  if (key < 0 || key > 127)
+    return;
+  for (i = 0; i < MAX_CACHED_VOICES; i++)
+    if (voices[i].key == key && voices[i].chan == chan && !voices[i].released)
+      {
+        voices[i].released = TRUE;
+        voices[i].fade_step = (gfloat) pow (voices[i].fade_step, scale);
+        voices[i].release_offset = release_offset;
+      }
+  if (live_owner[chan & 0x0F][key])
+    {
+      voice_policy_note_off (synth, NOTE_CACHE_CHANNEL (chan), key, release_offset);
+      live_owner[chan & 0x0F][key] = FALSE;
+    }
+}
+
+void
+note_cache_hand_off (note_cache * cache, fluid_synth_t * synth, guint nframes)
+{
+  /* the volume envelope attacks linearly, so the live note fades in as
+   * the cached voice fades out */
+  gfloat attack = (gfloat) (1200.0 * log2 (CROSSFADE_FRAMES / cache->rate));
+  fluid_voice_t *started[VOICE_POLICY_MAX_VOICES];
+  gint i, j, n;
+  for (i = 0; i < MAX_CACHED_VOICES; i++)
+    {
+      cached_voice *v = &voices[i];
+      gint chan, velocity;
+      if (v->key < 0 || v->handed_off || v->pos + (glong) nframes + CROSSFADE_FRAMES <= cache->frames)
+        continue;
+      chan = NOTE_CACHE_CHANNEL (v->chan);
+      /* the synth's velocity curve is (velocity/127)^2 in amplitude */
+      velocity = (gint) lrint (v->velocity * sqrt (cache->handoff_gain[v->key] * v->fade));
+      if (velocity <= 0)
+        {
+          v->key = -1;
+          continue;
+        }
+      set_start_offset (synth, chan, v->pos);
+      /* recorded as a stroke of the continuation channel, to be re-plucked */
+      n = voice_policy_note_on (synth, chan, v->key, MIN (velocity, 127), FALSE, started);
+      set_start_offset (synth, chan, 0);
+      if (v->released)
+        {
+          /* a released voice is fading already, and is let go of at once */
+          voice_policy_note_off (synth, chan, v->key, v->release_offset);
+          v->key = -1;
+          continue;
+        }
+      for (j = 0; j < n; j++)
+        {
+          fluid_voice_gen_set (started[j], GEN_VOLENVATTACK, attack);
+          fluid_voice_update_param (started[j], GEN_VOLENVATTACK);
+        }
+      live_owner[v->chan & 0x0F][v->key] = TRUE;
+      v->handed_off = TRUE;
+    }
+}
+
+void
+note_cache_mix (note_cache * cache, guint nframes, gfloat * left, gfloat * right)
+{
+  gint i;
+  for (i = 0; i < MAX_CACHED_VOICES; i++)
+    {
+      cached_voice *v = &voices[i];
+      gfloat const *l, *r;
+      gfloat gain;
+      glong n, j;
+      if (v->key < 0)
+        continue;
+      l = cache->left[v->key] + v->pos;
+      r = cache->right[v->key] + v->pos;
+      n = MIN ((glong) nframes, cache->frames - v->pos);
+      gain = (gfloat) (v->velocity * v->velocity) / (127 * 127);
+      if (v->handed_off)
+        {
+          gfloat fade = v->fade, step = v->released ? v->fade_step : 1.0f, crossfade = v->crossfade;
+          n = MIN (n, (glong) ceil (crossfade * CROSSFADE_FRAMES));
+          for (j = 0; j < n; j++)
+            {
+              left[j] += gain * fade * crossfade * l[j];
+              right[j] += gain * fade * crossfade * r[j];
+              fade *= step;
+              crossfade -= 1.0f / CROSSFADE_FRAMES;
+            }
+          v->fade = fade;
+          v->crossfade = crossfade;
+          if (crossfade <= 0.0f || v->pos + n >= cache->frames)
+            v->key = -1;
+        }
+      else if (!v->released)
+        for (j = 0; j < n; j++)
+          {
+            left[j] += gain * l[j];
+            right[j] += gain * r[j];
+          }
+      else
+        {
+          gfloat fade = v->fade, step = v->fade_step;
+          for (j = 0; j < n; j++)
+            {
+              left[j] += gain * fade * l[j];
+              right[j] += gain * fade * r[j];
+              fade *= step;
+            }
+          v->fade = fade;
+        }
+      v->pos += n;
+      /* a voice is handed off before it reaches the end of the rendered
+       * note, and ends there once its crossfade is over */
+      if (v->fade < RELEASE_FLOOR)
+        v->key = -1;
+    }
+}
+
+void
+note_cache_stop (void)
+{
+  gint i;
+  for (i = 0; i < MAX_CACHED_VOICES; i++)
+    voices[i].key = -1;
+  memset (live_owner, 0, sizeof (live_owner));
+}
+
+#endif //_HAVE_FLUIDSYNTH_
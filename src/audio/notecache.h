@@ -0,0 +1,116 @@
+/*
+ * notecache.h
+ * Plucks rendered once per key and mixed from memory.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef NOTECACHE_H
+#define NOTECACHE_H
+
+#include <glib.h>
+#include <fluidsynth.h>
+
+/**
+ * The length of the rendered start of each note.
+ */
+#define NOTE_CACHE_SECONDS (3.0)
+
+/**
+ * The synth channel cached notes of MIDI channel chan are continued on by
+ * the live synth once their rendered start has been played. These lie
+ * beyond the 16 MIDI channels, so no MIDI event reaches them.
+ */
+#define NOTE_CACHE_CHANNEL(chan) (16 + ((chan) & 0x0F))
+
+/**
+ * The channels the synth needs: the MIDI channels and a continuation
+ * channel for each.
+ */
+#define NOTE_CACHE_SYNTH_CHANNELS (32)
+
+/**
+ * The first few seconds of every key of a resampled bank, rendered at full
+ * velocity. A harpsichord pluck does not depend on how the key is struck
+ * beyond its loudness, so every note-on can be served from here.
+ */
+typedef struct note_cache
+{
+  glong frames;                 /* the frames rendered for each key */
+  gdouble rate;                 /* the sample rate they were rendered at */
+  gfloat *left[128];            /* NULL for keys the bank does not play */
+  gfloat *right[128];
+  /**
+   * The level at the end of the rendered note relative to a note started
+   * at that point in its sample, which the live synth continues it with.
+   */
+  gdouble handoff_gain[128];
+  /**
+   * The frames it takes a released note to fall by 60 dB.
+   */
+  glong release_frames[128];
+} note_cache;
+
+/**
+ * Renders the cache for bank 0 program 0 of the given bank, which must
+ * be a bank from sf_resample_bank() so that the synth plays its samples
+ * frame by frame. Reverb and chorus are not rendered.
+ *
+ * This takes seconds and is meant to be run off the audio and GUI threads.
+ *
+ * @return  the cache, or NULL on failure
+ */
+note_cache *note_cache_render (gchar const *bank, fluid_settings_t * settings);
+
+/**
+ * Frees a cache no cached voice is playing from any more.
+ */
+void note_cache_free (note_cache * cache);
+
+/*
+ * The following are called by the audio thread only.
+ */
+
+/**
+ * Starts a cached voice for the note if the cache has the key and the
+ * velocity only scales the pluck.
+ *
+ * @param one_string  whether to fade out quickly first whatever the last
+ *   stroke of the key on chan still sounds, cached, taken over or played
+ *   live, as voice_policy_note_on() does
+ * @return  FALSE if the live synth must play the note
+ */
+gboolean note_cache_note_on (note_cache * cache, fluid_synth_t * synth, gint chan, gint key, gint velocity, gboolean one_string);
+
+/**
+ * Releases the cached voices of the note, including any the live synth has
+ * taken over.
+ *
+ * @param release_offset  in timecents, added to the release as
+ *   voice_policy_note_off() adds it, 0 to leave the release as it is
+ */
+void note_cache_note_off (fluid_synth_t * synth, gint chan, gint key, gfloat release_offset);
+
+/**
+ * Hands the voices whose rendered start runs out soon over to the live
+ * synth, which fades its note in as the cached voice fades out. Call
+ * before the synth renders the block.
+ */
+void note_cache_hand_off (note_cache * cache, fluid_synth_t * synth, guint nframes);
+
+/**
+ * Adds the cached voices to the block the synth has rendered.
+ */
+void note_cache_mix (note_cache * cache, guint nframes, gfloat * left, gfloat * right);
+
+/**
+ * Silences all cached voices, as when the cache is about to change.
+ */
+void note_cache_stop (void);
+
+#endif // NOTECACHE_H
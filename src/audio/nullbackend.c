@@ -0,0 +1,138 @@
+#ifdef _HAVE_FLUIDSYNTH_
+/*
+ * nullbackend.c
+ * An audio backend that renders in real time without a sound card.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "audio/nullbackend.h"
+#include "audio/fluid.h"
+#include "audio/temperament.h"
+#include "audio/audiostats.h"
+#include "audio/trace.h"
+#include "audio/metrics.h"
+#include "audio/rtcheck.h"
+
+static GThread *render_thread = NULL;
+static gint quit_thread = FALSE;
+static null_backend_capture_func capture = NULL;
+
+void
+null_backend_set_capture (null_backend_capture_func func)
+{
+  g_atomic_pointer_set (&capture, func);
+}
+
+/* renders a block at each period, as a sound card's callback would be called */
+static gpointer
+render_func (gpointer data)
+{
+  float left[NULL_BACKEND_PERIOD_FRAMES], right[NULL_BACKEND_PERIOD_FRAMES];
+  gint64 start_time = g_get_monotonic_time ();
+  gint64 period = (gint64) NULL_BACKEND_PERIOD_FRAMES * G_USEC_PER_SEC / NULL_BACKEND_SAMPLE_RATE;
+  guint64 block;
+
+  for (block = 0; !g_atomic_int_get (&quit_thread); block++)
+    {
+      gint64 deadline = start_time + (gint64) (block * NULL_BACKEND_PERIOD_FRAMES * G_USEC_PER_SEC / NULL_BACKEND_SAMPLE_RATE);
+      gint64 now = g_get_monotonic_time ();
+      null_backend_capture_func func;
+      guint events;
+      if (deadline > now)
+        g_usleep (deadline - now);
+      now = g_get_monotonic_time ();
+
+      TRACE_BEGIN ("null_render");
+      RTCHECK_ENTER ();
+      memset (left, 0, sizeof (left));
+      memset (right, 0, sizeof (right));
+      events = fluidsynth_process_block (NULL_BACKEND_PERIOD_FRAMES, G_MAXDOUBLE, left, right);
+      /* a block finished after the previous one ran out would have been an underflow */
+      audio_stats_record (NULL_BACKEND_PERIOD_FRAMES, NULL_BACKEND_SAMPLE_RATE, g_get_monotonic_time () - now, events,
+                          fluidsynth_get_active_voices (), g_get_monotonic_time () > deadline + period, FALSE);
+      metrics_thread_cpu (METRICS_THREAD_AUDIO);
+      RTCHECK_LEAVE ();
+      TRACE_END ("null_render");
+      func = g_atomic_pointer_get (&capture);
+      if (func)
+        func (left, right, NULL_BACKEND_PERIOD_FRAMES, NULL_BACKEND_SAMPLE_RATE, deadline + period);
+    }
+  return NULL;
+}
+
+static int
+null_initialize (HistoricHarpsichordPrefs * config)
+{
+  g_message ("Initializing Fluidsynth");
+  if (fluidsynth_init (config, NULL_BACKEND_SAMPLE_RATE))
+    {
+      g_warning ("Initializing Fluidsynth FAILED!");
+      return -1;
+    }
+  set_tuning ();
+  request_tempered_bank ();
+
+  g_message ("Initializing null audio backend");
+  g_atomic_int_set (&quit_thread, FALSE);
+  render_thread = g_thread_try_new ("Null audio", render_func, NULL, NULL);
+  return render_thread ? 0 : -1;
+}
+
+static int
+null_destroy ()
+{
+  g_message ("Destroying null audio backend");
+  if (render_thread)
+    {
+      g_atomic_int_set (&quit_thread, TRUE);
+      g_thread_join (render_thread);
+      render_thread = NULL;
+    }
+  fluidsynth_close ();
+  return 0;
+}
+
+static int
+null_reconfigure (HistoricHarpsichordPrefs * config)
+{
+  null_destroy ();
+  return null_initialize (config);
+}
+
+static int
+null_start_playing ()
+{
+  return 0;
+}
+
+static int
+null_stop_playing ()
+{
+  return 0;
+}
+
+static int
+null_panic ()
+{
+  fluidsynth_panic ();
+  return 0;
+}
+
+backend_t null_backend = {
+  null_initialize,
+  null_destroy,
+  null_reconfigure,
+  null_start_playing,
+  null_stop_playing,
+  null_panic,
+};
+
+#endif //_HAVE_FLUIDSYNTH_
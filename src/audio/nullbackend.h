@@ -0,0 +1,37 @@
+/*
+ * nullbackend.h
+ * An audio backend that renders in real time without a sound card.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef NULLBACKEND_H
+#define NULLBACKEND_H
+
+#include "audio/audiointerface.h"
+
+#define NULL_BACKEND_SAMPLE_RATE (44100)
+#define NULL_BACKEND_PERIOD_FRAMES (256)
+
+/**
+ * Receives each block the null backend renders, on its audio thread.
+ *
+ * @param time  the monotonic time in microseconds at which the block would
+ *   start to sound: a period after it is rendered, as with a sound card
+ *   that double buffers
+ */
+typedef void (*null_backend_capture_func) (float const *left, float const *right, guint frames, guint rate, gint64 time);
+
+/**
+ * Sets the function the rendered blocks are passed to, or NULL for none.
+ */
+void null_backend_set_capture (null_backend_capture_func func);
+
+extern backend_t null_backend;
+
+#endif // NULLBACKEND_H
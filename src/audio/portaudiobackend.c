@@ -31,6 +31,11 @@
 #include "audio/fluid.h"
 #include "audio/temperament.h"
 #include "audio/audiointerface.h"
+#include "audio/audiostats.h"
+#include "audio/trace.h"
+#include "audio/metrics.h"
+#include "audio/rtcheck.h"
+#include "audio/startprofile.h"
 
 #include <portaudio.h>
 #include <glib.h>
@@ -42,8 +47,6 @@ static unsigned long sample_rate;
 
 static unsigned long playback_frame = 0;
 
-static gboolean reset_audio = FALSE;
-
 static gint ready = FALSE;
 
 
@@ -59,7 +62,6 @@ seconds_to_nframes (double seconds)
   return (unsigned long) (sample_rate * seconds);
 }
 
-#define MAX_MESSAGE_LENGTH (255)        //Allow single sysex blocks, ie 0xF0, length, data...0xF7  where length is one byte.
 
 
 static int
@@ -74,39 +76,37 @@ stream_callback (const void *input_buffer, void *output_buffer, unsigned long fr
   if (!ready)
     return paContinue;
 
-  if (reset_audio)
-    {
-      fluidsynth_all_notes_off ();
-      reset_synth_channels ();
-      reset_audio = FALSE;
-      return paContinue;
-    }
-
-  unsigned char event_data[MAX_MESSAGE_LENGTH]; //needs to be long enough for variable length messages...
-  size_t event_length = MAX_MESSAGE_LENGTH;
-  double event_time;
+  TRACE_BEGIN ("stream_callback");
+  RTCHECK_ENTER ();
+  gint64 start = g_get_monotonic_time ();
   double until_time = nframes_to_seconds (playback_frame + frames_per_buffer);
-
-  while (read_event_from_queue (AUDIO_BACKEND, event_data, &event_length, &event_time, until_time))
-    {//g_print("%x %x %x\n", event_data[0], event_data[1], event_data[2] );
-      fluidsynth_feed_midi (event_data, event_length);  //in fluid.c note fluidsynth api ues fluid_synth_xxx these naming conventions are a bit too similar
-    }
-  fluidsynth_render_audio (frames_per_buffer, buffers[0], buffers[1]);  //in fluid.c calls fluid_synth_write_float()
+  guint events = fluidsynth_process_block (frames_per_buffer, until_time, buffers[0], buffers[1]);  //in fluid.c calls fluid_synth_write_float()
+  audio_stats_record (frames_per_buffer, sample_rate, g_get_monotonic_time () - start, events, fluidsynth_get_active_voices (),
+                      (status_flags & paOutputUnderflow) != 0, (status_flags & paOutputOverflow) != 0);
+  metrics_thread_cpu (METRICS_THREAD_AUDIO);
+  RTCHECK_LEAVE ();
+  TRACE_END ("stream_callback");
   return paContinue;
 }
 
 static int
 actual_portaudio_initialize (HistoricHarpsichordPrefs * config)
 {
+ int failed;
+
  sample_rate = config->portaudio_sample_rate;
  preferences_change();
   g_message ("Initializing Fluidsynth");
-  if (fluidsynth_init (config, sample_rate))
+  startup_phase_begin ("fluidsynth_init");
+  failed = fluidsynth_init (config, sample_rate);
+  startup_phase_end ();
+  if (failed)
     {
       g_warning ("Initializing Fluidsynth FAILED!");
       return -1;
     }
   set_tuning ();
+  request_tempered_bank ();
 
   g_message ("Initializing PortAudio backend");
   g_info("PortAudio version: %s", Pa_GetVersionText());
@@ -114,23 +114,25 @@ actual_portaudio_initialize (HistoricHarpsichordPrefs * config)
   PaStreamParameters output_parameters;
   PaError err;
 
+  startup_phase_begin ("Pa_Initialize");
   err = Pa_Initialize ();
+  startup_phase_end ();
   if (err != paNoError)
     {
       g_warning ("Initializing PortAudio failed");
       return -1;
     }
  
+  startup_phase_begin ("device enumeration");
   output_parameters.device = get_portaudio_device_index (config->portaudio_device->str);
+  if (output_parameters.device == paNoDevice)
+    output_parameters.device = get_portaudio_device_index ("default");
+  startup_phase_end ();
 
   if (output_parameters.device == paNoDevice)
     {
-      output_parameters.device =   get_portaudio_device_index ("default");
-       if (output_parameters.device == paNoDevice)
-        {
-            g_warning("No PortAudio device %s and no default either.", config->portaudio_device->str);
-            return -1;
-        }
+      g_warning("No PortAudio device %s and no default either.", config->portaudio_device->str);
+      return -1;
     }
 
   PaDeviceInfo const *info = Pa_GetDeviceInfo (output_parameters.device);
@@ -148,13 +150,17 @@ actual_portaudio_initialize (HistoricHarpsichordPrefs * config)
   output_parameters.sampleFormat = paFloat32 | paNonInterleaved;
   output_parameters.suggestedLatency = Pa_GetDeviceInfo (output_parameters.device)->defaultLowOutputLatency;
   output_parameters.hostApiSpecificStreamInfo = NULL;
+  startup_phase_begin ("Pa_OpenStream");
   err = Pa_OpenStream (&stream, NULL, &output_parameters, config->portaudio_sample_rate, config->portaudio_period_size, paNoFlag /* make this a pref??? paClipOff */ , stream_callback, NULL);
+  startup_phase_end ();
   if (err != paNoError)
     {
       g_warning ("Couldn't open output stream");
       return -1;
     }
+  startup_phase_begin ("Pa_StartStream");
   err = Pa_StartStream (stream);
+  startup_phase_end ();
   if (err != paNoError)
     {
       g_warning ("Couldn't start output stream");
@@ -195,7 +201,7 @@ portaudio_destroy ()
   Pa_Terminate ();
 
 #ifdef _HAVE_FLUIDSYNTH_
-  fluidsynth_shutdown ();
+  fluidsynth_close ();
 #endif
 
   return 0;
@@ -206,6 +212,9 @@ static int
 portaudio_reconfigure (HistoricHarpsichordPrefs * config)
 {
   portaudio_destroy ();
+#ifdef _HAVE_FLUIDSYNTH_
+  fluidsynth_shutdown ();
+#endif
   return portaudio_initialize (config);
 }
 
@@ -227,7 +236,7 @@ portaudio_stop_playing ()
 static int
 portaudio_panic ()
 {
-  reset_audio = TRUE;
+  fluidsynth_panic ();
   return 0;
 }
 
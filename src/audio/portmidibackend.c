@@ -14,9 +14,13 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "audio/portmidibackend.h"
 #include "audio/portmidiutil.h"
 #include "audio/midi.h"
+#include "audio/trace.h"
+#include "audio/metrics.h"
+#include "audio/startprofile.h"
 #include <portmidi.h>
 #include <porttime.h>
 #include <glib.h>
@@ -25,6 +29,22 @@
 #define TIMER_RESOLUTION 5
 #define INPUT_BUFFER_SIZE 0
 #define OUTPUT_BUFFER_SIZE 256
+/* the most events read at a time; controller changes are coalesced within it */
+#define INPUT_BATCH_SIZE 64
+/* controller floods are cut down to this many events a second, in bursts
+ * of at most INPUT_BURST; notes always get through. The tokens are counted
+ * in thousandths, so that the refill of a few milliseconds is not lost. */
+#define CONTROL_EVENTS_PER_SECOND 500
+#define INPUT_BURST 64
+#define TOKEN (1000)
+#define NO_VALUE 0xFF
+#define MIDI_EOX 0xF7
+/* the lowest of the real-time messages, which may come in the middle of a SysEx */
+#define MIDI_REALTIME 0xF8
+
+/* the messages the synth has no use for, dropped by PortMidi itself */
+#define INPUT_FILTER (PM_FILT_ACTIVE | PM_FILT_CLOCK | PM_FILT_PLAY | PM_FILT_TICK \
+                      | PM_FILT_UNDEFINED | PM_FILT_RESET | PM_FILT_SYSTEMCOMMON | PM_FILT_AFTERTOUCH | PM_FILT_PROGRAM)
 
 static PmStream *input_stream = NULL;
 static PmStream *output_stream = NULL;
@@ -35,10 +55,66 @@ static gboolean reset = FALSE;
 
 static double playback_start_time;
 
+/* the last value passed on for each controller of each channel */
+static guint8 controller_value[16][128];
+static gint control_tokens = INPUT_BURST * TOKEN;
+static PtTimestamp last_refill = 0;
+static gint filtered_damping = -1;     /* the damping setting the input filter was set for */
+static guint coalesced_events = 0;     /* controller changes overtaken within a batch or repeating a value */
+static guint limited_events = 0;       /* events dropped by the rate limiter */
+
+/* the SysEx message under way, put together from the events PortMidi
+ * splits it into, four bytes to an event */
+static unsigned char sysex[MIDI_EVENT_MAX_LENGTH];
+static gint sysex_length = 0;          /* the bytes received so far, 0 if none is under way */
+static guint long_sysex = 0;           /* SysEx messages dropped as too long */
+
 
 static int portmidi_destroy ();
 
 
+/* drops what the synth has no use for; pitch bend and controllers are of
+ * no use when the damping drops them anyway */
+static void
+set_filter (gboolean damping)
+{
+  Pm_SetFilter (input_stream, INPUT_FILTER | (damping ? PM_FILT_PITCHBEND | PM_FILT_CONTROL : 0));
+  filtered_damping = damping;
+}
+
+/* adds the bytes of an event to the SysEx message under way; returns the
+ * length of the message when it is complete, else 0 */
+static gint
+add_sysex_bytes (PmMessage message)
+{
+  gint i;
+  for (i = 0; i < 4; i++)
+    {
+      unsigned char byte = (message >> (8 * i)) & 0xFF;
+      if (byte >= MIDI_REALTIME)
+        continue;
+      // any status byte but the EOX breaks the message off
+      if ((byte & 0x80) && byte != MIDI_EOX && !(byte == SYS_EXCLUSIVE_MESSAGE1 && sysex_length == 0))
+        {
+          sysex_length = 0;
+          return 0;
+        }
+      if (sysex_length < MIDI_EVENT_MAX_LENGTH)
+        sysex[sysex_length] = byte;
+      sysex_length++;
+      if (byte == MIDI_EOX)
+        {
+          gint length = sysex_length;
+          sysex_length = 0;
+          if (length <= MIDI_EVENT_MAX_LENGTH)
+            return length;
+          long_sysex++;
+          return 0;
+        }
+    }
+  return 0;
+}
+
 static void
 process_midi (PtTimestamp timestamp, void *user_data)
 {
@@ -52,28 +128,82 @@ process_midi (PtTimestamp timestamp, void *user_data)
       return;
     }
 
-  PmEvent event;
-  int r;
-  while (Pm_Poll (input_stream) == TRUE)
-    {
+  PmEvent events[INPUT_BATCH_SIZE];
+  int n;
 
-      r = Pm_Read (input_stream, &event, 1);
+  /* the damping may have been turned on or off in the preferences */
+  if (HistoricHarpsichord.prefs.damping != filtered_damping)
+    set_filter (HistoricHarpsichord.prefs.damping);
 
-      // we should only ever get one event.
-      // if we get a sysex, just skip it.
-      if (r != 1 || (Pm_MessageStatus (event.message) & 0xf0) == 0xf0)
-        {
-          continue;
-        }
+  /* a millisecond brings CONTROL_EVENTS_PER_SECOND thousandths of a token */
+  control_tokens = MIN (control_tokens + (timestamp - last_refill) * CONTROL_EVENTS_PER_SECOND, INPUT_BURST * TOKEN);
+  last_refill = timestamp;
 
-      unsigned char buffer[3] = {
-        Pm_MessageStatus (event.message),
-        Pm_MessageData1 (event.message),
-        Pm_MessageData2 (event.message)
-      };
+  while ((n = Pm_Read (input_stream, events, INPUT_BATCH_SIZE)) > 0)
+    {
+      TRACE_BEGIN ("process_midi");
+      /* for each controller, the last of its changes in the batch */
+      gint8 last_change[16][128];
+      int i;
+      memset (last_change, -1, sizeof (last_change));
+      for (i = 0; i < n; i++)
+        if ((Pm_MessageStatus (events[i].message) & 0xF0) == MIDI_CONTROL_CHANGE)
+          last_change[Pm_MessageStatus (events[i].message) & 0x0F][Pm_MessageData1 (events[i].message) & 0x7F] = i;
+
+      for (i = 0; i < n; i++)
+        {
+          unsigned char buffer[3] = {
+            Pm_MessageStatus (events[i].message),
+            Pm_MessageData1 (events[i].message),
+            Pm_MessageData2 (events[i].message)
+          };
+          unsigned char const *data = buffer;
+          int type = buffer[0] & 0xF0;
+          int length = (type == MIDI_PROGRAM_CHANGE || type == MIDI_CHANNEL_PRESSURE) ? 2 : 3;
+
+          /* the event that ends a SysEx may start with the EOX */
+          if (buffer[0] == SYS_EXCLUSIVE_MESSAGE1 || (sysex_length && (!(buffer[0] & 0x80) || buffer[0] == MIDI_EOX)))
+            {
+              if (buffer[0] == SYS_EXCLUSIVE_MESSAGE1)
+                sysex_length = 0;
+              length = add_sysex_bytes (events[i].message);
+              if (length == 0)
+                continue;
+              data = sysex;
+            }
+          else
+            {
+              // a new message ends any SysEx under way, but real-time messages are let through
+              if (buffer[0] < MIDI_REALTIME)
+                sysex_length = 0;
+              if (type == 0xF0 || !(buffer[0] & 0x80))
+                continue;
+            }
+          if (type == MIDI_CONTROL_CHANGE)
+            {
+              guint8 *value = &controller_value[buffer[0] & 0x0F][buffer[1] & 0x7F];
+              if (last_change[buffer[0] & 0x0F][buffer[1] & 0x7F] != i || *value == buffer[2])
+                {
+                  coalesced_events++;
+                  continue;
+                }
+              *value = buffer[2];
+            }
+          if (type != MIDI_NOTE_ON && type != MIDI_NOTE_OFF)
+            {
+              if (control_tokens < TOKEN)
+                {
+                  limited_events++;
+                  continue;
+                }
+              control_tokens -= TOKEN;
+            }
 
-      input_midi_event (MIDI_BACKEND, 0, buffer);
+          input_midi_event (MIDI_BACKEND, 0, data, length);
+        }
+      TRACE_END ("process_midi");
     }
+  metrics_thread_cpu (METRICS_THREAD_MIDI);
 }
 
 
@@ -101,7 +231,9 @@ portmidi_initialize (HistoricHarpsichordPrefs * config)
 {
   g_message ("Initializing PortMidi backend");
 
+  startup_phase_begin ("Pt_Start");
   PtError pterr = Pt_Start (TIMER_RESOLUTION, &process_midi, NULL);
+  startup_phase_end ();
   if (pterr != ptNoError)
     {
       g_warning ("Couldn't start timer");
@@ -112,7 +244,9 @@ portmidi_initialize (HistoricHarpsichordPrefs * config)
   int id;
   PmDeviceInfo const *info;
 
+  startup_phase_begin ("Pm_Initialize");
   err = Pm_InitializeWrapper ();
+  startup_phase_end ();
   if (err != pmNoError)
     {
       g_warning ("Couldn't initialize PortMidi");
@@ -142,13 +276,19 @@ portmidi_initialize (HistoricHarpsichordPrefs * config)
 
       g_message ("Opening input device '%s: %s'", info->interf, info->name);
 
+      startup_phase_begin ("Pm_OpenInput");
       err = Pm_OpenInput (&input_stream, id, NULL, INPUT_BUFFER_SIZE, NULL, NULL);
+      startup_phase_end ();
       if (err != pmNoError)
         {
           g_warning ("Couldn't open input stream");
           portmidi_destroy ();
           return error_shutdown ();
         }
+      set_filter (config->damping);
+      memset (controller_value, NO_VALUE, sizeof (controller_value));
+      control_tokens = INPUT_BURST * TOKEN;
+      last_refill = Pt_Time ();
     }
   else
     {
@@ -172,6 +312,12 @@ portmidi_destroy ()
 
   g_atomic_int_set (&initialized, FALSE);
 
+  if (coalesced_events || limited_events || long_sysex)
+    g_message ("MIDI input: %u controller changes coalesced, %u events dropped by the rate limiter, %u SysEx messages too long",
+               coalesced_events, limited_events, long_sysex);
+  coalesced_events = limited_events = long_sysex = 0;
+  sysex_length = 0;
+
   if (input_stream)
     {
       Pm_Close (input_stream);
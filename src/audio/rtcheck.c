@@ -0,0 +1,224 @@
+/*
+ * rtcheck.c
+ * Catching calls on the audio thread that may block, in rtcheck builds.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifdef _ENABLE_RTCHECK_
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#include <glib.h>
+#include "audio/rtcheck.h"
+
+#ifdef _ENABLE_RTCHECK_
+
+/* the violations reported with a backtrace; the rest are only counted */
+#define MAX_REPORTS (20)
+#define MAX_FRAMES (32)
+
+/* glibc's own allocator, which the interposed functions pass on to */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t count, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void __libc_free (void *ptr);
+
+static int (*real_pthread_mutex_lock) (pthread_mutex_t * mutex);
+static void (*real_g_mutex_lock) (GMutex * mutex);
+static void (*real_g_rec_mutex_lock) (GRecMutex * mutex);
+static ssize_t (*real_write) (int fd, const void *buf, size_t count);
+
+static __thread gint in_callback = 0;
+static __thread gboolean reporting = FALSE;
+static __thread gint in_api_lock = 0;
+static gint violations = 0;
+static gint api_locks = 0;
+
+/* writes to stderr without going through the interposed write() */
+static void
+say (gchar const *text, gint length)
+{
+  syscall (SYS_write, 2, text, length);
+}
+
+static void
+report (gchar const *call)
+{
+  gchar line[128];
+  void *frames[MAX_FRAMES];
+  gint n, depth;
+  if (reporting)
+    return;
+  reporting = TRUE;
+  n = g_atomic_int_add (&violations, 1);
+  if (n < MAX_REPORTS)
+    {
+      n = snprintf (line, sizeof (line), "RT check: %s() called in the audio callback\n", call);
+      say (line, MIN (n, (gint) sizeof (line) - 1));
+      depth = backtrace (frames, MAX_FRAMES);
+      /* leaves out report() and the interposed function */
+      if (depth > 2)
+        backtrace_symbols_fd (frames + 2, depth - 2, 2);
+    }
+  reporting = FALSE;
+}
+
+#define CHECK(call) G_STMT_START { if (G_UNLIKELY (in_callback && !in_api_lock)) report (call); } G_STMT_END
+
+void *
+malloc (size_t size)
+{
+  CHECK ("malloc");
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t count, size_t size)
+{
+  CHECK ("calloc");
+  return __libc_calloc (count, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  CHECK ("realloc");
+  return __libc_realloc (ptr, size);
+}
+
+void
+free (void *ptr)
+{
+  if (ptr)
+    CHECK ("free");
+  __libc_free (ptr);
+}
+
+int
+pthread_mutex_lock (pthread_mutex_t * mutex)
+{
+  CHECK ("pthread_mutex_lock");
+  if (real_pthread_mutex_lock == NULL)
+    real_pthread_mutex_lock = dlsym (RTLD_NEXT, "pthread_mutex_lock");
+  return real_pthread_mutex_lock (mutex);
+}
+
+void
+g_mutex_lock (GMutex * mutex)
+{
+  CHECK ("g_mutex_lock");
+  if (real_g_mutex_lock == NULL)
+    real_g_mutex_lock = dlsym (RTLD_NEXT, "g_mutex_lock");
+  real_g_mutex_lock (mutex);
+}
+
+/* FluidSynth's API lock, the one GRecMutex taken in the callback. Other
+ * threads take it only to load a SoundFont at startup and to build a
+ * tuning, so it is not held against the audio thread in play; it is counted
+ * apart rather than reported. */
+void
+g_rec_mutex_lock (GRecMutex * mutex)
+{
+  if (G_UNLIKELY (in_callback))
+    g_atomic_int_inc (&api_locks);
+  if (real_g_rec_mutex_lock == NULL)
+    real_g_rec_mutex_lock = dlsym (RTLD_NEXT, "g_rec_mutex_lock");
+  in_api_lock++;
+  real_g_rec_mutex_lock (mutex);
+  in_api_lock--;
+}
+
+ssize_t
+write (int fd, const void *buf, size_t count)
+{
+  CHECK ("write");
+  if (real_write == NULL)
+    real_write = dlsym (RTLD_NEXT, "write");
+  return real_write (fd, buf, count);
+}
+
+static void
+print_summary (void)
+{
+  gchar line[128];
+  gint n;
+  if (g_atomic_int_get (&api_locks))
+    {
+      n = snprintf (line, sizeof (line), "RT check: FluidSynth's API lock was taken %d times in the audio callback\n", g_atomic_int_get (&api_locks));
+      say (line, MIN (n, (gint) sizeof (line) - 1));
+    }
+  if (g_atomic_int_get (&violations) == 0)
+    return;
+  n = snprintf (line, sizeof (line), "RT check: %d calls that may block were made in the audio callback\n", g_atomic_int_get (&violations));
+  say (line, MIN (n, (gint) sizeof (line) - 1));
+}
+
+void
+rtcheck_init (void)
+{
+  void *frames[1];
+  real_pthread_mutex_lock = dlsym (RTLD_NEXT, "pthread_mutex_lock");
+  real_g_mutex_lock = dlsym (RTLD_NEXT, "g_mutex_lock");
+  real_g_rec_mutex_lock = dlsym (RTLD_NEXT, "g_rec_mutex_lock");
+  real_write = dlsym (RTLD_NEXT, "write");
+  /* the first backtrace loads the unwinder, which allocates */
+  backtrace (frames, 1);
+  atexit (print_summary);
+}
+
+void
+rtcheck_enter (void)
+{
+  in_callback++;
+}
+
+void
+rtcheck_leave (void)
+{
+  in_callback--;
+}
+
+guint
+rtcheck_violations (void)
+{
+  return g_atomic_int_get (&violations);
+}
+
+#else
+
+void
+rtcheck_init (void)
+{
+}
+
+void
+rtcheck_enter (void)
+{
+}
+
+void
+rtcheck_leave (void)
+{
+}
+
+guint
+rtcheck_violations (void)
+{
+  return 0;
+}
+
+#endif //_ENABLE_RTCHECK_
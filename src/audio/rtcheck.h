@@ -0,0 +1,53 @@
+/*
+ * rtcheck.h
+ * Catching calls on the audio thread that may block, in rtcheck builds.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+#include <glib.h>
+
+/*
+ * Configured with --enable-rtcheck, the program interposes malloc(),
+ * calloc(), realloc(), free(), pthread_mutex_lock(), g_mutex_lock() and
+ * write(), and reports any of them called between RTCHECK_ENTER() and
+ * RTCHECK_LEAVE() on the same thread, with a backtrace. The lock FluidSynth
+ * takes around its API, a GRecMutex, is only counted. Otherwise the marks
+ * cost nothing.
+ */
+#ifdef _ENABLE_RTCHECK_
+#define RTCHECK_ENTER() rtcheck_enter ()
+#define RTCHECK_LEAVE() rtcheck_leave ()
+#else
+#define RTCHECK_ENTER() G_STMT_START { } G_STMT_END
+#define RTCHECK_LEAVE() G_STMT_START { } G_STMT_END
+#endif
+
+/**
+ * Looks up the functions interposed, so that doing so later does not
+ * itself allocate. Call first thing in main().
+ */
+void rtcheck_init (void);
+
+/**
+ * Marks the calling thread as being in the audio callback, or as having
+ * left it.
+ */
+void rtcheck_enter (void);
+void rtcheck_leave (void);
+
+/**
+ * Returns the calls reported so far; always 0 unless built with
+ * --enable-rtcheck.
+ */
+guint rtcheck_violations (void);
+
+#endif // RTCHECK_H
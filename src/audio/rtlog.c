@@ -0,0 +1,232 @@
+/*
+ * rtlog.c
+ * Logging from the audio and MIDI threads without locking or blocking.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <glib.h>
+#include "audio/rtlog.h"
+#include "audio/ringbuffer.h"
+
+/* the threads that can log at once, and the records each ring holds */
+#define RTLOG_THREADS (8)
+#define RTLOG_RECORDS (128)
+#define RTLOG_RECORD_BYTES (256)
+/* how often the logging thread looks for records, in us */
+#define DRAIN_INTERVAL (20000)
+
+typedef struct rtlog_record
+{
+  gint64 time;
+  gint level;
+  gchar text[RTLOG_RECORD_BYTES - sizeof (gint64) - sizeof (gint)];
+} rtlog_record;
+
+typedef struct log_ring
+{
+  jack_ringbuffer_t *buffer;
+  gint owned;                   /* TRUE while a thread has the ring */
+  /* the rate limit, kept by the thread the ring belongs to alone */
+  gint64 window_start[RTLOG_LEVELS];
+  guint window_count[RTLOG_LEVELS];
+  /* counted by that thread, taken by the logging thread */
+  guint suppressed[RTLOG_LEVELS];
+  guint lost;                   /* for want of room in the ring */
+} log_ring;
+
+/* the messages each thread may log a second at each level */
+static guint const rate_limits[RTLOG_LEVELS] = { 50, 20, 20, 20 };
+
+static GLogLevelFlags const log_levels[RTLOG_LEVELS] = {
+  G_LOG_LEVEL_DEBUG, G_LOG_LEVEL_INFO, G_LOG_LEVEL_MESSAGE, G_LOG_LEVEL_WARNING
+};
+
+static gchar const *const level_names[RTLOG_LEVELS] = { "debug", "info", "message", "warning" };
+
+static void release_ring (gpointer data);
+
+static log_ring rings[RTLOG_THREADS];
+/* a thread's ring goes back to the pool when the thread exits, so the
+ * threads that come and go, such as those rendering a bank, do not use
+ * the rings up */
+static GPrivate thread_ring = G_PRIVATE_INIT (release_ring);
+static guint unclaimed_lost = 0;        /* from threads that came while all rings were owned */
+static gint64 start_time;
+static gboolean running = FALSE;
+static gboolean quit = FALSE;
+static GThread *log_thread = NULL;
+
+/* the calling thread's ring, claimed the first time it logs */
+static log_ring *
+get_ring (void)
+{
+  log_ring *ring = g_private_get (&thread_ring);
+  gint n;
+  if (ring)
+    return ring;
+  for (n = 0; n < RTLOG_THREADS; n++)
+    if (g_atomic_int_compare_and_exchange (&rings[n].owned, FALSE, TRUE))
+      {
+        ring = &rings[n];
+        /* the rate limit starts afresh for the new thread; what the last
+         * one logged is still drained in order */
+        memset (ring->window_start, 0, sizeof (ring->window_start));
+        memset (ring->window_count, 0, sizeof (ring->window_count));
+        g_private_set (&thread_ring, ring);
+        return ring;
+      }
+  return NULL;
+}
+
+/* at the exit of a thread that logged: gives its ring back */
+static void
+release_ring (gpointer data)
+{
+  log_ring *ring = data;
+  g_atomic_int_set (&ring->owned, FALSE);
+}
+
+/* counts the message against the rate limit of its level */
+static gboolean
+within_limit (log_ring * ring, rtlog_level level, gint64 now)
+{
+  if (now - ring->window_start[level] >= G_USEC_PER_SEC)
+    {
+      ring->window_start[level] = now;
+      ring->window_count[level] = 0;
+    }
+  if (ring->window_count[level] >= rate_limits[level])
+    {
+      g_atomic_int_inc (&ring->suppressed[level]);
+      return FALSE;
+    }
+  ring->window_count[level]++;
+  return TRUE;
+}
+
+void
+rtlog (rtlog_level level, gchar const *format, ...)
+{
+  rtlog_record record;
+  log_ring *ring;
+  va_list args;
+
+  level = CLAMP (level, RTLOG_DEBUG, RTLOG_WARNING);
+  va_start (args, format);
+  if (!g_atomic_int_get (&running))
+    {
+      g_logv (G_LOG_DOMAIN, log_levels[level], format, args);
+      va_end (args);
+      return;
+    }
+  ring = get_ring ();
+  if (ring == NULL)
+    {
+      g_atomic_int_inc (&unclaimed_lost);
+      va_end (args);
+      return;
+    }
+  record.time = g_get_monotonic_time ();
+  if (!within_limit (ring, level, record.time))
+    {
+      va_end (args);
+      return;
+    }
+  if (jack_ringbuffer_write_space (ring->buffer) < sizeof (record))
+    {
+      g_atomic_int_inc (&ring->lost);
+      va_end (args);
+      return;
+    }
+  record.level = level;
+  g_vsnprintf (record.text, sizeof (record.text), format, args);
+  va_end (args);
+  jack_ringbuffer_write (ring->buffer, (char const *) &record, sizeof (record));
+}
+
+/* takes the count, leaving whatever is added meanwhile */
+static guint
+take_count (guint * count)
+{
+  guint n = g_atomic_int_get (count);
+  if (n)
+    g_atomic_int_add ((gint *) count, -(gint) n);
+  return n;
+}
+
+/* logging thread: writes out all that has been logged */
+static void
+drain (void)
+{
+  gint n;
+  guint count;
+  for (n = 0; n < RTLOG_THREADS; n++)
+    {
+      log_ring *ring = &rings[n];
+      rtlog_record record;
+      gint level;
+      while (jack_ringbuffer_read_space (ring->buffer) >= sizeof (record))
+        {
+          jack_ringbuffer_read (ring->buffer, (char *) &record, sizeof (record));
+          g_log (G_LOG_DOMAIN, log_levels[record.level], "[%.6f] %s", (record.time - start_time) / 1e6, record.text);
+        }
+      for (level = 0; level < RTLOG_LEVELS; level++)
+        if ((count = take_count (&ring->suppressed[level])))
+          g_log (G_LOG_DOMAIN, log_levels[level], "%u %s messages from a real-time thread over the rate limit", count,
+                 level_names[level]);
+      if ((count = take_count (&ring->lost)))
+        g_warning ("%u messages from a real-time thread lost for want of room", count);
+    }
+  if ((count = take_count (&unclaimed_lost)))
+    g_warning ("%u messages lost from threads while %d others were logging", count, RTLOG_THREADS);
+}
+
+static gpointer
+log_thread_func (gpointer data)
+{
+  while (!g_atomic_int_get (&quit))
+    {
+      drain ();
+      g_usleep (DRAIN_INTERVAL);
+    }
+  drain ();
+  return NULL;
+}
+
+void
+rtlog_start (void)
+{
+  gint n;
+  if (running)
+    return;
+  if (rings[0].buffer == NULL)
+    {
+      for (n = 0; n < RTLOG_THREADS; n++)
+        rings[n].buffer = jack_ringbuffer_create (RTLOG_RECORDS * sizeof (rtlog_record));
+      start_time = g_get_monotonic_time ();
+    }
+  /* makes the thread key now, so that the first rtlog() on a thread need not */
+  g_private_get (&thread_ring);
+  g_atomic_int_set (&quit, FALSE);
+  log_thread = g_thread_new ("Logging", log_thread_func, NULL);
+  g_atomic_int_set (&running, TRUE);
+}
+
+void
+rtlog_stop (void)
+{
+  if (!running)
+    return;
+  g_atomic_int_set (&running, FALSE);
+  g_atomic_int_set (&quit, TRUE);
+  g_thread_join (log_thread);
+  log_thread = NULL;
+}
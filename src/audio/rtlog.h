@@ -0,0 +1,48 @@
+/*
+ * rtlog.h
+ * Logging from the audio and MIDI threads without locking or blocking.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef RTLOG_H
+#define RTLOG_H
+
+#include <glib.h>
+
+typedef enum rtlog_level
+{
+  RTLOG_DEBUG,
+  RTLOG_INFO,
+  RTLOG_MESSAGE,
+  RTLOG_WARNING,
+  RTLOG_LEVELS
+} rtlog_level;
+
+/**
+ * Starts the thread that writes out what the other threads have logged.
+ * Until then, and after rtlog_stop(), rtlog() passes straight on to g_log().
+ */
+void rtlog_start (void);
+
+/**
+ * Writes out what is left and stops the thread.
+ */
+void rtlog_stop (void);
+
+/**
+ * Logs from a thread that must not block. The message is formatted into a
+ * fixed-size record, cut short if need be, in a ring of the calling
+ * thread's own, and passed to g_log() with its time by the logging thread.
+ * Neither locks nor allocates, as long as the format converts only
+ * integers and strings. Each thread may log so many messages a second at
+ * each level; the rest are counted and the count logged instead.
+ */
+void rtlog (rtlog_level level, gchar const *format, ...) G_GNUC_PRINTF (2, 3);
+
+#endif // RTLOG_H
@@ -0,0 +1,411 @@
+/*
+ * scala.c
+ * Temperaments from Scala scale (.scl) and keyboard mapping (.kbm) files.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <historicHarpsichord/historicHarpsichord.h>
+#include "audio/scala.h"
+#include "audio/tuning.h"
+#include "core/utils.h"
+
+#define CACHE_FILE "TemperamentCache.ini"
+/* groups of the cache: one per file, named by the hash of its path and
+ * holding its identity and the hash of its contents, and one per content
+ * hash, holding the compiled tuning. A path may hold '[' or ']', which a
+ * group name cannot. */
+#define FILE_GROUP_PREFIX "file "
+
+/* a keyboard mapping, see http://www.huygens-fokker.org/scala/help.htm#mappings */
+typedef struct mapping
+{
+  gint size;                    /* 0 for a linear mapping */
+  gint first, last;             /* the keys that are retuned */
+  gint middle;                  /* the key scale degree 0 is on */
+  gint reference;
+  gdouble frequency;            /* of the reference key */
+  gint octave_degree;           /* the degree the mapping repeats at */
+  gint *map;                    /* the degree of each key of the pattern, -1 for none */
+} mapping;
+
+static GList *tunings = NULL;
+
+static void
+free_tuning (scala_tuning_t * tuning)
+{
+  g_free (tuning->name);
+  g_free (tuning->description);
+  g_free (tuning->path);
+  g_free (tuning);
+}
+
+/* the lines of text that are not comments */
+static GPtrArray *
+data_lines (gchar const *text)
+{
+  GPtrArray *lines = g_ptr_array_new_with_free_func (g_free);
+  gchar **all = g_strsplit (text, "\n", -1);
+  gchar **line;
+  for (line = all; *line; line++)
+    if (**line != '!')
+      g_ptr_array_add (lines, g_strstrip (g_strdup (*line)));
+  g_strfreev (all);
+  /* the text after the last newline is no line unless it has something */
+  if (lines->len && *(gchar *) g_ptr_array_index (lines, lines->len - 1) == 0)
+    g_ptr_array_remove_index (lines, lines->len - 1);
+  return lines;
+}
+
+/* a pitch is in cents if it has a period, otherwise it is a ratio or an integer;
+ * anything after it on the line is ignored */
+static gboolean
+parse_pitch (gchar const *line, gdouble * cents)
+{
+  gchar *text = g_strndup (line, strcspn (line, " \t"));
+  gchar *end;
+  gboolean ok;
+  if (strchr (text, '.'))
+    {
+      *cents = g_ascii_strtod (text, &end);
+      ok = end != text;
+    }
+  else
+    {
+      gint64 num = g_ascii_strtoll (text, &end, 10), den = 1;
+      ok = end != text;
+      if (ok && *end == '/')
+        {
+          gchar *start = end + 1;
+          den = g_ascii_strtoll (start, &end, 10);
+          ok = end != start;
+        }
+      ok = ok && num > 0 && den > 0;
+      if (ok)
+        *cents = 1200.0 * log2 ((gdouble) num / den);
+    }
+  g_free (text);
+  return ok;
+}
+
+static gint
+floor_div (gint a, gint b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* the cents of scale degree d above degree 0; degrees[n] is the period */
+static gdouble
+degree_cents (gdouble const *degrees, gint n, gint d)
+{
+  gint octave = floor_div (d, n);
+  return octave * degrees[n] + degrees[d - octave * n];
+}
+
+/* sets the degree the pattern of the mapping puts on key, whether or not
+ * the key is among those retuned; returns FALSE if it has none */
+static gboolean
+pattern_degree (mapping const *m, gint key, gint * degree)
+{
+  gint offset, pattern, i;
+  offset = key - m->middle;
+  if (m->size == 0)
+    {
+      *degree = offset;
+      return TRUE;
+    }
+  pattern = floor_div (offset, m->size);
+  i = offset - pattern * m->size;
+  if (m->map[i] < 0)
+    return FALSE;
+  *degree = pattern * m->octave_degree + m->map[i];
+  return TRUE;
+}
+
+/* sets the degree key plays, returns FALSE if the mapping leaves it out */
+static gboolean
+key_degree (mapping const *m, gint key, gint * degree)
+{
+  if (key < m->first || key > m->last)
+    return FALSE;
+  return pattern_degree (m, key, degree);
+}
+
+static gboolean
+parse_mapping (gchar const *kbm, gint n, mapping * m)
+{
+  GPtrArray *lines = data_lines (kbm);
+  gboolean ok = FALSE;
+  gint i;
+  if (lines->len >= 7)
+    {
+      m->size = atoi (g_ptr_array_index (lines, 0));
+      m->first = atoi (g_ptr_array_index (lines, 1));
+      m->last = atoi (g_ptr_array_index (lines, 2));
+      m->middle = atoi (g_ptr_array_index (lines, 3));
+      m->reference = atoi (g_ptr_array_index (lines, 4));
+      m->frequency = g_ascii_strtod (g_ptr_array_index (lines, 5), NULL);
+      m->octave_degree = atoi (g_ptr_array_index (lines, 6));
+      if (m->octave_degree <= 0)
+        m->octave_degree = n;
+      /* missing entries at the end of the map are unmapped keys */
+      if (m->size >= 0 && m->size <= 128 && m->frequency > 0.0)
+        {
+          m->map = g_new (gint, MAX (m->size, 1));
+          for (i = 0; i < m->size; i++)
+            {
+              gchar const *entry = i + 7 < (gint) lines->len ? g_ptr_array_index (lines, i + 7) : "x";
+              m->map[i] = (*entry == 'x' || *entry == 0) ? -1 : atoi (entry);
+            }
+          ok = TRUE;
+        }
+    }
+  g_ptr_array_free (lines, TRUE);
+  return ok;
+}
+
+gboolean
+scala_compile (gchar const *scl, gchar const *kbm, gchar ** description, gdouble pitch[128])
+{
+  GPtrArray *lines = data_lines (scl);
+  mapping m = { 0, 0, 127, 60, 69, TUNING_MODERN_PITCH, 0, NULL };
+  gdouble *degrees = NULL, reference;
+  gint n = 0, i, key, degree;
+  gboolean ok = FALSE;
+
+  if (lines->len >= 2)
+    n = atoi (g_ptr_array_index (lines, 1));
+  if (n < 1 || (gint) lines->len < n + 2)
+    goto out;
+  degrees = g_new (gdouble, n + 1);
+  degrees[0] = 0.0;
+  for (i = 1; i <= n; i++)
+    if (!parse_pitch (g_ptr_array_index (lines, i + 1), &degrees[i]))
+      goto out;
+  m.octave_degree = n;
+  if (kbm && !parse_mapping (kbm, n, &m))
+    goto out;
+  /* the reference key need not be among the keys retuned */
+  if (!pattern_degree (&m, m.reference, &degree))
+    goto out;
+
+  reference = 6900.0 + 1200.0 * log2 (m.frequency / TUNING_MODERN_PITCH) - degree_cents (degrees, n, degree);
+  for (key = 0; key < 128; key++)
+    pitch[key] = key_degree (&m, key, &degree) ? reference + degree_cents (degrees, n, degree) : 100.0 * key;
+  if (description)
+    *description = g_strdup (g_ptr_array_index (lines, 0));
+  ok = TRUE;
+
+out:
+  g_free (degrees);
+  g_free (m.map);
+  g_ptr_array_free (lines, TRUE);
+  return ok;
+}
+
+static gchar *
+get_cache_file (void)
+{
+  return g_build_filename (get_user_data_dir (TRUE), CACHE_FILE, NULL);
+}
+
+/* reads the tuning of hash from the cache */
+static gboolean
+load_tuning (GKeyFile * cache, gchar const *hash, scala_tuning_t * tuning)
+{
+  gsize n = 0;
+  gdouble *pitch = g_key_file_get_double_list (cache, hash, "pitch", &n, NULL);
+  if (pitch == NULL || n != 128)
+    {
+      g_free (pitch);
+      return FALSE;
+    }
+  memcpy (tuning->pitch, pitch, sizeof (tuning->pitch));
+  g_free (pitch);
+  tuning->description = g_key_file_get_string (cache, hash, "description", NULL);
+  return TRUE;
+}
+
+/* reads and compiles the files unless the cache has their hash, returns the hash */
+static gchar *
+compile_files (GKeyFile * cache, gchar const *path, gchar const *kbm_path, scala_tuning_t * tuning)
+{
+  gchar *scl = NULL, *kbm = NULL, *hash = NULL;
+  gsize scl_length, kbm_length = 0;
+  GChecksum *checksum;
+
+  if (!g_file_get_contents (path, &scl, &scl_length, NULL))
+    return NULL;
+  if (kbm_path && !g_file_get_contents (kbm_path, &kbm, &kbm_length, NULL))
+    kbm = NULL;
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (guchar *) scl, scl_length);
+  if (kbm)
+    {
+      g_checksum_update (checksum, (guchar *) "\n!kbm\n", 6);
+      g_checksum_update (checksum, (guchar *) kbm, kbm_length);
+    }
+  hash = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  if (!load_tuning (cache, hash, tuning))
+    {
+      g_debug ("Compiling Scala tuning %s", path);
+      if (scala_compile (scl, kbm, &tuning->description, tuning->pitch))
+        {
+          g_key_file_set_double_list (cache, hash, "pitch", tuning->pitch, 128);
+          g_key_file_set_string (cache, hash, "description", tuning->description);
+        }
+      else
+        {
+          g_warning ("%s is not a Scala scale%s", path, kbm ? " or its keyboard mapping is malformed" : "");
+          g_free (hash);
+          hash = NULL;
+        }
+    }
+  g_free (scl);
+  g_free (kbm);
+  return hash;
+}
+
+/* the identity of a file as the cache records it, "" if it does not exist */
+static gchar *
+file_identity (gchar const *path)
+{
+  GStatBuf st;
+  if (path == NULL || g_stat (path, &st) != 0)
+    return g_strdup ("");
+  return g_strdup_printf ("%" G_GINT64_FORMAT " %" G_GINT64_FORMAT, (gint64) st.st_mtime, (gint64) st.st_size);
+}
+
+/* brings the cache entry of path up to date and returns its tuning, or NULL */
+static scala_tuning_t *
+get_tuning (GKeyFile * cache, gchar const *path, GHashTable * used, gboolean * dirty)
+{
+  scala_tuning_t *tuning = g_malloc0 (sizeof (scala_tuning_t));
+  gchar *stem = g_strndup (path, strlen (path) - strlen (".scl"));
+  gchar *kbm_path = g_strconcat (stem, ".kbm", NULL);
+  gchar *path_hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, path, -1);
+  gchar *group = g_strconcat (FILE_GROUP_PREFIX, path_hash, NULL);
+  gchar *identity = file_identity (path), *kbm_identity = file_identity (kbm_path);
+  gchar *cached = g_key_file_get_string (cache, group, "identity", NULL);
+  gchar *cached_kbm = g_key_file_get_string (cache, group, "kbm-identity", NULL);
+  gchar *hash = g_key_file_get_string (cache, group, "hash", NULL);
+
+  if (!(hash && cached && cached_kbm && !strcmp (cached, identity) && !strcmp (cached_kbm, kbm_identity) && load_tuning (cache, hash, tuning)))
+    {
+      g_free (hash);
+      hash = compile_files (cache, path, *kbm_identity ? kbm_path : NULL, tuning);
+      if (hash)
+        {
+          g_key_file_set_string (cache, group, "path", path);
+          g_key_file_set_string (cache, group, "identity", identity);
+          g_key_file_set_string (cache, group, "kbm-identity", kbm_identity);
+          g_key_file_set_string (cache, group, "hash", hash);
+        }
+      else
+        g_key_file_remove_group (cache, group, NULL);
+      *dirty = TRUE;
+    }
+
+  if (hash)
+    {
+      gchar *base = g_path_get_basename (stem);
+      tuning->name = g_strdup (base);
+      tuning->path = g_strdup (path);
+      g_hash_table_replace (used, g_strdup (group), NULL);
+      g_hash_table_replace (used, hash, NULL);
+      g_free (base);
+    }
+  else
+    {
+      free_tuning (tuning);
+      tuning = NULL;
+    }
+  g_free (stem);
+  g_free (kbm_path);
+  g_free (path_hash);
+  g_free (group);
+  g_free (identity);
+  g_free (kbm_identity);
+  g_free (cached);
+  g_free (cached_kbm);
+  return tuning;
+}
+
+static gint
+compare_tunings (scala_tuning_t const *a, scala_tuning_t const *b)
+{
+  return g_utf8_collate (a->name, b->name);
+}
+
+GList *
+scala_get_tunings (void)
+{
+  gchar const *dirname = get_local_dir (HISTORICHARPSICHORD_DIR_TEMPERAMENTS);
+  gchar *filename = get_cache_file ();
+  GKeyFile *cache = g_key_file_new ();
+  GHashTable *used = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  gboolean dirty = FALSE;
+  gchar **groups, **group;
+  gchar const *name;
+  GDir *dir;
+
+  g_list_free_full (tunings, (GDestroyNotify) free_tuning);
+  tunings = NULL;
+  g_key_file_load_from_file (cache, filename, G_KEY_FILE_NONE, NULL);
+
+  /* made here so that users find where to put their files */
+  g_mkdir_with_parents (dirname, 0770);
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir)
+    {
+      while ((name = g_dir_read_name (dir)))
+        if (g_str_has_suffix (name, ".scl") || g_str_has_suffix (name, ".SCL"))
+          {
+            gchar *path = g_build_filename (dirname, name, NULL);
+            scala_tuning_t *tuning = get_tuning (cache, path, used, &dirty);
+            if (tuning)
+              tunings = g_list_prepend (tunings, tuning);
+            g_free (path);
+          }
+      g_dir_close (dir);
+    }
+  tunings = g_list_sort (tunings, (GCompareFunc) compare_tunings);
+
+  /* forget the files that have gone */
+  groups = g_key_file_get_groups (cache, NULL);
+  for (group = groups; *group; group++)
+    if (!g_hash_table_lookup_extended (used, *group, NULL, NULL))
+      {
+        g_key_file_remove_group (cache, *group, NULL);
+        dirty = TRUE;
+      }
+  g_strfreev (groups);
+
+  if (dirty)
+    {
+      gsize length;
+      gchar *data = g_key_file_to_data (cache, &length, NULL);
+      if (!g_file_set_contents (filename, data, length, NULL))
+        g_warning ("Could not write the temperament cache %s", filename);
+      g_free (data);
+    }
+  g_debug ("%u Scala tunings in %s", g_list_length (tunings), dirname);
+
+  g_key_file_free (cache);
+  g_hash_table_destroy (used);
+  g_free (filename);
+  return g_list_copy (tunings);
+}
@@ -0,0 +1,64 @@
+/*
+ * scala.h
+ * Temperaments from Scala scale (.scl) and keyboard mapping (.kbm) files.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SCALA_H
+#define SCALA_H
+
+#include <glib.h>
+
+/**
+ * A Scala tuning compiled for the synth.
+ */
+typedef struct scala_tuning_t
+{
+  /**
+   * The file name without its extension, unique within the directory.
+   */
+  gchar *name;
+  /**
+   * The description line of the .scl file.
+   */
+  gchar *description;
+  gchar *path;
+  /**
+   * The pitch of each key in cents as tuning_build_table() gives it, at
+   * modern pitch.
+   */
+  gdouble pitch[128];
+} scala_tuning_t;
+
+/**
+ * Compiles a scale and keyboard mapping into the pitch of each key.
+ * Without a mapping degree 0 of the scale is on key 60 and key 69 is
+ * tuned to 440 Hz. Keys the mapping leaves out keep equal temperament.
+ *
+ * @param scl  the contents of a .scl file
+ * @param kbm  the contents of a .kbm file, or NULL
+ * @param description  if not NULL, set to the description line of scl
+ * @param pitch  filled with the pitch of each key, see tuning_build_table()
+ * @return  FALSE if either file is malformed
+ */
+gboolean scala_compile (gchar const *scl, gchar const *kbm, gchar ** description, gdouble pitch[128]);
+
+/**
+ * Returns the tunings of the .scl files in the user's temperaments
+ * directory, sorted by name. A foo.kbm next to foo.scl is used as its
+ * keyboard mapping. Compiled tunings are cached by the hash of the files,
+ * and files whose mtime and size are unchanged are not even read, so
+ * hundreds of tunings cost nothing at startup.
+ *
+ * @return  a list of scala_tuning_t belonging to the cache, to be freed
+ *   with g_list_free()
+ */
+GList *scala_get_tunings (void);
+
+#endif // SCALA_H
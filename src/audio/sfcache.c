@@ -0,0 +1,256 @@
+/*
+ * sfcache.c
+ * Cache of reduced copies of the SoundFonts used for playback.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <historicHarpsichord/historicHarpsichord.h>
+#include "audio/sfcache.h"
+#include "audio/sfcatalog.h"
+#include "audio/sfonset.h"
+#include "core/utils.h"
+#include "sffile.h"
+
+#define CACHE_DIR "SoundFontCache"
+#define REPORT_GROUP "Onsets"
+
+static gchar *
+get_cache_dir (void)
+{
+  gchar *dir = g_build_filename (get_user_data_dir (TRUE), CACHE_DIR, NULL);
+  g_mkdir_with_parents (dir, 0770);
+  return dir;
+}
+
+/* removes cached copies of SoundFonts that are no longer catalogued */
+static void
+prune_cache (gchar const *cache_dir)
+{
+  GDir *dir = g_dir_open (cache_dir, 0, NULL);
+  GHashTable *hashes;
+  GList *entries, *g;
+  gchar const *filename;
+  if (dir == NULL)
+    return;
+  hashes = g_hash_table_new (g_str_hash, g_str_equal);
+  entries = sf_catalog_get_entries ();
+  for (g = entries; g; g = g->next)
+    {
+      sf_catalog_entry_t *entry = g->data;
+      if (entry->hash)
+        g_hash_table_insert (hashes, entry->hash, entry->hash);
+    }
+  while ((filename = g_dir_read_name (dir)))
+    {
+      gchar *hash = g_strndup (filename, strcspn (filename, "-."));
+      if (!g_hash_table_lookup (hashes, hash))
+        {
+          gchar *path = g_build_filename (cache_dir, filename, NULL);
+          g_remove (path);
+          g_free (path);
+        }
+      g_free (hash);
+    }
+  g_dir_close (dir);
+  g_hash_table_destroy (hashes);
+  g_list_free (entries);
+}
+
+/* writes the loaded SoundFont to cached */
+static gboolean
+write_copy (SFInfo * sf, FILE * fin, gchar const *cached)
+{
+  gboolean ret = FALSE;
+  /* write beside the final name, so an interrupted write is never used */
+  gchar *tmp = g_strconcat (cached, ".part", NULL);
+  FILE *fout = fopen (tmp, "wb");
+  if (fout)
+    {
+      ret = (save_soundfont (sf, fin, fout) == 0);
+      ret = (fclose (fout) == 0) && ret;
+      if (ret)
+        ret = (g_rename (tmp, cached) == 0);
+      if (!ret)
+        g_remove (tmp);
+    }
+  g_free (tmp);
+  return ret;
+}
+
+static void
+write_report (gchar const *report, gint trimmed, gdouble saved_ms[128])
+{
+  GKeyFile *keyfile = g_key_file_new ();
+  gchar *data;
+  gsize length;
+  g_key_file_set_integer (keyfile, REPORT_GROUP, "trimmed-samples", trimmed);
+  g_key_file_set_double_list (keyfile, REPORT_GROUP, "saved-ms", saved_ms, 128);
+  data = g_key_file_to_data (keyfile, &length, NULL);
+  if (!g_file_set_contents (report, data, length, NULL))
+    g_warning ("Could not write %s", report);
+  g_free (data);
+  g_key_file_free (keyfile);
+}
+
+/* reduces the SoundFont at path to bank 0 program 0 and moves the start of
+ * its samples to their onsets. The result is written to cached if that
+ * changed anything, and the latency saved per key to report. */
+static gboolean
+build_playback_copy (gchar const *path, gchar const *cached, gchar const *report)
+{
+  SFInfo sf;
+  SFPresetId keep = { 0, 0 };
+  gdouble saved_ms[128];
+  gint npresets, trimmed;
+  gboolean ret = FALSE;
+  FILE *fin;
+
+  fin = fopen (path, "rb");
+  if (fin == NULL)
+    return FALSE;
+  memset (&sf, 0, sizeof (sf));
+  if (load_soundfont (&sf, fin, TRUE) == 0)
+    {
+      npresets = sf.npresets;
+      if (subset_soundfont (&sf, &keep, 1) >= 0 && (trimmed = sf_onset_trim (&sf, fin, saved_ms)) >= 0)
+        {
+          if (sf.npresets < npresets || trimmed > 0)
+            ret = write_copy (&sf, fin, cached);
+          else
+            ret = TRUE;
+          if (ret)
+            write_report (report, trimmed, saved_ms);
+        }
+    }
+  free_soundfont (&sf);
+  fclose (fin);
+  return ret;
+}
+
+static void
+log_report (gchar const *path, gchar const *report)
+{
+  GKeyFile *keyfile = g_key_file_new ();
+  gdouble *saved_ms;
+  gsize i, n = 0;
+  gdouble total = 0.0, most = 0.0;
+  gint keys = 0;
+
+  if (g_key_file_load_from_file (keyfile, report, G_KEY_FILE_NONE, NULL)
+      && (saved_ms = g_key_file_get_double_list (keyfile, REPORT_GROUP, "saved-ms", &n, NULL)))
+    {
+      for (i = 0; i < n; i++)
+        if (saved_ms[i] > 0.0)
+          {
+            g_debug ("Key %d starts %.2f ms earlier", (gint) i, saved_ms[i]);
+            total += saved_ms[i];
+            most = MAX (most, saved_ms[i]);
+            keys++;
+          }
+      if (keys)
+        g_message ("Trimming leading silence from %s saves %.2f ms per key on average, %.2f ms at most", path, total / keys, most);
+      g_free (saved_ms);
+    }
+  g_key_file_free (keyfile);
+}
+
+gchar *
+sf_cache_get_playback_soundfont (gchar const *path)
+{
+  sf_catalog_entry_t const *entry = sf_catalog_lookup (path);
+  gchar *cache_dir, *base, *cached, *report;
+
+  if (entry == NULL || entry->hash == NULL || sf_catalog_find_preset (entry, 0, 0) == NULL)
+    return g_strdup (path);
+
+  cache_dir = get_cache_dir ();
+  base = g_build_filename (cache_dir, entry->hash, NULL);
+  cached = g_strconcat (base, "-0-0.sf2", NULL);
+  report = g_strconcat (base, "-0-0.onsets", NULL);
+  g_free (base);
+
+  /* the report records that the analysis was done, even if no copy was needed */
+  if (!g_file_test (report, G_FILE_TEST_EXISTS))
+    {
+      prune_cache (cache_dir);
+      g_remove (cached);
+      if (!build_playback_copy (path, cached, report))
+        g_warning ("Could not prepare %s for playback, loading it as it is", path);
+    }
+  log_report (path, report);
+
+  if (!g_file_test (cached, G_FILE_TEST_EXISTS))
+    {
+      g_free (cached);
+      cached = g_strdup (path);
+    }
+  g_free (report);
+  g_free (cache_dir);
+  return cached;
+}
+
+gchar *
+sf_cache_get_resampled_bank (gchar const *path, guint rate, gdouble const key_cents[128])
+{
+  sf_catalog_entry_t const *entry = sf_catalog_lookup (path);
+  gint32 hundredths[128];
+  gchar *cache_dir, *tuning, *name, *bank;
+  gint key;
+
+  if (entry == NULL || entry->hash == NULL)
+    return NULL;
+  /* tunings that differ by less than a hundredth of a cent share a bank */
+  for (key = 0; key < 128; key++)
+    hundredths[key] = GINT32_TO_LE ((gint32) lrint (key_cents[key] * 100.0));
+  tuning = g_compute_checksum_for_data (G_CHECKSUM_SHA1, (guchar *) hundredths, sizeof (hundredths));
+  cache_dir = get_cache_dir ();
+  name = g_strdup_printf ("%s-r%u-%.12s.sf2", entry->hash, rate, tuning);
+  bank = g_build_filename (cache_dir, name, NULL);
+  g_free (name);
+  g_free (tuning);
+  g_free (cache_dir);
+  return bank;
+}
+
+void
+sf_cache_forget_resampled_banks (gchar const *path, gchar const *keep)
+{
+  sf_catalog_entry_t const *entry = sf_catalog_lookup (path);
+  gchar *cache_dir, *prefix, *keep_name;
+  gchar const *filename;
+  GDir *dir;
+
+  if (entry == NULL || entry->hash == NULL)
+    return;
+  cache_dir = get_cache_dir ();
+  dir = g_dir_open (cache_dir, 0, NULL);
+  if (dir == NULL)
+    {
+      g_free (cache_dir);
+      return;
+    }
+  prefix = g_strconcat (entry->hash, "-r", NULL);
+  keep_name = keep ? g_path_get_basename (keep) : NULL;
+  while ((filename = g_dir_read_name (dir)))
+    if (g_str_has_prefix (filename, prefix) && g_strcmp0 (filename, keep_name))
+      {
+        gchar *bank = g_build_filename (cache_dir, filename, NULL);
+        g_remove (bank);
+        g_free (bank);
+      }
+  g_dir_close (dir);
+  g_free (keep_name);
+  g_free (prefix);
+  g_free (cache_dir);
+}
@@ -0,0 +1,51 @@
+/*
+ * sfcache.h
+ * Cache of reduced copies of the SoundFonts used for playback.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SFCACHE_H
+#define SFCACHE_H
+
+#include <glib.h>
+
+/**
+ * Returns the file the synth should load to play the given SoundFont.
+ * Only bank 0 program 0 is ever played, so a SoundFont holding other presets
+ * as well is reduced to that preset with the instruments and samples it
+ * uses. The leading silence of its samples is trimmed as well, see
+ * sf_onset_trim(), and the latency that saves is logged. The copy is kept in
+ * the user data directory, keyed by the hash of the original, and is only
+ * built once. If the SoundFont needs no changes or the copy cannot be made
+ * the SoundFont itself is returned.
+ *
+ * @param path  the SoundFont chosen by the user
+ * @return  a newly allocated path, to be freed with g_free()
+ */
+gchar *sf_cache_get_playback_soundfont (gchar const *path);
+
+/**
+ * Returns the file in the cache for a bank of the given SoundFont resampled
+ * with sf_resample_bank(). The file need not exist yet.
+ *
+ * @param path  the SoundFont chosen by the user
+ * @param rate  the output sample rate the bank is made for
+ * @param key_cents  the tuning the bank is made for, per key
+ * @return  a newly allocated path, to be freed with g_free()
+ */
+gchar *sf_cache_get_resampled_bank (gchar const *path, guint rate, gdouble const key_cents[128]);
+
+/**
+ * Removes the resampled banks of the given SoundFont from the cache, except
+ * keep. Each bank takes several times the memory of the SoundFont, so only
+ * the one in use is kept.
+ */
+void sf_cache_forget_resampled_banks (gchar const *path, gchar const *keep);
+
+#endif // SFCACHE_H
@@ -0,0 +1,612 @@
+/*
+ * sfcatalog.c
+ * Persistent catalogue of the installed SoundFont files.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <historicHarpsichord/historicHarpsichord.h>
+#include "audio/sfcatalog.h"
+#include "core/utils.h"
+#include "sffile.h"
+
+#define CATALOG_FILE "SoundFontCatalog.xml"
+#define HASH_BLOCK_SIZE (64 * 1024)
+
+/* path -> sf_catalog_entry_t */
+static GHashTable *catalog = NULL;
+/* path -> sf_catalog_entry_t holding only the identity of a file that
+ * could not be parsed, so that it is not parsed again until it changes */
+static GHashTable *broken = NULL;
+static gboolean catalog_dirty = FALSE;
+static gboolean rescanning = FALSE;
+
+/* a rescan runs in a thread of its own against a copy of the identities
+ * catalogued; the main thread, which alone touches the catalogue, merges
+ * what it found */
+typedef struct rescan_job
+{
+  gchar *dirs[2];
+  GHashTable *known;            /* path -> sf_catalog_entry_t holding only the identity */
+  GHashTable *parsed;           /* path -> sf_catalog_entry_t of the files parsed */
+  GHashTable *failed;           /* path -> identity of the files that could not be parsed */
+  GHashTable *seen;             /* the SoundFont files found */
+  GHashTable *visited;          /* "device:inode" of the directories scanned */
+  GList *vanished;              /* the files catalogued that are gone */
+  gint count;                   /* how many files were parsed */
+} rescan_job;
+
+
+static void
+free_preset (sf_catalog_preset_t * preset)
+{
+  g_free (preset->name);
+  g_free (preset);
+}
+
+static void
+free_entry (sf_catalog_entry_t * entry)
+{
+  g_list_free_full (entry->presets, (GDestroyNotify) free_preset);
+  g_free (entry->path);
+  g_free (entry->hash);
+  g_free (entry->name);
+  g_free (entry);
+}
+
+/* SoundFont names are fixed length byte strings of no particular encoding */
+static gchar *
+clean_name (gchar const *name, gsize length)
+{
+  gchar *ret = g_strndup (name, length);
+  gchar *p;
+  for (p = ret; *p; p++)
+    if (!g_ascii_isprint (*p))
+      *p = ' ';
+  return g_strstrip (ret);
+}
+
+static gchar *
+get_catalog_file (void)
+{
+  return g_build_filename (get_user_data_dir (TRUE), CATALOG_FILE, NULL);
+}
+
+static gchar *
+hash_file (gchar const *path)
+{
+  FILE *fp = fopen (path, "rb");
+  if (fp == NULL)
+    return NULL;
+  GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  guchar *block = g_malloc (HASH_BLOCK_SIZE);
+  size_t n;
+  while ((n = fread (block, 1, HASH_BLOCK_SIZE, fp)) > 0)
+    g_checksum_update (checksum, block, n);
+  fclose (fp);
+  g_free (block);
+  gchar *hash = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+  return hash;
+}
+
+/* returns the amount of generator oper in layer, or def if it is absent */
+static gint
+find_gen (SFGenLayer * layer, gint oper, gint def)
+{
+  gint i;
+  for (i = 0; i < layer->nlists; i++)
+    if (layer->list[i].oper == oper)
+      return (guint16) layer->list[i].amount;
+  return def;
+}
+
+/* the preset's key range is the union of the ranges of all sample zones,
+ * each intersected with the range of the preset zone it is reached from */
+static sf_catalog_preset_t *
+summarize_preset (SFInfo * sf, SFPresetHdr * hdr)
+{
+  sf_catalog_preset_t *preset = g_malloc0 (sizeof (sf_catalog_preset_t));
+  gboolean *used = g_malloc0 (sizeof (gboolean) * MAX (sf->nsamples, 1));
+  gint preset_range = 0x7f00, i, j;
+  guint lo = 127, hi = 0;
+
+  preset->name = clean_name (hdr->hdr.name, sizeof (hdr->hdr.name));
+  preset->bank = hdr->bank;
+  preset->program = hdr->preset;
+
+  for (i = 0; i < hdr->hdr.nlayers; i++)
+    {
+      SFGenLayer *player = &hdr->hdr.layer[i];
+      gint prange = find_gen (player, SF_GEN_KEYRANGE, preset_range);
+      gint inst = find_gen (player, SF_GEN_INSTRUMENT, -1);
+      if (inst < 0)
+        {
+          if (i == 0)           /* global zone */
+            preset_range = prange;
+          continue;
+        }
+      if (inst >= sf->ninsts)
+        continue;
+
+      SFInstHdr *ihdr = &sf->inst[inst];
+      gint inst_range = 0x7f00;
+      for (j = 0; j < ihdr->hdr.nlayers; j++)
+        {
+          SFGenLayer *ilayer = &ihdr->hdr.layer[j];
+          gint irange = find_gen (ilayer, SF_GEN_KEYRANGE, inst_range);
+          gint sample = find_gen (ilayer, SF_GEN_SAMPLEID, -1);
+          if (sample < 0)
+            {
+              if (j == 0)
+                inst_range = irange;
+              continue;
+            }
+          if (sample >= sf->nsamples)
+            continue;
+          guint klo = MAX (SF_RANGE_LO (prange), SF_RANGE_LO (irange));
+          guint khi = MIN (SF_RANGE_HI (prange), SF_RANGE_HI (irange));
+          if (klo <= khi)
+            {
+              lo = MIN (lo, klo);
+              hi = MAX (hi, khi);
+            }
+          used[sample] = TRUE;
+        }
+    }
+
+  for (i = 0; i < sf->nsamples; i++)
+    if (used[i] && !(sf->sample[i].sampletype & 0x8000) && sf->sample[i].endsample > sf->sample[i].startsample)
+      preset->sample_bytes += 2 * (guint64) (sf->sample[i].endsample - sf->sample[i].startsample);
+  g_free (used);
+
+  preset->key_lo = lo <= hi ? lo : 0;
+  preset->key_hi = lo <= hi ? hi : 0;
+  return preset;
+}
+
+static gint
+compare_presets (sf_catalog_preset_t const *a, sf_catalog_preset_t const *b)
+{
+  if (a->bank != b->bank)
+    return a->bank < b->bank ? -1 : 1;
+  return a->program < b->program ? -1 : a->program > b->program;
+}
+
+/* parses the file, returns NULL if it is not a readable SoundFont */
+static sf_catalog_entry_t *
+parse_soundfont (gchar const *path, GStatBuf * st)
+{
+  SFInfo sf;
+  FILE *fp = fopen (path, "rb");
+  gint i;
+  if (fp == NULL)
+    return NULL;
+  memset (&sf, 0, sizeof (sf));
+  if (load_soundfont (&sf, fp, TRUE))
+    {
+      fclose (fp);
+      g_warning ("%s is not a SoundFont file", path);
+      return NULL;
+    }
+  fclose (fp);
+
+  sf_catalog_entry_t *entry = g_malloc0 (sizeof (sf_catalog_entry_t));
+  entry->path = g_strdup (path);
+  entry->inode = st->st_ino;
+  entry->mtime = st->st_mtime;
+  entry->size = st->st_size;
+  entry->hash = hash_file (path);
+  entry->name = sf.sf_name ? clean_name (sf.sf_name, strlen (sf.sf_name)) : NULL;
+  entry->sample_bytes = sf.samplesize > 0 ? sf.samplesize : 0;
+
+  /* the last preset header is the terminal EOP record */
+  for (i = 0; i < sf.npresets - 1; i++)
+    entry->presets = g_list_prepend (entry->presets, summarize_preset (&sf, &sf.preset[i]));
+  entry->presets = g_list_sort (entry->presets, (GCompareFunc) compare_presets);
+
+  free_soundfont (&sf);
+  return entry;
+}
+
+static gchar *
+get_prop (xmlNodePtr node, gchar const *name)
+{
+  xmlChar *tmp = xmlGetProp (node, (xmlChar *) name);
+  gchar *ret = g_strdup (tmp ? (gchar *) tmp : "");
+  if (tmp)
+    xmlFree (tmp);
+  return ret;
+}
+
+static guint64
+get_int_prop (xmlNodePtr node, gchar const *name)
+{
+  gchar *tmp = get_prop (node, name);
+  guint64 ret = g_ascii_strtoull (tmp, NULL, 10);
+  g_free (tmp);
+  return ret;
+}
+
+static void
+set_int_prop (xmlNodePtr node, gchar const *name, guint64 value)
+{
+  gchar *tmp = g_strdup_printf ("%" G_GUINT64_FORMAT, value);
+  xmlSetProp (node, (xmlChar *) name, (xmlChar *) tmp);
+  g_free (tmp);
+}
+
+static void
+load_catalog (void)
+{
+  gchar *filename = get_catalog_file ();
+  xmlDocPtr doc = NULL;
+  xmlNodePtr root, cur, child;
+
+  catalog = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_entry);
+  broken = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_entry);
+
+  if (g_file_test (filename, G_FILE_TEST_EXISTS))
+    doc = xmlParseFile (filename);
+  g_free (filename);
+  if (doc == NULL)
+    return;
+
+  root = xmlDocGetRootElement (doc);
+  if (root == NULL || xmlStrcmp (root->name, (const xmlChar *) "SoundFontCatalog"))
+    {
+      g_warning ("Ignoring malformed SoundFont catalogue");
+      xmlFreeDoc (doc);
+      return;
+    }
+
+  for (cur = root->xmlChildrenNode; cur; cur = cur->next)
+    {
+      if (!xmlStrcmp (cur->name, (const xmlChar *) "Broken"))
+        {
+          sf_catalog_entry_t *entry = g_malloc0 (sizeof (sf_catalog_entry_t));
+          entry->path = get_prop (cur, "path");
+          entry->inode = get_int_prop (cur, "inode");
+          entry->mtime = get_int_prop (cur, "mtime");
+          entry->size = get_int_prop (cur, "size");
+          g_hash_table_replace (broken, entry->path, entry);
+          continue;
+        }
+      if (xmlStrcmp (cur->name, (const xmlChar *) "SoundFont"))
+        continue;
+      sf_catalog_entry_t *entry = g_malloc0 (sizeof (sf_catalog_entry_t));
+      entry->path = get_prop (cur, "path");
+      entry->inode = get_int_prop (cur, "inode");
+      entry->mtime = get_int_prop (cur, "mtime");
+      entry->size = get_int_prop (cur, "size");
+      entry->hash = get_prop (cur, "hash");
+      entry->name = get_prop (cur, "name");
+      entry->sample_bytes = get_int_prop (cur, "sample_bytes");
+      for (child = cur->xmlChildrenNode; child; child = child->next)
+        {
+          if (xmlStrcmp (child->name, (const xmlChar *) "Preset"))
+            continue;
+          sf_catalog_preset_t *preset = g_malloc0 (sizeof (sf_catalog_preset_t));
+          preset->name = get_prop (child, "name");
+          preset->bank = get_int_prop (child, "bank");
+          preset->program = get_int_prop (child, "program");
+          preset->key_lo = get_int_prop (child, "key_lo");
+          preset->key_hi = get_int_prop (child, "key_hi");
+          preset->sample_bytes = get_int_prop (child, "sample_bytes");
+          entry->presets = g_list_append (entry->presets, preset);
+        }
+      g_hash_table_replace (catalog, entry->path, entry);
+    }
+  xmlFreeDoc (doc);
+}
+
+static void
+save_catalog (void)
+{
+  gchar *filename = get_catalog_file ();
+  xmlDocPtr doc = xmlNewDoc ((xmlChar *) "1.0");
+  xmlNodePtr root, node, child;
+  GHashTableIter iter;
+  sf_catalog_entry_t *entry;
+  GList *g;
+
+  doc->xmlRootNode = root = xmlNewDocNode (doc, NULL, (xmlChar *) "SoundFontCatalog", NULL);
+  g_hash_table_iter_init (&iter, catalog);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & entry))
+    {
+      node = xmlNewChild (root, NULL, (xmlChar *) "SoundFont", NULL);
+      xmlSetProp (node, (xmlChar *) "path", (xmlChar *) entry->path);
+      set_int_prop (node, "inode", entry->inode);
+      set_int_prop (node, "mtime", entry->mtime);
+      set_int_prop (node, "size", entry->size);
+      xmlSetProp (node, (xmlChar *) "hash", (xmlChar *) (entry->hash ? entry->hash : ""));
+      xmlSetProp (node, (xmlChar *) "name", (xmlChar *) (entry->name ? entry->name : ""));
+      set_int_prop (node, "sample_bytes", entry->sample_bytes);
+      for (g = entry->presets; g; g = g->next)
+        {
+          sf_catalog_preset_t *preset = g->data;
+          child = xmlNewChild (node, NULL, (xmlChar *) "Preset", NULL);
+          xmlSetProp (child, (xmlChar *) "name", (xmlChar *) preset->name);
+          set_int_prop (child, "bank", preset->bank);
+          set_int_prop (child, "program", preset->program);
+          set_int_prop (child, "key_lo", preset->key_lo);
+          set_int_prop (child, "key_hi", preset->key_hi);
+          set_int_prop (child, "sample_bytes", preset->sample_bytes);
+        }
+    }
+  g_hash_table_iter_init (&iter, broken);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & entry))
+    {
+      node = xmlNewChild (root, NULL, (xmlChar *) "Broken", NULL);
+      xmlSetProp (node, (xmlChar *) "path", (xmlChar *) entry->path);
+      set_int_prop (node, "inode", entry->inode);
+      set_int_prop (node, "mtime", entry->mtime);
+      set_int_prop (node, "size", entry->size);
+    }
+
+  if (xmlSaveFormatFile (filename, doc, 1) < 0)
+    g_warning ("Could not write SoundFont catalogue %s", filename);
+  else
+    catalog_dirty = FALSE;
+  xmlFreeDoc (doc);
+  g_free (filename);
+}
+
+/* an entry holding only the identity of the file */
+static sf_catalog_entry_t *
+identity_entry (gchar const *path, guint64 inode, gint64 mtime, guint64 size)
+{
+  sf_catalog_entry_t *entry = g_malloc0 (sizeof (sf_catalog_entry_t));
+  entry->path = g_strdup (path);
+  entry->inode = inode;
+  entry->mtime = mtime;
+  entry->size = size;
+  return entry;
+}
+
+/* whether entry was made from the file as it is now */
+static gboolean
+same_file (sf_catalog_entry_t const *entry, GStatBuf * st)
+{
+  return entry && entry->inode == (guint64) st->st_ino && entry->mtime == (gint64) st->st_mtime && entry->size == (guint64) st->st_size;
+}
+
+/* brings the entry for path up to date, returns TRUE if the file was parsed */
+static gboolean
+refresh_entry (gchar const *path, GStatBuf * st)
+{
+  sf_catalog_entry_t *entry = g_hash_table_lookup (catalog, path);
+  if (same_file (entry, st) || same_file (g_hash_table_lookup (broken, path), st))
+    return FALSE;
+
+  g_debug ("Cataloguing SoundFont %s", path);
+  entry = parse_soundfont (path, st);
+  if (entry)
+    {
+      g_hash_table_replace (catalog, entry->path, entry);
+      g_hash_table_remove (broken, path);
+    }
+  else
+    {
+      g_hash_table_remove (catalog, path);
+      entry = identity_entry (path, st->st_ino, st->st_mtime, st->st_size);
+      g_hash_table_replace (broken, entry->path, entry);
+    }
+  catalog_dirty = TRUE;
+  return TRUE;
+}
+
+/* worker thread: parses the file unless it is as it was catalogued */
+static void
+scan_file (rescan_job * job, gchar const *path, GStatBuf * st)
+{
+  sf_catalog_entry_t *entry;
+  g_hash_table_add (job->seen, g_strdup (path));
+  if (same_file (g_hash_table_lookup (job->known, path), st))
+    return;
+  g_debug ("Cataloguing SoundFont %s", path);
+  entry = parse_soundfont (path, st);
+  if (entry)
+    g_hash_table_replace (job->parsed, entry->path, entry);
+  else
+    {
+      entry = identity_entry (path, st->st_ino, st->st_mtime, st->st_size);
+      g_hash_table_replace (job->failed, entry->path, entry);
+    }
+  job->count++;
+}
+
+/* worker thread: scans the directory and those below it, each once
+ * however many links lead to it */
+static void
+scan_directory (rescan_job * job, gchar const *dirname)
+{
+  GDir *dir;
+  gchar const *name;
+  gchar *id;
+  GStatBuf st;
+  if (g_stat (dirname, &st) != 0)
+    return;
+  id = g_strdup_printf ("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT, (guint64) st.st_dev, (guint64) st.st_ino);
+  if (g_hash_table_contains (job->visited, id))
+    {
+      g_free (id);
+      return;
+    }
+  g_hash_table_add (job->visited, id);
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir == NULL)
+    return;
+  while ((name = g_dir_read_name (dir)))
+    {
+      gchar *path = g_build_filename (dirname, name, NULL);
+      if (g_stat (path, &st) == 0)
+        {
+          if (S_ISDIR (st.st_mode))
+            scan_directory (job, path);
+          else if (g_str_has_suffix (name, ".sf2") || g_str_has_suffix (name, ".SF2"))
+            scan_file (job, path, &st);
+        }
+      g_free (path);
+    }
+  g_dir_close (dir);
+}
+
+/* main thread: merges what the worker found into the catalogue */
+static gboolean
+rescan_done (rescan_job * job)
+{
+  GHashTableIter iter;
+  sf_catalog_entry_t *entry;
+  GList *g;
+
+  g_hash_table_iter_init (&iter, job->parsed);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & entry))
+    {
+      g_hash_table_iter_steal (&iter);
+      g_hash_table_remove (broken, entry->path);
+      g_hash_table_replace (catalog, entry->path, entry);
+      catalog_dirty = TRUE;
+    }
+  g_hash_table_iter_init (&iter, job->failed);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & entry))
+    {
+      g_hash_table_iter_steal (&iter);
+      g_hash_table_remove (catalog, entry->path);
+      g_hash_table_replace (broken, entry->path, entry);
+      catalog_dirty = TRUE;
+    }
+  for (g = job->vanished; g; g = g->next)
+    {
+      g_hash_table_remove (catalog, g->data);
+      g_hash_table_remove (broken, g->data);
+      catalog_dirty = TRUE;
+    }
+
+  if (catalog_dirty)
+    save_catalog ();
+  g_debug ("SoundFont catalogue holds %u files, %d (re)parsed", g_hash_table_size (catalog), job->count);
+
+  g_free (job->dirs[0]);
+  g_free (job->dirs[1]);
+  g_hash_table_destroy (job->known);
+  g_hash_table_destroy (job->parsed);
+  g_hash_table_destroy (job->failed);
+  g_hash_table_destroy (job->seen);
+  g_hash_table_destroy (job->visited);
+  g_list_free_full (job->vanished, g_free);
+  g_free (job);
+  rescanning = FALSE;
+  return FALSE;
+}
+
+/* worker thread */
+static gpointer
+rescan_func (rescan_job * job)
+{
+  GHashTableIter iter;
+  gchar const *path;
+  GStatBuf st;
+
+  scan_directory (job, job->dirs[0]);
+  scan_directory (job, job->dirs[1]);
+  g_hash_table_iter_init (&iter, job->known);
+  while (g_hash_table_iter_next (&iter, (gpointer *) & path, NULL))
+    if (!g_hash_table_contains (job->seen, path) && g_stat (path, &st) != 0)
+      job->vanished = g_list_prepend (job->vanished, g_strdup (path));
+  g_idle_add ((GSourceFunc) rescan_done, job);
+  return NULL;
+}
+
+/* copies the identity of each entry of table into known */
+static void
+copy_identities (GHashTable * table, GHashTable * known)
+{
+  GHashTableIter iter;
+  sf_catalog_entry_t *entry;
+  g_hash_table_iter_init (&iter, table);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & entry))
+    {
+      sf_catalog_entry_t *copy = identity_entry (entry->path, entry->inode, entry->mtime, entry->size);
+      g_hash_table_replace (known, copy->path, copy);
+    }
+}
+
+void
+sf_catalog_rescan (void)
+{
+  rescan_job *job;
+  GThread *thread;
+
+  if (catalog == NULL)
+    load_catalog ();
+  if (rescanning)
+    return;
+
+  job = g_malloc0 (sizeof (rescan_job));
+  job->dirs[0] = get_system_dir (HISTORICHARPSICHORD_DIR_SOUNDFONTS);
+  job->dirs[1] = g_strdup (get_local_dir (HISTORICHARPSICHORD_DIR_SOUNDFONTS));
+  job->known = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_entry);
+  job->parsed = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_entry);
+  job->failed = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_entry);
+  job->seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  job->visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  copy_identities (catalog, job->known);
+  copy_identities (broken, job->known);
+
+  rescanning = TRUE;
+  thread = g_thread_try_new ("SoundFont rescan", (GThreadFunc) rescan_func, job, NULL);
+  if (thread)
+    g_thread_unref (thread);
+  else
+    rescan_done (job);
+}
+
+sf_catalog_entry_t const *
+sf_catalog_lookup (gchar const *path)
+{
+  GStatBuf st;
+  if (catalog == NULL)
+    load_catalog ();
+  if (path == NULL || g_stat (path, &st) != 0 || S_ISDIR (st.st_mode))
+    return NULL;
+  if (refresh_entry (path, &st))
+    save_catalog ();
+  return g_hash_table_lookup (catalog, path);
+}
+
+GList *
+sf_catalog_get_entries (void)
+{
+  if (catalog == NULL)
+    load_catalog ();
+  return g_hash_table_get_values (catalog);
+}
+
+sf_catalog_preset_t const *
+sf_catalog_find_preset (sf_catalog_entry_t const *entry, guint bank, guint program)
+{
+  GList *g;
+  if (entry == NULL)
+    return NULL;
+  for (g = entry->presets; g; g = g->next)
+    {
+      sf_catalog_preset_t *preset = g->data;
+      if (preset->bank == bank && preset->program == program)
+        return preset;
+    }
+  return NULL;
+}
@@ -0,0 +1,98 @@
+/*
+ * sfcatalog.h
+ * Persistent catalogue of the installed SoundFont files.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SFCATALOG_H
+#define SFCATALOG_H
+
+#include <glib.h>
+
+/**
+ * One preset of a catalogued SoundFont.
+ */
+typedef struct sf_catalog_preset_t
+{
+  gchar *name;
+  guint bank;
+  guint program;
+  /**
+   * The lowest and highest key any of the preset's zones responds to.
+   */
+  guint key_lo;
+  guint key_hi;
+  /**
+   * The size in bytes of the sample data the preset refers to.
+   */
+  guint64 sample_bytes;
+} sf_catalog_preset_t;
+
+/**
+ * A catalogued SoundFont file.
+ */
+typedef struct sf_catalog_entry_t
+{
+  gchar *path;
+  /**
+   * The file identity the entry was made from. A file whose inode, mtime
+   * and size are unchanged is not parsed again on a rescan.
+   */
+  guint64 inode;
+  gint64 mtime;
+  guint64 size;
+  /**
+   * SHA-1 of the file contents.
+   */
+  gchar *hash;
+  /**
+   * The name from the INFO chunk, may be NULL.
+   */
+  gchar *name;
+  /**
+   * The size in bytes of all sample data in the file.
+   */
+  guint64 sample_bytes;
+  /**
+   * A list of sf_catalog_preset_t.
+   */
+  GList *presets;
+} sf_catalog_entry_t;
+
+/**
+ * Starts bringing the catalogue up to date with the system and user
+ * SoundFont directories, in a thread of its own; the main loop merges the
+ * results when it is done. Only files that are new or whose inode, mtime
+ * or size changed since the last scan are parsed; a file that could not be
+ * parsed is not tried again until one of them changes. A directory reached
+ * again through a link is scanned once. The catalogue is saved to the user
+ * data directory if anything changed.
+ */
+void sf_catalog_rescan (void);
+
+/**
+ * Returns the catalogue entry for the given file, or NULL if it is not
+ * catalogued. The file is catalogued on the fly if it lies outside the
+ * scanned directories. The entry belongs to the catalogue.
+ */
+sf_catalog_entry_t const *sf_catalog_lookup (gchar const *path);
+
+/**
+ * Returns a list of all catalogued entries. The list must be freed with
+ * g_list_free(), the entries belong to the catalogue.
+ */
+GList *sf_catalog_get_entries (void);
+
+/**
+ * Returns the preset with the given bank and program of a catalogued
+ * SoundFont, or NULL.
+ */
+sf_catalog_preset_t const *sf_catalog_find_preset (sf_catalog_entry_t const *entry, guint bank, guint program);
+
+#endif // SFCATALOG_H
@@ -0,0 +1,246 @@
+/*
+ * sfonset.c
+ * Onset detection and leading-silence trimming of SoundFont samples.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "audio/sfonset.h"
+
+#define BLOCK_FRAMES 4096
+#define ROM_SAMPLE 0x8000
+
+/* generators that move the start of the played sample data */
+#define GEN_START_OFFSET 0
+#define GEN_START_COARSE_OFFSET 4
+
+/* reads frames [start, end) of the sample data, calling func on each block;
+ * stops early when func returns FALSE */
+static gboolean
+scan_sample (SFInfo * sf, FILE * fin, gint32 start, gint32 end, gboolean (*func) (gint16 const *block, gint n, gpointer data), gpointer data)
+{
+  gint16 block[BLOCK_FRAMES];
+  if (fseek (fin, sf->samplepos + start * 2L, SEEK_SET) < 0)
+    return FALSE;
+  while (start < end)
+    {
+      gint n = MIN (end - start, BLOCK_FRAMES);
+      if (fread (block, 2, n, fin) != (size_t) n)
+        return FALSE;
+      if (!func (block, n, data))
+        break;
+      start += n;
+    }
+  return TRUE;
+}
+
+static gboolean
+find_peak (gint16 const *block, gint n, gpointer data)
+{
+  gint *peak = data, i;
+  for (i = 0; i < n; i++)
+    if (abs (block[i]) > *peak)
+      *peak = abs (block[i]);
+  return TRUE;
+}
+
+typedef struct onset_search
+{
+  gint threshold;
+  gint32 frames;                /* frames examined before the onset */
+  gboolean found;
+} onset_search;
+
+static gboolean
+find_onset (gint16 const *block, gint n, gpointer data)
+{
+  onset_search *search = data;
+  gint i;
+  for (i = 0; i < n; i++)
+    if (abs (block[i]) >= search->threshold)
+      {
+        search->frames += i;
+        search->found = TRUE;
+        return FALSE;
+      }
+  search->frames += n;
+  return TRUE;
+}
+
+/* returns the number of frames the start of sample sp can move forward,
+ * or -1 on a read error */
+static gint32
+measure_silence (SFInfo * sf, FILE * fin, SFSampleInfo * sp)
+{
+  onset_search search = { 0, 0, FALSE };
+  gint32 limit, margin, trim;
+  gint peak = 0;
+
+  if ((sp->sampletype & ROM_SAMPLE) || sp->endsample <= sp->startsample || sp->samplerate <= 0)
+    return 0;
+  if (sp->startsample * 2L + (sp->endsample - sp->startsample) * 2L > sf->samplesize)
+    return 0;
+  /* the loop must stay whole, and a looped sample starts no later than its loop */
+  limit = sp->endsample - sp->startsample;
+  if (sp->startloop > sp->startsample && sp->startloop < sp->endsample)
+    limit = sp->startloop - sp->startsample;
+
+  if (!scan_sample (sf, fin, sp->startsample, sp->endsample, find_peak, &peak))
+    return -1;
+  if (peak == 0)
+    return 0;
+  search.threshold = MAX (1, (gint) (peak * pow (10.0, SF_ONSET_THRESHOLD_DB / 20.0)));
+  if (!scan_sample (sf, fin, sp->startsample, sp->startsample + limit, find_onset, &search))
+    return -1;
+  if (!search.found)
+    return 0;
+
+  margin = (gint32) (sp->samplerate * SF_ONSET_MARGIN_MS / 1000.0);
+  trim = search.frames - margin;
+  return CLAMP (trim, 0, limit);
+}
+
+/* returns the amount of generator oper in the layer, or def */
+static gint
+find_gen (SFGenLayer * layer, gint oper, gint def)
+{
+  gint i;
+  for (i = 0; i < layer->nlists; i++)
+    if (layer->list[i].oper == oper)
+      return layer->list[i].amount;
+  return def;
+}
+
+/* adds a generator to a layer after record at; the list was allocated by
+ * libsffile, which frees it with free() */
+static void
+insert_gen (SFGenLayer * layer, gint at, gint oper, gint amount)
+{
+  SFGenRec *list = realloc (layer->list, sizeof (SFGenRec) * (layer->nlists + 1));
+  if (list == NULL)
+    return;
+  memmove (&list[at + 2], &list[at + 1], sizeof (SFGenRec) * (layer->nlists - at - 1));
+  list[at + 1].oper = oper;
+  list[at + 1].amount = amount;
+  layer->list = list;
+  layer->nlists++;
+}
+
+/* takes trim frames off the start offset of a zone playing a trimmed sample,
+ * so it still starts at the same point of the data */
+static void
+correct_start_offset (SFGenLayer * layer, gint32 trim)
+{
+  gint i, fine = -1, coarse = -1;
+  gint32 offset;
+  for (i = 0; i < layer->nlists; i++)
+    if (layer->list[i].oper == GEN_START_OFFSET)
+      fine = i;
+    else if (layer->list[i].oper == GEN_START_COARSE_OFFSET)
+      coarse = i;
+  if (fine < 0 && coarse < 0)
+    return;
+  offset = (fine < 0 ? 0 : layer->list[fine].amount) + (coarse < 0 ? 0 : layer->list[coarse].amount * 32768);
+  offset = MAX (0, offset - trim);
+  if (coarse >= 0)
+    layer->list[coarse].amount = offset / 32768;
+  if (fine >= 0)
+    layer->list[fine].amount = coarse >= 0 ? offset % 32768 : MIN (offset, G_MAXINT16);
+  else if (offset % 32768)
+    /* a zone with the coarse offset alone needs a fine one for the rest */
+    insert_gen (layer, coarse, GEN_START_OFFSET, offset % 32768);
+}
+
+/* records for each key what the sample bank 0 program 0 plays there saved */
+static void
+map_keys (SFInfo * sf, gint32 * trims, gdouble saved_ms[128])
+{
+  SFPresetHdr *preset = NULL;
+  gint i, j, key;
+  gboolean assigned[128] = { FALSE };
+
+  for (i = 0; i < sf->npresets - 1; i++)
+    if (sf->preset[i].bank == 0 && sf->preset[i].preset == 0)
+      preset = &sf->preset[i];
+  if (preset == NULL)
+    return;
+  for (i = 0; i < preset->hdr.nlayers; i++)
+    {
+      SFGenLayer *player = &preset->hdr.layer[i];
+      gint prange = find_gen (player, SF_GEN_KEYRANGE, 0x7f00);
+      gint inst = (guint16) find_gen (player, SF_GEN_INSTRUMENT, -1);
+      if (inst >= sf->ninsts - 1)
+        continue;
+      for (j = 0; j < sf->inst[inst].hdr.nlayers; j++)
+        {
+          SFGenLayer *ilayer = &sf->inst[inst].hdr.layer[j];
+          gint irange = find_gen (ilayer, SF_GEN_KEYRANGE, 0x7f00);
+          gint sample = (guint16) find_gen (ilayer, SF_GEN_SAMPLEID, -1);
+          guint lo = MAX (SF_RANGE_LO (prange), SF_RANGE_LO (irange));
+          guint hi = MIN (SF_RANGE_HI (prange), SF_RANGE_HI (irange));
+          if (sample >= sf->nsamples - 1)
+            continue;
+          for (key = lo; key <= hi && key < 128; key++)
+            if (!assigned[key])
+              {
+                assigned[key] = TRUE;
+                saved_ms[key] = 1000.0 * trims[sample] / sf->sample[sample].samplerate;
+              }
+        }
+    }
+}
+
+gint
+sf_onset_trim (SFInfo * sf, FILE * fin, gdouble saved_ms[128])
+{
+  gint32 *trims;
+  gint i, j, moved = 0;
+
+  memset (saved_ms, 0, sizeof (gdouble) * 128);
+  if (sf->nsamples < 1)
+    return 0;
+  trims = g_malloc0 (sizeof (gint32) * sf->nsamples);
+  for (i = 0; i < sf->nsamples - 1; i++)
+    {
+      trims[i] = measure_silence (sf, fin, &sf->sample[i]);
+      if (trims[i] < 0)
+        {
+          g_free (trims);
+          return -1;
+        }
+    }
+  /* stereo partners must stay aligned, so they move by the smaller amount */
+  for (i = 0; i < sf->nsamples - 1; i++)
+    {
+      SFSampleInfo *sp = &sf->sample[i];
+      if ((sp->sampletype & (2 | 4 | 8)) && sp->samplelink < sf->nsamples - 1)
+        trims[i] = trims[sp->samplelink] = MIN (trims[i], trims[sp->samplelink]);
+    }
+
+  for (i = 0; i < sf->ninsts - 1; i++)
+    for (j = 0; j < sf->inst[i].hdr.nlayers; j++)
+      {
+        SFGenLayer *layer = &sf->inst[i].hdr.layer[j];
+        gint sample = (guint16) find_gen (layer, SF_GEN_SAMPLEID, -1);
+        if (sample < sf->nsamples - 1 && trims[sample] > 0)
+          correct_start_offset (layer, trims[sample]);
+      }
+  map_keys (sf, trims, saved_ms);
+  for (i = 0; i < sf->nsamples - 1; i++)
+    if (trims[i] > 0)
+      {
+        sf->sample[i].startsample += trims[i];
+        moved++;
+      }
+  g_free (trims);
+  return moved;
+}
@@ -0,0 +1,46 @@
+/*
+ * sfonset.h
+ * Onset detection and leading-silence trimming of SoundFont samples.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SFONSET_H
+#define SFONSET_H
+
+#include <stdio.h>
+#include <glib.h>
+#include "sffile.h"
+
+/**
+ * Level relative to a sample's peak at which its onset is taken to be.
+ */
+#define SF_ONSET_THRESHOLD_DB (-36.0)
+
+/**
+ * Time kept before the detected onset so the start of the transient
+ * survives.
+ */
+#define SF_ONSET_MARGIN_MS (2.0)
+
+/**
+ * Moves the start point of every sample of the loaded SoundFont forward to
+ * just before its onset. The start never moves past the loop start. Zones
+ * that offset the sample start are corrected for the samples that moved.
+ * The sample data is read from fin, which must be the file sf was loaded
+ * from; save_soundfont() then writes the trimmed copy.
+ *
+ * @param sf  the SoundFont, possibly already reduced with subset_soundfont()
+ * @param fin  the file sf was loaded from
+ * @param saved_ms  receives for each key the milliseconds of leading silence
+ *   removed from the sample bank 0 program 0 plays on it
+ * @return  the number of samples whose start moved, or -1 on a read error
+ */
+gint sf_onset_trim (SFInfo * sf, FILE * fin, gdouble saved_ms[128]);
+
+#endif // SFONSET_H
@@ -0,0 +1,540 @@
+/*
+ * sfresample.c
+ * Building SoundFonts resampled per key at the device rate.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "audio/sfresample.h"
+#include "sffile.h"
+
+/* the filter spans this many zero crossings of the sinc on each side */
+#define ZERO_CROSSINGS 16
+/* fractional positions the filter table is computed for */
+#define PHASES 256
+/* fraction of the Nyquist frequency passed */
+#define PASSBAND 0.97
+
+#define GEN_COUNT 61
+#define ROM_SAMPLE 0x8000
+#define LINKED_SAMPLE (2 | 4 | 8)
+
+/* generator operators (SF2.01 section 8.1.2) used here */
+enum
+{
+  GEN_START_OFFSET = 0,
+  GEN_END_OFFSET = 1,
+  GEN_STARTLOOP_OFFSET = 2,
+  GEN_ENDLOOP_OFFSET = 3,
+  GEN_START_COARSE_OFFSET = 4,
+  GEN_FILTER_FC = 8,
+  GEN_END_COARSE_OFFSET = 12,
+  GEN_VELRANGE = 44,
+  GEN_STARTLOOP_COARSE_OFFSET = 45,
+  GEN_KEYNUM = 46,
+  GEN_ENDLOOP_COARSE_OFFSET = 50,
+  GEN_COARSE_TUNE = 51,
+  GEN_FINE_TUNE = 52,
+  GEN_SCALE_TUNING = 56,
+  GEN_ROOT_KEY = 58,
+};
+
+/* the effective generators of a zone */
+typedef struct zone_gens
+{
+  gint amount[GEN_COUNT];
+  gboolean set[GEN_COUNT];
+} zone_gens;
+
+typedef struct sinc_filter
+{
+  gint half;                    /* taps on each side of the position */
+  gfloat *table;                /* (PHASES + 1) rows of 2 * half taps */
+} sinc_filter;
+
+/* the sample data of the source, read on demand */
+typedef struct source_data
+{
+  SFInfo *sf;
+  FILE *fp;
+  gint16 **samples;
+} source_data;
+
+/* a sample of the bank being built */
+typedef struct bank_sample
+{
+  gint source;
+  SFSampleInfo info;
+} bank_sample;
+
+static gint
+gen_default (gint oper)
+{
+  switch (oper)
+    {
+    case GEN_FILTER_FC:
+      return 13500;
+    case 21: case 23: case 25: case 26: case 27: case 28: case 30:
+    case 33: case 34: case 35: case 36: case 38:
+      return -12000;            /* envelope and LFO times */
+    case SF_GEN_KEYRANGE:
+    case GEN_VELRANGE:
+      return 0x7f00;
+    case GEN_SCALE_TUNING:
+      return 100;
+    case GEN_KEYNUM:
+    case 47:
+    case GEN_ROOT_KEY:
+      return -1;
+    default:
+      return 0;
+    }
+}
+
+/* generators that are not allowed at preset level or are unused */
+static gboolean
+instrument_only (gint oper)
+{
+  switch (oper)
+    {
+    case 0: case 1: case 2: case 3: case 4: case 12: case 45: case 50:
+    case 46: case 47: case 54: case 57: case 58:
+    case 14: case 18: case 19: case 20: case 42: case 49: case 55: case 59: case 60:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+/* generators that are baked into the sample or set per key */
+static gboolean
+baked (gint oper)
+{
+  switch (oper)
+    {
+    case 0: case 1: case 2: case 3: case 4: case 12: case 45: case 50:
+    case SF_GEN_INSTRUMENT: case SF_GEN_KEYRANGE: case GEN_VELRANGE:
+    case GEN_KEYNUM: case GEN_COARSE_TUNE: case GEN_FINE_TUNE:
+    case SF_GEN_SAMPLEID: case GEN_SCALE_TUNING: case GEN_ROOT_KEY:
+      return TRUE;
+    default:
+      return instrument_only (oper) && oper != 54 && oper != 57 && oper != 47;
+    }
+}
+
+static void
+apply_layer (zone_gens * z, SFGenLayer * layer)
+{
+  gint i;
+  for (i = 0; i < layer->nlists; i++)
+    if (layer->list[i].oper >= 0 && layer->list[i].oper < GEN_COUNT)
+      {
+        gint oper = layer->list[i].oper;
+        /* ranges and indices are unsigned */
+        if (oper == SF_GEN_KEYRANGE || oper == GEN_VELRANGE || oper == SF_GEN_INSTRUMENT || oper == SF_GEN_SAMPLEID)
+          z->amount[oper] = (guint16) layer->list[i].amount;
+        else
+          z->amount[oper] = layer->list[i].amount;
+        z->set[oper] = TRUE;
+      }
+}
+
+static gint
+get_gen (zone_gens * z, gint oper)
+{
+  return z->set[oper] ? z->amount[oper] : gen_default (oper);
+}
+
+/* fills z with the generators of zone n of hdr, the global zone included;
+ * returns FALSE if n is the global zone */
+static gboolean
+get_zone (SFHeader * hdr, gint n, gint index_oper, zone_gens * z)
+{
+  memset (z, 0, sizeof (zone_gens));
+  apply_layer (z, &hdr->layer[n]);
+  if (!z->set[index_oper])
+    return FALSE;
+  if (n > 0)
+    {
+      zone_gens global;
+      gint i;
+      memset (&global, 0, sizeof (zone_gens));
+      apply_layer (&global, &hdr->layer[0]);
+      if (!global.set[index_oper])
+        for (i = 0; i < GEN_COUNT; i++)
+          if (global.set[i] && !z->set[i])
+            {
+              z->amount[i] = global.amount[i];
+              z->set[i] = TRUE;
+            }
+    }
+  return TRUE;
+}
+
+static gboolean
+in_range (gint range, gint key)
+{
+  return key >= SF_RANGE_LO (range) && key <= SF_RANGE_HI (range);
+}
+
+static gint
+intersect_ranges (gint a, gint b)
+{
+  gint lo = MAX (SF_RANGE_LO (a), SF_RANGE_LO (b));
+  gint hi = MIN (SF_RANGE_HI (a), SF_RANGE_HI (b));
+  return (hi << 8) | lo;
+}
+
+static void
+make_filter (sinc_filter * f, gdouble ratio)
+{
+  gdouble cutoff = PASSBAND / MAX (1.0, ratio);
+  gint p, k, taps;
+  f->half = (gint) ceil (ZERO_CROSSINGS / cutoff);
+  taps = 2 * f->half;
+  f->table = g_malloc (sizeof (gfloat) * (PHASES + 1) * taps);
+  for (p = 0; p <= PHASES; p++)
+    for (k = 0; k < taps; k++)
+      {
+        /* distance of tap k from the read position */
+        gdouble x = k - f->half + 1 - (gdouble) p / PHASES;
+        gdouble w = x / f->half;
+        gdouble h = 0.0;
+        if (fabs (w) < 1.0)
+          {
+            /* Blackman window */
+            w = 0.42 + 0.5 * cos (G_PI * w) + 0.08 * cos (2 * G_PI * w);
+            h = cutoff * w * (x == 0.0 ? 1.0 : sin (G_PI * cutoff * x) / (G_PI * cutoff * x));
+          }
+        f->table[p * taps + k] = (gfloat) h;
+      }
+}
+
+static gint16 *
+get_source_sample (source_data * src, gint n)
+{
+  SFSampleInfo *sp = &src->sf->sample[n];
+  glong frames = sp->endsample - sp->startsample;
+  if (src->samples[n])
+    return src->samples[n];
+  if ((sp->sampletype & ROM_SAMPLE) || frames <= 0 || (sp->startsample + frames) * 2L > src->sf->samplesize)
+    return NULL;
+  src->samples[n] = g_malloc (frames * 2);
+  if (fseek (src->fp, src->sf->samplepos + sp->startsample * 2L, SEEK_SET) < 0 || fread (src->samples[n], 2, frames, src->fp) != (size_t) frames)
+    {
+      g_free (src->samples[n]);
+      src->samples[n] = NULL;
+    }
+  return src->samples[n];
+}
+
+/* resamples frames [start, end) of data so that output frame t comes from
+ * position start + t * ratio; writes the result to out and returns the
+ * number of frames written, or -1 on a write error */
+static glong
+resample (gint16 const *data, glong start, glong end, gdouble ratio, FILE * out)
+{
+  sinc_filter f;
+  glong frames = (glong) ((end - start - 1) / ratio) + 1, t;
+  gint16 block[1024];
+  gint n = 0, taps;
+
+  make_filter (&f, ratio);
+  taps = 2 * f.half;
+  for (t = 0; t < frames; t++)
+    {
+      gdouble pos = start + t * ratio, a, y = 0.0;
+      glong i0 = (glong) floor (pos);
+      gdouble phase = (pos - i0) * PHASES;
+      gint p = (gint) phase, k;
+      gfloat *row0 = f.table + p * taps, *row1 = row0 + taps;
+      a = phase - p;
+      for (k = 0; k < taps; k++)
+        {
+          glong i = i0 + k - f.half + 1;
+          if (i >= start && i < end)
+            y += data[i] * ((1.0 - a) * row0[k] + a * row1[k]);
+        }
+      block[n++] = (gint16) CLAMP (lrint (y), -32768, 32767);
+      if (n == G_N_ELEMENTS (block) || t == frames - 1)
+        {
+          if (fwrite (block, 2, n, out) != (size_t) n)
+            {
+              g_free (f.table);
+              return -1;
+            }
+          n = 0;
+        }
+    }
+  g_free (f.table);
+  return frames;
+}
+
+/* adds the instrument zone playing key to the bank: writes the resampled
+ * sample data to raw at frame *pos and appends the zone's generators */
+static gboolean
+add_key_zone (source_data * src, zone_gens * pz, zone_gens * iz, gint key, gdouble cents, guint rate, FILE * raw, glong * pos, GArray * samples, GArray * gens, GArray * layers)
+{
+  SFInfo *sf = src->sf;
+  gint sample = iz->amount[SF_GEN_SAMPLEID];
+  SFSampleInfo *sp = &sf->sample[sample];
+  gint16 *data = get_source_sample (src, sample);
+  gint root = get_gen (iz, GEN_ROOT_KEY), oper, first;
+  glong start, end, startloop, endloop, loop, frames;
+  gdouble pitch, ratio;
+  bank_sample bs;
+  SFGenRec rec;
+  SFGenLayer layer;
+
+  if (data == NULL)
+    return FALSE;
+  if (root < 0)
+    root = sp->originalPitch > 127 ? 60 : sp->originalPitch;
+
+  /* everything that sets the pitch of the key goes into the ratio */
+  pitch = (get_gen (iz, GEN_SCALE_TUNING) + (pz->set[GEN_SCALE_TUNING] ? pz->amount[GEN_SCALE_TUNING] : 0)) * (key - root)
+    + 100 * (get_gen (iz, GEN_COARSE_TUNE) + get_gen (pz, GEN_COARSE_TUNE))
+    + get_gen (iz, GEN_FINE_TUNE) + get_gen (pz, GEN_FINE_TUNE) + (gchar) sp->pitchCorrection + cents;
+  ratio = pow (2.0, pitch / 1200.0) * sp->samplerate / rate;
+
+  /* sample addresses relative to the sample's data */
+  start = get_gen (iz, GEN_START_OFFSET) + 32768L * get_gen (iz, GEN_START_COARSE_OFFSET);
+  end = sp->endsample - sp->startsample + get_gen (iz, GEN_END_OFFSET) + 32768L * get_gen (iz, GEN_END_COARSE_OFFSET);
+  startloop = sp->startloop - sp->startsample + get_gen (iz, GEN_STARTLOOP_OFFSET) + 32768L * get_gen (iz, GEN_STARTLOOP_COARSE_OFFSET);
+  endloop = sp->endloop - sp->startsample + get_gen (iz, GEN_ENDLOOP_OFFSET) + 32768L * get_gen (iz, GEN_ENDLOOP_COARSE_OFFSET);
+  start = CLAMP (start, 0, sp->endsample - sp->startsample);
+  end = CLAMP (end, start, sp->endsample - sp->startsample);
+  if (end - start < 2 || ratio <= 0.0)
+    return FALSE;
+
+  frames = resample (data, start, end, ratio, raw);
+  if (frames < 0)
+    return FALSE;
+
+  memset (&bs, 0, sizeof (bs));
+  bs.source = sample;
+  g_snprintf (bs.info.name, sizeof (bs.info.name), "%.14s %d", sp->name, key);
+  bs.info.startsample = *pos;
+  bs.info.endsample = *pos + frames;
+  /* the loop length is rounded to whole frames by itself, so that the
+   * rounding of where the loop starts does not change it */
+  loop = lrint ((endloop - startloop) / ratio);
+  startloop = lrint ((startloop - start) / ratio);
+  endloop = startloop + loop;
+  bs.info.startloop = *pos + CLAMP (startloop, 0, frames);
+  bs.info.endloop = *pos + CLAMP (endloop, 0, frames);
+  bs.info.samplerate = rate;
+  bs.info.originalPitch = key;
+  bs.info.pitchCorrection = 0;
+  bs.info.sampletype = sp->sampletype;
+  *pos += frames;
+  g_array_append_val (samples, bs);
+
+  /* keyRange and velRange come first, sampleID last */
+  first = gens->len;
+  rec.oper = SF_GEN_KEYRANGE;
+  rec.amount = (key << 8) | key;
+  g_array_append_val (gens, rec);
+  rec.oper = GEN_VELRANGE;
+  rec.amount = intersect_ranges (get_gen (iz, GEN_VELRANGE), get_gen (pz, GEN_VELRANGE));
+  g_array_append_val (gens, rec);
+  for (oper = 0; oper < GEN_COUNT; oper++)
+    {
+      gint amount = get_gen (iz, oper);
+      gboolean set = iz->set[oper];
+      if (baked (oper))
+        continue;
+      /* preset generators add to the instrument's */
+      if (pz->set[oper] && !instrument_only (oper))
+        {
+          amount += pz->amount[oper];
+          set = TRUE;
+        }
+      if (set)
+        {
+          rec.oper = oper;
+          rec.amount = amount;
+          g_array_append_val (gens, rec);
+        }
+    }
+  rec.oper = GEN_ROOT_KEY;
+  rec.amount = key;
+  g_array_append_val (gens, rec);
+  rec.oper = SF_GEN_SAMPLEID;
+  rec.amount = samples->len - 1;
+  g_array_append_val (gens, rec);
+
+  layer.nlists = gens->len - first;
+  layer.list = GINT_TO_POINTER (first);   /* turned into a pointer when gens is complete */
+  layer.nmods = 0;
+  layer.mods = NULL;
+  g_array_append_val (layers, layer);
+  return TRUE;
+}
+
+/* links the stereo partners among the samples made for one key, from index first */
+static void
+link_key_samples (SFInfo * sf, GArray * samples, guint first)
+{
+  guint i, j;
+  for (i = first; i < samples->len; i++)
+    {
+      bank_sample *a = &g_array_index (samples, bank_sample, i);
+      if (!(a->info.sampletype & LINKED_SAMPLE))
+        continue;
+      a->info.sampletype = 1;   /* mono unless its partner is here too */
+      for (j = first; j < samples->len; j++)
+        if (g_array_index (samples, bank_sample, j).source == sf->sample[a->source].samplelink)
+          {
+            a->info.sampletype = sf->sample[a->source].sampletype;
+            a->info.samplelink = j;
+            break;
+          }
+    }
+}
+
+/* writes the bank described by the arrays, the sample data coming from raw */
+static gint
+write_bank (gchar const *dest, FILE * raw, glong frames, GArray * samples, GArray * gens, GArray * layers)
+{
+  SFInfo bank;
+  SFPresetHdr preset[2];
+  SFInstHdr inst[2];
+  SFGenLayer player;
+  SFGenRec prec;
+  gint ret = -1;
+  guint i;
+  gchar *tmp;
+  FILE *fout;
+
+  memset (&bank, 0, sizeof (bank));
+  memset (preset, 0, sizeof (preset));
+  memset (inst, 0, sizeof (inst));
+  bank.version = 2;
+  bank.minorversion = 1;
+  bank.samplepos = 0;
+  bank.samplesize = frames * 2;
+
+  prec.oper = SF_GEN_INSTRUMENT;
+  prec.amount = 0;
+  player.nlists = 1;
+  player.list = &prec;
+  player.nmods = 0;
+  player.mods = NULL;
+  strncpy (preset[0].hdr.name, "Harpsichord", sizeof (preset[0].hdr.name));
+  preset[0].hdr.nlayers = 1;
+  preset[0].hdr.layer = &player;
+  strncpy (preset[1].hdr.name, "EOP", sizeof (preset[1].hdr.name));
+  bank.npresets = 2;
+  bank.preset = preset;
+
+  for (i = 0; i < layers->len; i++)
+    {
+      SFGenLayer *layer = &g_array_index (layers, SFGenLayer, i);
+      layer->list = &g_array_index (gens, SFGenRec, GPOINTER_TO_INT (layer->list));
+    }
+  strncpy (inst[0].hdr.name, "Harpsichord", sizeof (inst[0].hdr.name));
+  inst[0].hdr.nlayers = layers->len;
+  inst[0].hdr.layer = (SFGenLayer *) layers->data;
+  strncpy (inst[1].hdr.name, "EOI", sizeof (inst[1].hdr.name));
+  bank.ninsts = 2;
+  bank.inst = inst;
+
+  bank.nsamples = samples->len + 1;
+  bank.sample = g_malloc0 (sizeof (SFSampleInfo) * bank.nsamples);
+  for (i = 0; i < samples->len; i++)
+    bank.sample[i] = g_array_index (samples, bank_sample, i).info;
+  strncpy (bank.sample[samples->len].name, "EOS", sizeof (bank.sample[0].name));
+
+  tmp = g_strconcat (dest, ".part", NULL);
+  fout = fopen (tmp, "wb");
+  if (fout)
+    {
+      ret = save_soundfont (&bank, raw, fout);
+      if (fclose (fout))
+        ret = -1;
+      if (ret == 0 && g_rename (tmp, dest))
+        ret = -1;
+      if (ret)
+        g_remove (tmp);
+    }
+  g_free (tmp);
+  g_free (bank.sample);
+  return ret;
+}
+
+gint
+sf_resample_bank (gchar const *source, gchar const *dest, guint rate, gdouble const key_cents[128])
+{
+  SFInfo sf;
+  SFPresetHdr *preset = NULL;
+  source_data src;
+  GArray *samples, *gens, *layers;
+  FILE *raw;
+  glong pos = 0;
+  gint ret = -1, key, i, j;
+
+  memset (&sf, 0, sizeof (sf));
+  src.sf = &sf;
+  src.fp = fopen (source, "rb");
+  if (src.fp == NULL)
+    return -1;
+  raw = tmpfile ();
+  if (raw == NULL || load_soundfont (&sf, src.fp, TRUE))
+    {
+      if (raw)
+        fclose (raw);
+      fclose (src.fp);
+      return -1;
+    }
+  for (i = 0; i < sf.npresets - 1; i++)
+    if (sf.preset[i].bank == 0 && sf.preset[i].preset == 0)
+      preset = &sf.preset[i];
+  src.samples = g_malloc0 (sizeof (gint16 *) * MAX (sf.nsamples, 1));
+  samples = g_array_new (FALSE, FALSE, sizeof (bank_sample));
+  gens = g_array_new (FALSE, FALSE, sizeof (SFGenRec));
+  layers = g_array_new (FALSE, FALSE, sizeof (SFGenLayer));
+
+  for (key = 0; preset && key < 128; key++)
+    {
+      guint first = samples->len;
+      for (i = 0; i < preset->hdr.nlayers; i++)
+        {
+          zone_gens pz, iz;
+          SFHeader *ihdr;
+          if (!get_zone (&preset->hdr, i, SF_GEN_INSTRUMENT, &pz) || !in_range (get_gen (&pz, SF_GEN_KEYRANGE), key))
+            continue;
+          if (pz.amount[SF_GEN_INSTRUMENT] >= sf.ninsts - 1)
+            continue;
+          ihdr = &sf.inst[pz.amount[SF_GEN_INSTRUMENT]].hdr;
+          for (j = 0; j < ihdr->nlayers; j++)
+            if (get_zone (ihdr, j, SF_GEN_SAMPLEID, &iz) && in_range (get_gen (&iz, SF_GEN_KEYRANGE), key) && iz.amount[SF_GEN_SAMPLEID] < sf.nsamples - 1)
+              add_key_zone (&src, &pz, &iz, key, key_cents[key], rate, raw, &pos, samples, gens, layers);
+        }
+      link_key_samples (&sf, samples, first);
+    }
+
+  if (samples->len > 0 && fflush (raw) == 0)
+    ret = write_bank (dest, raw, pos, samples, gens, layers);
+
+  for (i = 0; i < sf.nsamples; i++)
+    g_free (src.samples[i]);
+  g_free (src.samples);
+  g_array_free (samples, TRUE);
+  g_array_free (gens, TRUE);
+  g_array_free (layers, TRUE);
+  free_soundfont (&sf);
+  fclose (raw);
+  fclose (src.fp);
+  return ret;
+}
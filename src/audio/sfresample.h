@@ -0,0 +1,37 @@
+/*
+ * sfresample.h
+ * Building SoundFonts resampled per key at the device rate.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SFRESAMPLE_H
+#define SFRESAMPLE_H
+
+#include <glib.h>
+
+/**
+ * Writes a SoundFont in which bank 0 program 0 of source has one sample
+ * per key, resampled with a windowed-sinc polyphase filter so that it plays
+ * at exactly the key's tempered pitch at the given output rate. The synth
+ * then steps through the samples one frame per frame and needs neither
+ * interpolation nor tuning. The pitch generators of the source are baked
+ * into the samples; the others are carried over to the per-key zones.
+ *
+ * This takes seconds and is meant to be run off the audio and GUI threads.
+ *
+ * @param source  the SoundFont to resample
+ * @param dest  the file to write
+ * @param rate  the output sample rate of the synth
+ * @param key_cents  for each synth key, the deviation from equal
+ *   temperament in cents to build in
+ * @return  0 on success, -1 on failure
+ */
+gint sf_resample_bank (gchar const *source, gchar const *dest, guint rate, gdouble const key_cents[128]);
+
+#endif // SFRESAMPLE_H
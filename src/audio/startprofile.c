@@ -0,0 +1,184 @@
+/*
+ * startprofile.c
+ * Timing the phases of startup, with the page faults and memory each costs.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+#include "audio/startprofile.h"
+
+#define MAX_PHASES (64)
+#define MAX_DEPTH (8)
+
+typedef struct usage
+{
+  gint64 time;                  /* us */
+  glong minor_faults;
+  glong major_faults;
+  glong rss;                    /* KB */
+} usage;
+
+typedef struct phase
+{
+  gchar const *name;
+  gint depth;
+  usage begin;
+  usage end;
+} phase;
+
+static phase phases[MAX_PHASES];
+static gint count = 0;
+static gint open_phases[MAX_DEPTH];
+static gint depth = 0;
+
+static void
+get_usage (usage * u)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+  struct rusage ru;
+#endif
+  u->time = g_get_monotonic_time ();
+  u->minor_faults = u->major_faults = u->rss = 0;
+#ifdef HAVE_SYS_RESOURCE_H
+  if (getrusage (RUSAGE_SELF, &ru) == 0)
+    {
+      u->minor_faults = ru.ru_minflt;
+      u->major_faults = ru.ru_majflt;
+      /* the peak, where the current size is not to be had */
+      u->rss = ru.ru_maxrss;
+    }
+#endif
+#ifdef __linux__
+  {
+    FILE *fp = fopen ("/proc/self/statm", "r");
+    glong size, resident;
+    if (fp)
+      {
+        if (fscanf (fp, "%ld %ld", &size, &resident) == 2)
+          u->rss = resident * (sysconf (_SC_PAGESIZE) / 1024);
+        fclose (fp);
+      }
+  }
+#endif
+}
+
+void
+startup_phase_begin (gchar const *name)
+{
+  phase *p;
+  if (count == MAX_PHASES || depth == MAX_DEPTH)
+    {
+      /* still to be matched by its end */
+      if (depth < MAX_DEPTH)
+        open_phases[depth] = -1;
+      depth++;
+      return;
+    }
+  p = &phases[count];
+  p->name = name;
+  p->depth = depth;
+  get_usage (&p->begin);
+  p->end.time = 0;
+  open_phases[depth++] = count++;
+}
+
+void
+startup_phase_end (void)
+{
+  if (depth == 0)
+    return;
+  depth--;
+  if (depth < MAX_DEPTH && open_phases[depth] >= 0)
+    {
+      get_usage (&phases[open_phases[depth]].end);
+      open_phases[depth] = -1;
+    }
+}
+
+static void
+end_all (void)
+{
+  while (depth)
+    startup_phase_end ();
+}
+
+/* the time of the phase not taken by its sub-phases, in us */
+static gint64
+self_time (gint n)
+{
+  gint64 t = phases[n].end.time - phases[n].begin.time;
+  gint i;
+  for (i = n + 1; i < count && phases[i].depth > phases[n].depth; i++)
+    if (phases[i].depth == phases[n].depth + 1)
+      t -= phases[i].end.time - phases[i].begin.time;
+  return t;
+}
+
+/* the span from the first phase to the end of the last at the top level */
+static gint64
+total_time (void)
+{
+  gint64 end = 0;
+  gint i;
+  for (i = 0; i < count; i++)
+    end = MAX (end, phases[i].end.time);
+  return count ? end - phases[0].begin.time : 0;
+}
+
+void
+startup_profile_print (void)
+{
+  gint i;
+  end_all ();
+  g_print ("Startup took %.1f ms\n", total_time () / 1000.0);
+  g_print ("%-36s %9s %9s %8s %8s %9s\n", "phase", "ms", "self ms", "minflt", "majflt", "RSS +KB");
+  for (i = 0; i < count; i++)
+    {
+      phase *p = &phases[i];
+      g_print ("%*s%-*s %9.1f %9.1f %8ld %8ld %9ld\n", 2 * p->depth, "", 36 - 2 * p->depth, p->name,
+               (p->end.time - p->begin.time) / 1000.0, self_time (i) / 1000.0, p->end.minor_faults - p->begin.minor_faults,
+               p->end.major_faults - p->begin.major_faults, p->end.rss - p->begin.rss);
+    }
+}
+
+gboolean
+startup_profile_write_json (gchar const *filename)
+{
+  FILE *fp = g_fopen (filename, "w");
+  gint i;
+  if (fp == NULL)
+    {
+      g_warning ("Could not write the startup profile to %s", filename);
+      return FALSE;
+    }
+  end_all ();
+  fprintf (fp, "{\"total_ms\": %.3f, \"phases\": [", total_time () / 1000.0);
+  for (i = 0; i < count; i++)
+    {
+      phase *p = &phases[i];
+      fprintf (fp,
+               "%s\n{\"name\": \"%s\", \"depth\": %d, \"start_ms\": %.3f, \"ms\": %.3f, \"self_ms\": %.3f, "
+               "\"minor_faults\": %ld, \"major_faults\": %ld, \"rss_growth_kb\": %ld}",
+               i ? "," : "", p->name, p->depth, (p->begin.time - phases[0].begin.time) / 1000.0,
+               (p->end.time - p->begin.time) / 1000.0, self_time (i) / 1000.0, p->end.minor_faults - p->begin.minor_faults,
+               p->end.major_faults - p->begin.major_faults, p->end.rss - p->begin.rss);
+    }
+  fprintf (fp, "\n]}\n");
+  fclose (fp);
+  g_message ("Startup profile written to %s", filename);
+  return TRUE;
+}
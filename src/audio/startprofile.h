@@ -0,0 +1,41 @@
+/*
+ * startprofile.h
+ * Timing the phases of startup, with the page faults and memory each costs.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef STARTPROFILE_H
+#define STARTPROFILE_H
+
+#include <glib.h>
+
+/**
+ * Marks the start and end of a phase of startup on the main thread. Phases
+ * begun inside another are its sub-phases; each must be ended before the
+ * one around it. The name must be a string literal. Phases are always
+ * recorded, which costs a few microseconds each, so that those before the
+ * command line is parsed are not missed.
+ */
+void startup_phase_begin (gchar const *name);
+void startup_phase_end (void);
+
+/**
+ * Prints the time, page faults and growth of the resident set of each
+ * phase, ending those still open.
+ */
+void startup_profile_print (void);
+
+/**
+ * Writes the same as JSON.
+ *
+ * @return  FALSE if the file could not be written
+ */
+gboolean startup_profile_write_json (gchar const *filename);
+
+#endif // STARTPROFILE_H
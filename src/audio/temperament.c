@@ -24,6 +24,9 @@
 #include "historicHarpsichord/historicHarpsichord.h"
 #include "audio/midi.h"
 #include "audio/audiointerface.h"
+#include "audio/fluid.h"
+#include "audio/tuning.h"
+#include "audio/scala.h"
 
 typedef struct notespec
 {
@@ -46,10 +49,11 @@ typedef struct temperament
   gint unusedsharp;             /* which notepitch is the sharpest in circle of 5ths - initially G# */
   gint unusedflat;              /* which notepitch is the flattest in circle of 5ths - initially Eb */
   notepitch notepitches[12];    /* pitches of C-natural, C#, ... A#, B-natural */
+  gdouble *key_pitch;           /* for temperaments from Scala files, the pitch of every key at modern pitch, see tuning_build_table() */
 } temperament;
 
 
-static gint temperament_offset = 0;     /* shift in temperament around circle of 5ths, not currently used */
+static gint temperament_offset = 0;     /* semitones the temperament is moved round by, see tuning_build_table(); not currently used */
 
 static temperament Pythagorean = {
   "Pythagorean", 8, 3,
@@ -242,26 +246,70 @@ static temperament *PR_temperament = &Equal;    /* the currently used temperamen
 
 static temperament *temperaments[] = { &Equal, &Meantone, &WerckmeisterIII,  &WerckmeisterIV, &Lehman, &Rameau, &Pythagorean, &SilbermannII, &SilbermannI, &VanZwolle};
 
-/* return an array of values representing deviations from equal temperament for 12 notes from C for the passed temperament. Returned value is read only */
-static gdouble *
-get_cents (temperament * t)
+/* fill cents with the deviations from equal temperament of the 12 notes from C for the passed temperament */
+static void
+get_cents (temperament * t, gdouble cents[12])
 {
-  static gdouble array[12];
-  int i, j;
+  int i;
   for (i = 0; i < 12; i++)
+    cents[i] = 1200 * log2 (t->notepitches[i].pitch / Equal.notepitches[i].pitch);
+}
+
+/* fill pitch with the current temperament at the current pitch standard, see tuning_build_table()
+ * and tuning_move_table() */
+static void
+get_key_pitches (gdouble pitch[128])
+{
+  gdouble cents[12];
+  if (PR_temperament->key_pitch)
     {
-      j = (i + temperament_offset) % 12;
-      //g_print("cents tempered %d to %d unshifted %f shifted %f\n", i, j, 1200 * log2(t->notepitches[i].pitch/Equal.notepitches[i].pitch), 1200 * log2(t->notepitches[j].pitch/Equal.notepitches[j].pitch));
-      array[i] = 1200 * log2 (t->notepitches[j].pitch / Equal.notepitches[j].pitch);
+      tuning_move_table (PR_temperament->key_pitch, temperament_offset, tuning_get_pitch_standard (), pitch);
+      return;
     }
-  return array;
+  get_cents (PR_temperament, cents);
+  tuning_build_table (cents, temperament_offset, tuning_get_pitch_standard (), pitch);
 }
 
+/* return the temperaments of the user's Scala files; the pitches of C4 to B4 stand in for the notepitches */
+static GList *
+get_scala_temperaments (void)
+{
+  GList *tunings = scala_get_tunings ();
+  GList *ret = NULL, *g;
+  for (g = tunings; g; g = g->next)
+    {
+      scala_tuning_t *tuning = g->data;
+      temperament *t = g_malloc0 (sizeof (temperament));
+      gint i;
+      t->name = g_strdup (tuning->name);
+      t->key_pitch = g_new (gdouble, 128);
+      memcpy (t->key_pitch, tuning->pitch, 128 * sizeof (gdouble));
+      for (i = 0; i < 12; i++)
+        t->notepitches[i].pitch = TUNING_MODERN_PITCH * pow (2.0, (tuning->pitch[60 + i] - 6900.0) / 1200.0);
+      ret = g_list_append (ret, t);
+    }
+  g_list_free (tunings);
+  return ret;
+}
 
 void
 set_tuning (void)
 {
-  change_tuning (get_cents (PR_temperament));
+#ifdef _HAVE_FLUIDSYNTH_
+  gdouble pitch[128];
+  get_key_pitches (pitch);
+  fluidsynth_set_key_tuning (pitch);
+#endif
+}
+
+void
+request_tempered_bank (void)
+{
+#ifdef _HAVE_FLUIDSYNTH_
+  gdouble pitch[128];
+  get_key_pitches (pitch);
+  fluidsynth_request_resampled_bank (pitch);
+#endif
 }
 
 #define COLUMN_NAME (0)
@@ -274,6 +322,7 @@ temperament_changed_callback (GtkComboBox * combobox, GtkListStore * list_store)
   gtk_combo_box_get_active_iter (GTK_COMBO_BOX (combobox), &iter);
   gtk_tree_model_get (GTK_TREE_MODEL (list_store), &iter, COLUMN_PTR, &PR_temperament, -1);
   set_tuning ();                //note synth may not be attached...
+  request_tempered_bank ();
   g_string_assign (HistoricHarpsichord.prefs.temperament, PR_temperament->name);
 }
 
@@ -290,19 +339,32 @@ get_temperament_combo (void)
       gtk_widget_set_tooltip_text (combobox, _("Set the musical temperament (tuning) to be used for playback."));
       g_object_ref (combobox);
       PR_temperament = &Equal;
+      GList *scala = get_scala_temperaments ();
+      GList *g = scala;
+      gint n = G_N_ELEMENTS (temperaments) + g_list_length (scala);
       int i;
-      for (i = 0; i < (gint) G_N_ELEMENTS (temperaments); i++)
+      for (i = 0; i < n; i++)
         {
           GtkTreeIter iter;
+          temperament *t;
+          if (i < (gint) G_N_ELEMENTS (temperaments))
+            t = temperaments[i];
+          else
+            {
+              t = g->data;
+              g = g->next;
+            }
           gtk_list_store_append (list_store, &iter);
-          gtk_list_store_set (list_store, &iter, COLUMN_NAME, temperaments[i]->name, COLUMN_PTR, temperaments[i], -1);
+          gtk_list_store_set (list_store, &iter, COLUMN_NAME, t->name, COLUMN_PTR, t, -1);
 
-          if ((i == 0) || (HistoricHarpsichord.prefs.temperament && !strcmp (HistoricHarpsichord.prefs.temperament->str, temperaments[i]->name)))
+          if ((i == 0) || (HistoricHarpsichord.prefs.temperament && !strcmp (HistoricHarpsichord.prefs.temperament->str, t->name)))
             {
               gtk_combo_box_set_active_iter (GTK_COMBO_BOX (combobox), &iter);
-              PR_temperament = temperaments[i];
+              PR_temperament = t;
             }
         }
+      /* the Scala temperaments live as long as the combo box */
+      g_list_free (scala);
       renderer = gtk_cell_renderer_text_new ();
       gtk_cell_layout_pack_start (GTK_CELL_LAYOUT (combobox), renderer, TRUE);
       gtk_cell_layout_add_attribute (GTK_CELL_LAYOUT (combobox), renderer, "text", COLUMN_NAME);
@@ -25,6 +25,10 @@
 
 GtkWidget *get_temperament_combo (void);
 
+/* retunes the synth to the current temperament and pitch standard */
 void set_tuning (void);
 
+/* asks the synth for samples resampled to the current temperament, if it is set up for that */
+void request_tempered_bank (void);
+
 #endif //TEMPERAMENT_H
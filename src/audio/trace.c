@@ -0,0 +1,159 @@
+/*
+ * trace.c
+ * A timeline of what each thread does, for finding where a key press stalls.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <signal.h>
+#include "audio/trace.h"
+
+/* the threads that can be traced, and the events each keeps, a power of two */
+#define TRACE_THREADS (8)
+#define TRACE_EVENTS (32768)
+
+typedef struct trace_event
+{
+  gchar const *name;
+  gint64 time;
+  gchar phase;
+} trace_event;
+
+/* written by one thread only, read when dumping */
+typedef struct trace_buffer
+{
+  gchar const *first;           /* the first tracepoint the thread passed, to name it by */
+  guint count;                  /* the events ever recorded */
+  trace_event events[TRACE_EVENTS];
+} trace_buffer;
+
+gboolean trace_on = FALSE;
+
+static gchar *trace_filename;
+static gint64 start_time;
+static trace_buffer *buffers;
+static gint claimed;
+static GPrivate thread_buffer;
+/* stands for the buffer of a thread that came after all were claimed */
+static trace_buffer untraced;
+static volatile sig_atomic_t dump_requested = FALSE;
+
+/* the calling thread's buffer, claimed on its first tracepoint */
+static trace_buffer *
+get_buffer (gchar const *name)
+{
+  trace_buffer *buffer = g_private_get (&thread_buffer);
+  if (buffer == NULL)
+    {
+      gint n = g_atomic_int_add (&claimed, 1);
+      buffer = n < TRACE_THREADS ? &buffers[n] : &untraced;
+      if (buffer != &untraced)
+        buffer->first = name;
+      g_private_set (&thread_buffer, buffer);
+    }
+  return buffer;
+}
+
+void
+trace_record (gchar const *name, gchar phase)
+{
+  trace_buffer *buffer = get_buffer (name);
+  trace_event *event;
+  guint count;
+  if (buffer == &untraced)
+    return;
+  count = buffer->count;
+  event = &buffer->events[count % TRACE_EVENTS];
+  event->name = name;
+  event->time = g_get_monotonic_time ();
+  event->phase = phase;
+  g_atomic_int_set (&buffer->count, count + 1);
+}
+
+gboolean
+trace_dump (void)
+{
+  FILE *fp = g_fopen (trace_filename, "w");
+  gboolean first = TRUE;
+  gint n, claims = MIN (g_atomic_int_get (&claimed), TRACE_THREADS);
+  if (fp == NULL)
+    {
+      g_warning ("Could not write the trace to %s", trace_filename);
+      return FALSE;
+    }
+  fprintf (fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  for (n = 0; n < claims; n++)
+    {
+      trace_buffer *buffer = &buffers[n];
+      guint count = g_atomic_int_get (&buffer->count), i;
+      /* leave out the oldest events, which the thread may be overwriting */
+      guint from = count > TRACE_EVENTS / 2 ? count - TRACE_EVENTS / 2 : 0;
+      fprintf (fp, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+               first ? "" : ",", n + 1, buffer->first ? buffer->first : "?");
+      first = FALSE;
+      for (i = from; i != count; i++)
+        {
+          trace_event *event = &buffer->events[i % TRACE_EVENTS];
+          fprintf (fp, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %" G_GINT64_FORMAT ", \"pid\": 1, \"tid\": %d}",
+                   event->name, event->phase, event->time - start_time, n + 1);
+        }
+    }
+  fprintf (fp, "\n]}\n");
+  fclose (fp);
+  g_message ("Trace written to %s", trace_filename);
+  return TRUE;
+}
+
+static void
+dump_at_exit (void)
+{
+  trace_dump ();
+}
+
+#ifdef SIGUSR1
+static void
+request_dump (int sig)
+{
+  dump_requested = TRUE;
+}
+
+/* a file cannot be written from a signal handler, so the main loop polls */
+static gboolean
+dump_if_requested (gpointer data)
+{
+  if (dump_requested)
+    {
+      dump_requested = FALSE;
+      trace_dump ();
+    }
+  return TRUE;
+}
+#endif
+
+void
+trace_enable (gchar const *filename)
+{
+  if (trace_on)
+    return;
+  trace_filename = g_strdup (filename);
+  buffers = g_new0 (trace_buffer, TRACE_THREADS);
+  start_time = g_get_monotonic_time ();
+  /* makes the thread key now, so that the first event on the audio or MIDI
+   * thread need not allocate it */
+  g_private_get (&thread_buffer);
+  atexit (dump_at_exit);
+#ifdef SIGUSR1
+  signal (SIGUSR1, request_dump);
+  g_timeout_add_seconds (1, dump_if_requested, NULL);
+#endif
+  trace_on = TRUE;
+}
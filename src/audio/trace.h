@@ -0,0 +1,51 @@
+/*
+ * trace.h
+ * A timeline of what each thread does, for finding where a key press stalls.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+
+/**
+ * Marks the start and end of a span of work on the calling thread. The name
+ * must be a string literal. When tracing is off a tracepoint costs a load
+ * and a branch.
+ */
+#define TRACE_BEGIN(name) G_STMT_START { if (G_UNLIKELY (trace_on)) trace_record (name, 'B'); } G_STMT_END
+#define TRACE_END(name) G_STMT_START { if (G_UNLIKELY (trace_on)) trace_record (name, 'E'); } G_STMT_END
+
+extern gboolean trace_on;
+
+/**
+ * Starts recording tracepoints, each thread into a buffer of its own that
+ * keeps its most recent events. The timeline is written to the given file
+ * in Chrome trace format, which chrome://tracing and Perfetto open, at exit
+ * and on SIGUSR1. Call before starting the audio.
+ */
+void trace_enable (gchar const *filename);
+
+/**
+ * Writes the timeline recorded so far.
+ *
+ * @return  FALSE if the file could not be written
+ */
+gboolean trace_dump (void);
+
+/**
+ * Records a tracepoint. Neither locks nor allocates; use TRACE_BEGIN() and
+ * TRACE_END() rather than calling this.
+ *
+ * @param phase  'B' for begin or 'E' for end
+ */
+void trace_record (gchar const *name, gchar phase);
+
+#endif // TRACE_H
@@ -0,0 +1,137 @@
+/*
+ * tuning.c
+ * Per-key tuning tables for the synth.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <math.h>
+#include <glib.h>
+#include <historicHarpsichord/historicHarpsichord.h>
+#include "audio/tuning.h"
+
+gdouble
+tuning_get_pitch_standard (void)
+{
+  return HistoricHarpsichord.prefs.lowpitch ? TUNING_MODERN_PITCH * pow (2.0, -1.0 / 12.0) : TUNING_MODERN_PITCH;
+}
+
+/* the distance in cents of the pitch standard from modern pitch */
+static gdouble
+standard_cents (gdouble a4)
+{
+  return 1200.0 * log2 (a4 / TUNING_MODERN_PITCH);
+}
+
+void
+tuning_build_table (gdouble const cents[12], gint offset, gdouble a4, gdouble pitch[128])
+{
+  gdouble standard = standard_cents (a4);
+  gint key;
+  offset = ((offset % 12) + 12) % 12;
+  for (key = 0; key < 128; key++)
+    pitch[key] = 100.0 * key + cents[(key + offset) % 12] + standard;
+}
+
+void
+tuning_move_table (gdouble const modern[128], gint offset, gdouble a4, gdouble pitch[128])
+{
+  gdouble standard = standard_cents (a4);
+  gint key, from;
+  offset = ((offset % 12) + 12) % 12;
+  for (key = 0; key < 128; key++)
+    {
+      from = key + offset;
+      while (from > 127)
+        from -= 12;
+      pitch[key] = 100.0 * key + modern[from] - 100.0 * from + standard;
+    }
+}
+
+/* the universal SysEx sub-ID of the MIDI Tuning Standard and its messages */
+#define MTS_SUB_ID (0x08)
+#define MTS_BULK_DUMP (0x01)
+#define MTS_NOTE_CHANGE (0x02)
+#define MTS_BANK_NOTE_CHANGE (0x07)
+#define MTS_OCTAVE_1BYTE (0x08)
+#define MTS_OCTAVE_2BYTE (0x09)
+
+/* the pitch in cents of a key given as a semitone and 14 bits of a
+ * fraction of it; FALSE for 7F 7F 7F, which leaves the key as it is */
+static gboolean
+mts_key_pitch (guchar const *data, gdouble * cents)
+{
+  if (data[0] == 0x7F && data[1] == 0x7F && data[2] == 0x7F)
+    return FALSE;
+  *cents = 100.0 * data[0] + 100.0 * ((data[1] << 7) | data[2]) / 16384.0;
+  return TRUE;
+}
+
+/* applies count key changes, each a key followed by its pitch */
+static void
+mts_note_changes (guchar const *data, gint count, gdouble pitch[128])
+{
+  gint i;
+  for (i = 0; i < count; i++, data += 4)
+    mts_key_pitch (data + 1, &pitch[data[0] & 0x7F]);
+}
+
+gboolean
+tuning_apply_mts (guchar const *buf, gint length, gdouble pitch[128])
+{
+  gdouble cents[12];
+  gint i, key, count;
+  /* F0, 7E or 7F, device, 08, the message, F7 */
+  if (length < 6 || buf[0] != 0xF0 || (buf[1] != 0x7E && buf[1] != 0x7F) || buf[3] != MTS_SUB_ID)
+    return FALSE;
+  switch (buf[4])
+    {
+    case MTS_BULK_DUMP:
+      /* the program, a 16 character name, 128 keys and a checksum */
+      if (length < 6 + 16 + 3 * 128 + 2)
+        return FALSE;
+      for (key = 0; key < 128; key++)
+        mts_key_pitch (buf + 6 + 16 + 3 * key, &pitch[key]);
+      return TRUE;
+    case MTS_NOTE_CHANGE:
+      /* the program, then the count of changes */
+      count = length > 7 ? buf[6] : 0;
+      if (length < 8 + 4 * count)
+        return FALSE;
+      mts_note_changes (buf + 7, count, pitch);
+      return TRUE;
+    case MTS_BANK_NOTE_CHANGE:
+      /* the bank and program, then the count of changes */
+      count = length > 8 ? buf[7] : 0;
+      if (length < 9 + 4 * count)
+        return FALSE;
+      mts_note_changes (buf + 8, count, pitch);
+      return TRUE;
+    case MTS_OCTAVE_1BYTE:
+      /* three bytes of channel mask, then 12 deviations of -64 to +63
+       * cents from equal temperament */
+      if (length < 8 + 12 + 1)
+        return FALSE;
+      for (i = 0; i < 12; i++)
+        cents[i] = (gdouble) buf[8 + i] - 64.0;
+      break;
+    case MTS_OCTAVE_2BYTE:
+      /* three bytes of channel mask, then 12 deviations of 14 bits
+       * spanning -100 to +100 cents */
+      if (length < 8 + 24 + 1)
+        return FALSE;
+      for (i = 0; i < 12; i++)
+        cents[i] = (((buf[8 + 2 * i] << 7) | buf[9 + 2 * i]) - 8192) * 100.0 / 8192.0;
+      break;
+    default:
+      return FALSE;
+    }
+  for (key = 0; key < 128; key++)
+    pitch[key] = 100.0 * key + cents[key % 12];
+  return TRUE;
+}
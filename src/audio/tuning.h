@@ -0,0 +1,61 @@
+/*
+ * tuning.h
+ * Per-key tuning tables for the synth.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <glib.h>
+
+#define TUNING_MODERN_PITCH (440.0)
+
+/**
+ * Returns the pitch of A4 in Hz for the pitch standard the preferences
+ * choose: modern pitch, or with lowpitch an equal tempered semitone below
+ * it, the A=415 of baroque ensembles.
+ */
+gdouble tuning_get_pitch_standard (void);
+
+/**
+ * Compiles a temperament into the pitch of every key.
+ *
+ * @param cents  the deviation from equal temperament of the 12 notes from C
+ * @param offset  the number of semitones the temperament is moved round by,
+ *   so that key C plays the temperament's note offset semitones above C
+ * @param a4  the pitch of A4 in Hz
+ * @param pitch  filled with the pitch of each key in cents above key 0 at
+ *   modern pitch, the form the synth's key tuning takes: 6900 is A440
+ */
+void tuning_build_table (gdouble const cents[12], gint offset, gdouble a4, gdouble pitch[128]);
+
+/**
+ * Moves a table built for modern pitch to the pitch standard a4, and its
+ * deviations from equal temperament round by offset semitones as
+ * tuning_build_table() does, so that key C plays with the deviation of the
+ * key offset semitones above it. Keys whose counterpart is off the table
+ * take that of the key an octave nearer.
+ */
+void tuning_move_table (gdouble const modern[128], gint offset, gdouble a4, gdouble pitch[128]);
+
+/**
+ * Applies a MIDI Tuning Standard message to a table: a bulk tuning dump,
+ * a single note tuning change, with or without a bank, or a one or two
+ * byte octave tuning. The synth has a single tuning, so the program, bank
+ * and channels a message names are not looked at.
+ *
+ * @param buf  the whole SysEx message, from 0xF0 to 0xF7
+ * @param pitch  the table, in cents above key 0 as tuning_build_table()
+ *   fills it in, changed where the message retunes keys
+ * @return  whether buf is such a message
+ */
+gboolean tuning_apply_mts (guchar const *buf, gint length, gdouble pitch[128]);
+
+#endif // TUNING_H
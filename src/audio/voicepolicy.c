@@ -0,0 +1,134 @@
+#ifdef _HAVE_FLUIDSYNTH_
+/*
+ * voicepolicy.c
+ * One string per key: a key struck again re-plucks its string rather than
+ * sounding another.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <fluidsynth.h>
+#include "audio/voicepolicy.h"
+#include "audio/notecache.h"
+
+/* the release of a string re-plucked, about 30 ms, short enough not to be
+ * heard as a second note and long enough not to click */
+#define REPLUCK_RELEASE_TIMECENTS (-6000.0)
+
+/* for each channel and key, 1 + the note id of its last stroke, or 0; the
+ * note cache's continuation channels are counted too */
+static guint stroke[NOTE_CACHE_SYNTH_CHANNELS][128];
+/* whether that stroke is still held */
+static gboolean held[NOTE_CACHE_SYNTH_CHANNELS][128];
+
+#define CHANNEL(chan) ((chan) % NOTE_CACHE_SYNTH_CHANNELS)
+
+/* fills voices with those of note id, or with all the voices sounding if id
+ * is negative; returns how many */
+static gint
+get_voices (fluid_synth_t * synth, fluid_voice_t * voices[VOICE_POLICY_MAX_VOICES], gint id)
+{
+  gint n;
+  fluid_synth_get_voicelist (synth, voices, VOICE_POLICY_MAX_VOICES, id);
+  for (n = 0; n < VOICE_POLICY_MAX_VOICES && voices[n]; n++)
+    ;
+  return n;
+}
+
+gint
+voice_policy_start (fluid_synth_t * synth, gint chan, gint key, gint velocity, fluid_voice_t * started[VOICE_POLICY_MAX_VOICES])
+{
+  fluid_voice_t *voices[VOICE_POLICY_MAX_VOICES];
+  guint before = 0;
+  gint i, n, sounding, count = 0;
+
+  /* the synth numbers its notes in order, and all the voices of a note
+   * share its number, so the voices the note-on starts are those numbered
+   * above all that were sounding before it */
+  sounding = get_voices (synth, voices, -1);
+  for (i = 0; i < sounding; i++)
+    before = MAX (before, fluid_voice_get_id (voices[i]));
+  fluid_synth_noteon (synth, chan, key, velocity);
+  n = get_voices (synth, started, -1);
+  for (i = 0; i < n; i++)
+    if (sounding == 0 || fluid_voice_get_id (started[i]) > before)
+      started[count++] = started[i];
+  return count;
+}
+
+void
+voice_policy_repluck (fluid_synth_t * synth, gint chan, gint key)
+{
+  fluid_voice_t *voices[VOICE_POLICY_MAX_VOICES];
+  guint *last = &stroke[CHANNEL (chan)][key & 0x7F];
+  gfloat release;
+  gint i, n;
+
+  if (*last == 0)
+    return;
+  /* the voice's release takes the channel's offset on top of its own */
+  release = REPLUCK_RELEASE_TIMECENTS - fluid_synth_get_gen (synth, chan, GEN_VOLENVRELEASE);
+  n = get_voices (synth, voices, *last - 1);
+  for (i = 0; i < n; i++)
+    {
+      fluid_voice_gen_set (voices[i], GEN_VOLENVRELEASE, release);
+      fluid_voice_update_param (voices[i], GEN_VOLENVRELEASE);
+    }
+  /* lets off the voices still held, the released ones now fade */
+  if (n)
+    fluid_synth_stop (synth, *last - 1);
+  *last = 0;
+  held[CHANNEL (chan)][key & 0x7F] = FALSE;
+}
+
+gint
+voice_policy_note_on (fluid_synth_t * synth, gint chan, gint key, gint velocity, gboolean repluck,
+                      fluid_voice_t * started[VOICE_POLICY_MAX_VOICES])
+{
+  gint count;
+
+  if (repluck)
+    voice_policy_repluck (synth, chan, key);
+
+  count = voice_policy_start (synth, chan, key, velocity, started);
+  /* a key without samples starts none */
+  stroke[CHANNEL (chan)][key & 0x7F] = count ? fluid_voice_get_id (started[0]) + 1 : 0;
+  held[CHANNEL (chan)][key & 0x7F] = count > 0;
+  return count;
+}
+
+void
+voice_policy_note_off (fluid_synth_t * synth, gint chan, gint key, gfloat release_offset)
+{
+  fluid_voice_t *voices[VOICE_POLICY_MAX_VOICES];
+  guint last = stroke[CHANNEL (chan)][key & 0x7F];
+  gint i, n;
+
+  if (release_offset != 0.0 && last && held[CHANNEL (chan)][key & 0x7F])
+    {
+      n = get_voices (synth, voices, last - 1);
+      for (i = 0; i < n; i++)
+        {
+          fluid_voice_gen_set (voices[i], GEN_VOLENVRELEASE, fluid_voice_gen_get (voices[i], GEN_VOLENVRELEASE) + release_offset);
+          fluid_voice_update_param (voices[i], GEN_VOLENVRELEASE);
+        }
+    }
+  held[CHANNEL (chan)][key & 0x7F] = FALSE;
+  fluid_synth_noteoff (synth, chan, key);
+}
+
+void
+voice_policy_reset (void)
+{
+  memset (stroke, 0, sizeof (stroke));
+  memset (held, 0, sizeof (held));
+}
+
+#endif //_HAVE_FLUIDSYNTH_
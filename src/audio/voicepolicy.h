@@ -0,0 +1,70 @@
+/*
+ * voicepolicy.h
+ * One string per key: a key struck again re-plucks its string rather than
+ * sounding another.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef VOICEPOLICY_H
+#define VOICEPOLICY_H
+
+#include <glib.h>
+#include <fluidsynth.h>
+
+/*
+ * Called by the audio thread only.
+ */
+
+/**
+ * The most voices the synth can list, its own polyphony limit.
+ */
+#define VOICE_POLICY_MAX_VOICES (256)
+
+/**
+ * Plays a note-on, as fluid_synth_noteon() does, and finds the voices it
+ * started.
+ *
+ * @param started  filled with the voices the note-on started
+ * @return  how many it started
+ */
+gint voice_policy_start (fluid_synth_t * synth, gint chan, gint key, gint velocity, fluid_voice_t * started[VOICE_POLICY_MAX_VOICES]);
+
+/**
+ * Strikes key on chan and records the voices the stroke starts. With
+ * repluck, first fades out quickly whatever the previous stroke of the key
+ * on that channel still sounds, held or released. The voices sounding are
+ * thus at most the keys times the choirs a note-on plays, whatever the
+ * repetition rate.
+ *
+ * @param started  filled with the voices the stroke started
+ * @return  how many it started
+ */
+gint voice_policy_note_on (fluid_synth_t * synth, gint chan, gint key, gint velocity, gboolean repluck,
+                           fluid_voice_t * started[VOICE_POLICY_MAX_VOICES]);
+
+/**
+ * Fades out quickly whatever the last stroke of key on chan still sounds,
+ * as voice_policy_note_on() does with repluck, and forgets the stroke.
+ */
+void voice_policy_repluck (fluid_synth_t * synth, gint chan, gint key);
+
+/**
+ * Lets key off on chan, first adding release_offset to the volume envelope
+ * release of the voices of its last stroke, and of those alone.
+ *
+ * @param release_offset  in timecents, 0 to leave the release as it is
+ */
+void voice_policy_note_off (fluid_synth_t * synth, gint chan, gint key, gfloat release_offset);
+
+/**
+ * Forgets the strokes recorded, when the synth played changes.
+ */
+void voice_policy_reset (void);
+
+#endif // VOICEPOLICY_H
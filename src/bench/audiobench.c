@@ -0,0 +1,389 @@
+/*
+ * audiobench.c
+ * Micro and macro benchmarks of the audio backend, printed as JSON.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "historicHarpsichord/historicHarpsichord.h"
+#include "core/utils.h"
+#include "core/prefops.h"
+#include "audio/audiointerface.h"
+#include "audio/eventqueue.h"
+#include "audio/ringbuffer.h"
+#include "audio/midi.h"
+#include "audio/fluid.h"
+
+struct HistoricHarpsichordRoot HistoricHarpsichord;
+
+/* each measurement is repeated this often and summarised */
+#define SAMPLES (50)
+/* each sample times a batch long enough for the microsecond clock */
+#define RING_BATCH (100000)
+#define QUEUE_BATCH (20000)
+#define RENDER_BATCH (16)
+#define LOADS (5)
+#define RING_SIZE (4096)
+#define PING_COUNT (10000)
+
+static gboolean first_result = TRUE;
+
+static int
+compare_doubles (gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(gdouble const *) a, y = *(gdouble const *) b;
+  return (x > y) - (x < y);
+}
+
+/* prints one result; params is the inside of a JSON object */
+static void
+emit (gchar const *name, gchar const *params, gchar const *unit, gdouble * samples, gint n)
+{
+  qsort (samples, n, sizeof (gdouble), compare_doubles);
+  g_print ("%s\n    {\"name\": \"%s\", \"params\": {%s}, \"unit\": \"%s\", \"samples\": %d, "
+           "\"min\": %.6g, \"median\": %.6g, \"p99\": %.6g, \"max\": %.6g}",
+           first_result ? "" : ",", name, params ? params : "", unit, n,
+           samples[0], samples[n / 2], samples[MIN (n - 1, n * 99 / 100)], samples[n - 1]);
+  first_result = FALSE;
+}
+
+static void
+bench_ringbuffer_throughput (void)
+{
+  gsize sizes[] = { 3, 16, 256 };
+  char data[256];
+  gdouble samples[SAMPLES];
+  guint s, i, j;
+
+  memset (data, 0, sizeof (data));
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      jack_ringbuffer_t *rb = jack_ringbuffer_create (RING_SIZE);
+      gchar *params = g_strdup_printf ("\"bytes\": %" G_GSIZE_FORMAT, sizes[s]);
+      for (i = 0; i < SAMPLES; i++)
+        {
+          gint64 start = g_get_monotonic_time ();
+          for (j = 0; j < RING_BATCH; j++)
+            {
+              jack_ringbuffer_write (rb, data, sizes[s]);
+              jack_ringbuffer_read (rb, data, sizes[s]);
+            }
+          samples[i] = RING_BATCH * sizes[s] / (gdouble) MAX (g_get_monotonic_time () - start, 1);
+        }
+      emit ("ringbuffer_throughput", params, "MB/s", samples, SAMPLES);
+      g_free (params);
+      jack_ringbuffer_free (rb);
+    }
+}
+
+static jack_ringbuffer_t *ping, *pong;
+
+/* returns each stamp it is sent */
+static gpointer
+echo_func (gpointer data)
+{
+  gint64 stamp = 0;
+  while (stamp >= 0)
+    {
+      if (jack_ringbuffer_read_space (ping) < sizeof (stamp))
+        continue;
+      jack_ringbuffer_read (ping, (char *) &stamp, sizeof (stamp));
+      while (jack_ringbuffer_write_space (pong) < sizeof (stamp))
+        ;
+      jack_ringbuffer_write (pong, (char *) &stamp, sizeof (stamp));
+    }
+  return NULL;
+}
+
+/* the round trip between two threads polling, as the queues are passed
+ * between the main and audio threads */
+static void
+bench_ringbuffer_latency (void)
+{
+  gdouble *samples = g_new (gdouble, PING_COUNT);
+  gint64 stamp, done = -1;
+  GThread *thread;
+  gint i;
+
+  ping = jack_ringbuffer_create (RING_SIZE);
+  pong = jack_ringbuffer_create (RING_SIZE);
+  thread = g_thread_new ("Echo", echo_func, NULL);
+  for (i = 0; i < PING_COUNT; i++)
+    {
+      stamp = g_get_monotonic_time ();
+      jack_ringbuffer_write (ping, (char *) &stamp, sizeof (stamp));
+      while (jack_ringbuffer_read_space (pong) < sizeof (stamp))
+        ;
+      jack_ringbuffer_read (pong, (char *) &stamp, sizeof (stamp));
+      samples[i] = g_get_monotonic_time () - stamp;
+    }
+  jack_ringbuffer_write (ping, (char *) &done, sizeof (done));
+  g_thread_join (thread);
+  emit ("ringbuffer_round_trip", NULL, "us", samples, PING_COUNT);
+  jack_ringbuffer_free (ping);
+  jack_ringbuffer_free (pong);
+  g_free (samples);
+}
+
+static void
+bench_event_queue (void)
+{
+  event_queue_t *queue = event_queue_new (0, 32, 256, 0
+#ifdef _HAVE_RUBBERBAND_
+                                          , 0
+#endif
+    );
+  guchar note[] = { MIDI_NOTE_ON, 60, 100 };
+  guchar sysex[MIDI_EVENT_MAX_LENGTH];
+  guchar buffer[MIDI_EVENT_MAX_LENGTH];
+  midi_event_t header;
+  gdouble samples[SAMPLES];
+  gsize length;
+  gdouble time;
+  gint i, j;
+
+  memset (sysex, 0, sizeof (sysex));
+  sysex[0] = 0xF0;
+  sysex[sizeof (sysex) - 1] = 0xF7;
+
+  for (i = 0; i < SAMPLES; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+      for (j = 0; j < QUEUE_BATCH; j++)
+        {
+          event_queue_write_immediate (queue, note, sizeof (note));
+          event_queue_read_output (queue, buffer, &length, &time, G_MAXDOUBLE);
+        }
+      samples[i] = (g_get_monotonic_time () - start) * 1000.0 / QUEUE_BATCH;
+    }
+  emit ("event_queue_immediate_round_trip", "\"bytes\": 3", "ns", samples, SAMPLES);
+
+  for (i = 0; i < SAMPLES; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+      for (j = 0; j < QUEUE_BATCH; j++)
+        {
+          event_queue_write_immediate (queue, sysex, sizeof (sysex));
+          event_queue_read_output (queue, buffer, &length, &time, G_MAXDOUBLE);
+        }
+      samples[i] = (g_get_monotonic_time () - start) * 1000.0 / QUEUE_BATCH;
+    }
+  emit ("event_queue_immediate_round_trip", "\"bytes\": 512", "ns", samples, SAMPLES);
+
+  header.backend = MIDI_BACKEND;
+  header.port = 0;
+  header.length = sizeof (note);
+  for (i = 0; i < SAMPLES; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+      for (j = 0; j < QUEUE_BATCH; j++)
+        {
+          event_queue_write_input (queue, &header, note[0], note + 1);
+          g_free (event_queue_read_input (queue));
+        }
+      samples[i] = (g_get_monotonic_time () - start) * 1000.0 / QUEUE_BATCH;
+    }
+  emit ("event_queue_input_round_trip", "\"bytes\": 3", "ns", samples, SAMPLES);
+
+  /* what the audio callback pays to drain a full queue before rendering */
+  for (i = 0; i < SAMPLES; i++)
+    {
+      gint64 elapsed = 0;
+      for (j = 0; j < QUEUE_BATCH / 32; j++)
+        {
+          gint64 start;
+          while (event_queue_write_immediate (queue, note, sizeof (note)))
+            ;
+          start = g_get_monotonic_time ();
+          while (event_queue_read_output (queue, buffer, &length, &time, G_MAXDOUBLE))
+            ;
+          elapsed += g_get_monotonic_time () - start;
+        }
+      samples[i] = elapsed * 1000.0 / (QUEUE_BATCH / 32);
+    }
+  emit ("event_queue_drain", "\"events\": 32", "ns", samples, SAMPLES);
+  event_queue_free (queue);
+}
+
+#ifdef _HAVE_FLUIDSYNTH_
+static void
+bench_soundfont_load (HistoricHarpsichordPrefs * prefs)
+{
+  gdouble samples[LOADS];
+  gint i;
+  for (i = 0; i < LOADS; i++)
+    {
+      gint64 start = g_get_monotonic_time ();
+      if (fluidsynth_init (prefs, 44100))
+        return;
+      samples[i] = (g_get_monotonic_time () - start) / 1000.0;
+      fluidsynth_close ();
+    }
+  emit ("soundfont_load", NULL, "ms", samples, LOADS);
+}
+
+/* strikes the given number of keys from the bottom of the compass up */
+static void
+strike (gint notes)
+{
+  gint i;
+  for (i = 0; i < notes; i++)
+    {
+      guchar event[] = { MIDI_NOTE_ON, 29 + i % 60, 100 };
+      fluidsynth_feed_midi (event, sizeof (event));
+    }
+}
+
+/* lets the voices of the last measurement die away */
+static void
+silence (guint period)
+{
+  float *left = g_new0 (float, period), *right = g_new0 (float, period);
+  guint frames;
+  fluidsynth_panic ();
+  for (frames = 0; frames < 44100 * 2; frames += period)
+    fluidsynth_process_block (period, G_MAXDOUBLE, left, right);
+  g_free (left);
+  g_free (right);
+}
+
+static void
+bench_render_one (guint rate, guint period, gint notes)
+{
+  float *left = g_new0 (float, period), *right = g_new0 (float, period);
+  gdouble samples[SAMPLES];
+  gchar *params;
+  gint i, j, voices = 0;
+
+  silence (period);
+  for (i = 0; i < SAMPLES; i++)
+    {
+      gint64 start;
+      /* restrike now and then so the voices measured have not died away */
+      if (i % 10 == 0)
+        strike (notes);
+      start = g_get_monotonic_time ();
+      for (j = 0; j < RENDER_BATCH; j++)
+        fluidsynth_process_block (period, G_MAXDOUBLE, left, right);
+      /* the fraction of the period spent rendering */
+      samples[i] = (g_get_monotonic_time () - start) * (gdouble) rate / (RENDER_BATCH * period * 1e6);
+      voices = MAX (voices, fluidsynth_get_active_voices ());
+    }
+  params = g_strdup_printf ("\"rate\": %u, \"period\": %u, \"notes\": %d, \"voices\": %d", rate, period, notes, voices);
+  emit ("render_load", params, "fraction of period", samples, SAMPLES);
+  g_free (params);
+  g_free (left);
+  g_free (right);
+}
+
+static void
+bench_render (HistoricHarpsichordPrefs * prefs)
+{
+  guint rates[] = { 22050, 44100, 48000, 96000 };
+  guint periods[] = { 64, 128, 256, 512, 1024 };
+  gint notes[] = { 0, 1, 4, 16, 32, 64 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (rates); i++)
+    {
+      if (fluidsynth_init (prefs, rates[i]))
+        return;
+      if (rates[i] == 44100)
+        {
+          guint j;
+          for (j = 0; j < G_N_ELEMENTS (notes); j++)
+            bench_render_one (rates[i], 256, notes[j]);
+          for (j = 0; j < G_N_ELEMENTS (periods); j++)
+            bench_render_one (rates[i], periods[j], 16);
+        }
+      else
+        bench_render_one (rates[i], 256, 16);
+      fluidsynth_close ();
+    }
+}
+
+/* the cost of a retuning to the main thread that sends it and to the audio
+ * thread that applies it */
+static void
+bench_tuning_change (HistoricHarpsichordPrefs * prefs)
+{
+  gdouble send[SAMPLES], apply[SAMPLES], pitch[128];
+  gint i, key;
+
+  if (fluidsynth_init (prefs, 44100))
+    return;
+  for (i = 0; i < SAMPLES; i++)
+    {
+      gint64 start;
+      for (key = 0; key < 128; key++)
+        pitch[key] = 100.0 * key + (i % 2 ? -5.0 : 5.0);
+      start = g_get_monotonic_time ();
+      fluidsynth_set_key_tuning (pitch);
+      send[i] = g_get_monotonic_time () - start;
+      start = g_get_monotonic_time ();
+      fluidsynth_start_block ();
+      apply[i] = g_get_monotonic_time () - start;
+      /* frees the tunings retired */
+      while (g_main_context_iteration (NULL, FALSE))
+        ;
+    }
+  emit ("tuning_change_send", NULL, "us", send, SAMPLES);
+  emit ("tuning_change_apply", NULL, "us", apply, SAMPLES);
+  fluidsynth_close ();
+}
+#endif //_HAVE_FLUIDSYNTH_
+
+int
+main (int argc, char *argv[])
+{
+  gboolean micro_only = FALSE;
+  gchar *soundfont = NULL;
+  GOptionEntry entries[] = {
+    {"micro", 0, 0, G_OPTION_ARG_NONE, &micro_only, "Leave out the benchmarks that need a SoundFont", NULL},
+    {"soundfont", 0, 0, G_OPTION_ARG_FILENAME, &soundfont, "Play this SoundFont rather than the one the preferences give", "FILE"},
+    {NULL}
+  };
+  GOptionContext *context = g_option_context_new ("- benchmark the audio backend");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    g_error ("Option parsing failed: %s", error->message);
+  g_option_context_free (context);
+
+  initdir ();
+  initprefs ();
+  HistoricHarpsichord.prefs.resampled_bank = HistoricHarpsichord.prefs.note_cache = FALSE;
+  if (soundfont)
+    g_string_assign (HistoricHarpsichord.prefs.fluidsynth_soundfont, soundfont);
+
+  g_print ("{\"version\": \"%s\", \"fluidsynth\": %s, \"results\": [", VERSION,
+#ifdef _HAVE_FLUIDSYNTH_
+           "true"
+#else
+           "false"
+#endif
+    );
+  bench_ringbuffer_throughput ();
+  bench_ringbuffer_latency ();
+  bench_event_queue ();
+#ifdef _HAVE_FLUIDSYNTH_
+  if (!micro_only)
+    {
+      bench_soundfont_load (&HistoricHarpsichord.prefs);
+      bench_render (&HistoricHarpsichord.prefs);
+      bench_tuning_change (&HistoricHarpsichord.prefs);
+    }
+#endif
+  g_print ("\n]}\n");
+  return 0;
+}
@@ -52,9 +52,44 @@
 #include "core/utils.h"
 #include "core/prefops.h"
 #include "audio/audiointerface.h"
+#include "audio/adaptive.h"
+#include "audio/audiostats.h"
+#include "audio/latency.h"
+#include "audio/trace.h"
+#include "audio/metrics.h"
+#include "audio/midirecord.h"
+#include "audio/loadgen.h"
+#include "audio/rtcheck.h"
+#include "audio/startprofile.h"
 
 struct HistoricHarpsichordRoot HistoricHarpsichord;
 
+#define STATS_INTERVAL (10)
+
+static gboolean print_stats = FALSE;
+static gboolean latency_test = FALSE;
+static gchar *metrics_file = NULL;
+static gchar *replay_file = NULL;
+static gchar *test_driver = NULL;
+static gboolean replay_fast = FALSE;
+static gboolean load_test = FALSE;
+static gboolean benchmark_tuning = FALSE;
+static gint load_threshold = 80;
+static gboolean profile_startup = FALSE;
+static gchar *profile_startup_json = NULL;
+
+static gboolean
+print_audio_stats (gpointer data)
+{
+  audio_stats_t stats;
+  gchar *text;
+  audio_stats_get (&stats);
+  text = audio_stats_format (&stats);
+  g_print ("%s", text);
+  g_free (text);
+  return TRUE;
+}
+
 static gchar **
 process_command_line (int argc, char **argv, gboolean gtkstatus)
 {
@@ -62,6 +97,8 @@ process_command_line (int argc, char **argv, gboolean gtkstatus)
   GOptionContext *context;
   gchar* scheme_script_name = NULL;
   gboolean version = FALSE;
+  gchar *trace_file = NULL;
+  gchar *record_file = NULL;
   gchar **filenames = NULL;
 
   GOptionEntry entries[] =
@@ -70,6 +107,19 @@ process_command_line (int argc, char **argv, gboolean gtkstatus)
     { "verbose",             'V', 0, G_OPTION_ARG_NONE, &HistoricHarpsichord.verbose, _("Display every messages"), NULL },
     { "audio-options",       'A', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &HistoricHarpsichord.prefs.audio_driver,_("Audio driver options"), _("options") },
     { "midi-options",        'M', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &HistoricHarpsichord.prefs.midi_driver, _("Midi driver options"), _("options") },
+    { "benchmark-tuning",    0,   0, G_OPTION_ARG_NONE, &benchmark_tuning, _("Measure the cost of adaptive tuning and exit"), NULL },
+    { "stats",               0,   0, G_OPTION_ARG_NONE, &print_stats, _("Print the load on the audio callback every 10 seconds"), NULL },
+    { "trace",               0,   0, G_OPTION_ARG_FILENAME, &trace_file, _("Record a timeline of the audio and MIDI threads to FILE, written at exit and on SIGUSR1"), _("FILE") },
+    { "metrics",             0,   0, G_OPTION_ARG_FILENAME, &metrics_file, _("Keep FILE up to date with the audio and MIDI metrics in Prometheus text format"), _("FILE") },
+    { "profile-startup",     0,   0, G_OPTION_ARG_NONE, &profile_startup, _("Print the time, page faults and memory growth of each phase of startup"), NULL },
+    { "profile-startup-json", 0,  0, G_OPTION_ARG_FILENAME, &profile_startup_json, _("Write the startup profile to FILE as JSON"), _("FILE") },
+    { "record",              0,   0, G_OPTION_ARG_FILENAME, &record_file, _("Record the MIDI input with its timing to FILE"), _("FILE") },
+    { "replay",              0,   0, G_OPTION_ARG_FILENAME, &replay_file, _("Play a recording of MIDI input from FILE and exit"), _("FILE") },
+    { "replay-fast",         0,   0, G_OPTION_ARG_NONE, &replay_fast, _("Replay as fast as possible instead of in real time"), NULL },
+    { "load-test",           0,   0, G_OPTION_ARG_NONE, &load_test, _("Play ever more notes until the audio drops out, report what was sustained and exit"), NULL },
+    { "load-threshold",      0,   0, G_OPTION_ARG_INT, &load_threshold, _("Stop the load test when the load passes PERCENT of the period (80)"), _("PERCENT") },
+    { "test-driver",         0,   0, G_OPTION_ARG_STRING, &test_driver, _("Replay or load test with this audio driver: portaudio, null or dummy"), _("DRIVER") },
+    { "latency-test",        0,   0, G_OPTION_ARG_NONE, &latency_test, _("Measure the time from key to sound without a sound card and exit"), NULL },
     { G_OPTION_REMAINING,    0,   0, G_OPTION_ARG_FILENAME_ARRAY, &filenames, NULL, _("[FILE]...") },
     { NULL }
   };
@@ -105,6 +155,12 @@ process_command_line (int argc, char **argv, gboolean gtkstatus)
     exit(EXIT_SUCCESS);
   }
 
+  if(trace_file)
+    trace_enable (trace_file);
+
+  if(record_file)
+    midi_record_start (record_file);
+
   if(HistoricHarpsichord.prefs.audio_driver)
     g_string_ascii_down (HistoricHarpsichord.prefs.audio_driver);
 
@@ -123,6 +179,27 @@ localization_init()
   textdomain(GETTEXT_PACKAGE);
 }
 
+/* reports the startup profile once the main window has been drawn */
+static gboolean
+startup_done (gpointer data)
+{
+  startup_phase_end ();
+  if (profile_startup)
+    startup_profile_print ();
+  if (profile_startup_json)
+    startup_profile_write_json (profile_startup_json);
+  return FALSE;
+}
+
+/* a test run fails if the audio callback made calls that may block */
+static gint
+test_status (gint status)
+{
+  if (status == 0 && rtcheck_violations ())
+    return 1;
+  return status;
+}
+
 
 
 int
@@ -130,25 +207,49 @@ main (int argc, char *argv[])
 {
   gchar** files = NULL;
   gboolean gtk_status = FALSE;
+  gint audio_failed;
 
+  rtcheck_init ();
  // g_log_set_default_handler (main_log_handler, NULL);
 
+  startup_phase_begin ("gtk_init_check");
   if(!(gtk_status = gtk_init_check (&argc, &argv)))
     g_message(_("Could not start graphical interface."));
+  startup_phase_end ();
 
+  startup_phase_begin ("process_command_line");
   files = process_command_line (argc, argv, gtk_status);
+  startup_phase_end ();
 
 
   /* initialization of directory relocatability */
+  startup_phase_begin ("initdir");
   initdir ();
+  startup_phase_end ();
 
   //check_if_upgrade();
   //init_environment();
+  startup_phase_begin ("localization_init");
   localization_init();
+  startup_phase_end ();
+  startup_phase_begin ("initprefs");
   initprefs (); 
+  startup_phase_end ();
+  if (benchmark_tuning)
+    exit (adaptive_tuning_benchmark (&HistoricHarpsichord.prefs));
+  if (latency_test)
+    exit (test_status (latency_test_run (&HistoricHarpsichord.prefs)));
+  if (replay_file)
+    exit (test_status (midi_replay_run (&HistoricHarpsichord.prefs, replay_file, test_driver, replay_fast)));
+  if (load_test)
+    exit (test_status (load_test_run (&HistoricHarpsichord.prefs, test_driver, load_threshold / 100.0)));
   
   //project Initializations
-  if (audio_initialize (&HistoricHarpsichord.prefs))
+  startup_phase_begin ("audio_initialize");
+  audio_failed = audio_initialize (&HistoricHarpsichord.prefs);
+  startup_phase_end ();
+  startup_phase_begin ("main window");
+  if (audio_failed)
     {
     g_print ("Failed to initialize audio or MIDI backends");
     gchar *title, *message;
@@ -187,6 +288,13 @@ main (int argc, char *argv[])
     
     gtk_widget_show_all (window);
     }
+  if (print_stats)
+    g_timeout_add_seconds (STATS_INTERVAL, print_audio_stats, NULL);
+  if (metrics_file)
+    metrics_enable (metrics_file);
+  startup_phase_end ();
+  startup_phase_begin ("first frame");
+  g_idle_add (startup_done, NULL);
   gtk_main ();
 
 
@@ -81,6 +81,7 @@ initprefs ()
   
   ret->dynamic_compression = 100;
   ret->damping = 1;
+  ret->one_string_per_key = 1;
   /* Read values from personal preferences file */
 
   //readpreffile (localrc, ret);
@@ -187,6 +188,10 @@ parseConfig (xmlDocPtr doc, xmlNodePtr cur, HistoricHarpsichordPrefs * prefs)
     READXMLENTRY (fluidsynth_soundfont)
     READBOOLXMLENTRY (fluidsynth_reverb)
     READBOOLXMLENTRY (fluidsynth_chorus)
+    READBOOLXMLENTRY (resampled_bank)
+    READBOOLXMLENTRY (note_cache)
+    READBOOLXMLENTRY (adaptive_tuning)
+    READBOOLXMLENTRY (one_string_per_key)
     cur = cur->next;
     }
   return;
@@ -213,6 +218,10 @@ get_bool_pref (gchar * prefname)
     GETBOOLPREF (damping)
     GETBOOLPREF (fluidsynth_reverb)
     GETBOOLPREF (fluidsynth_chorus)
+    GETBOOLPREF (resampled_bank)
+    GETBOOLPREF (note_cache)
+    GETBOOLPREF (adaptive_tuning)
+    GETBOOLPREF (one_string_per_key)
     return FALSE;
 }
 
@@ -448,6 +457,10 @@ writeXMLPrefs (HistoricHarpsichordPrefs * prefs)
     WRITEXMLENTRY (fluidsynth_soundfont)
     WRITEBOOLXMLENTRY (fluidsynth_reverb)
     WRITEBOOLXMLENTRY (fluidsynth_chorus)
+    WRITEBOOLXMLENTRY (resampled_bank)
+    WRITEBOOLXMLENTRY (note_cache)
+    WRITEBOOLXMLENTRY (adaptive_tuning)
+    WRITEBOOLXMLENTRY (one_string_per_key)
     WRITEINTXMLENTRY (dynamic_compression)
     WRITEBOOLXMLENTRY (damping)
     
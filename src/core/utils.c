@@ -289,6 +289,33 @@ get_system_dir (HistoricHarpsichordDirectory dir)
     }
 }
 
+/**
+ * Returns the user's own directory of the given kind, in the user data
+ * directory. The returned string belongs to the function.
+ */
+const gchar *
+get_local_dir (HistoricHarpsichordDirectory dir)
+{
+  static gchar *soundfonts = NULL;
+  static gchar *temperaments = NULL;
+  switch (dir)
+    {
+
+    case HISTORICHARPSICHORD_DIR_SOUNDFONTS:
+      if (soundfonts == NULL)
+        soundfonts = g_build_filename (get_user_data_dir (TRUE), SOUNDFONTS_DIR, NULL);
+      return soundfonts;
+
+    case HISTORICHARPSICHORD_DIR_TEMPERAMENTS:
+      if (temperaments == NULL)
+        temperaments = g_build_filename (get_user_data_dir (TRUE), TEMPERAMENTS_DIR, NULL);
+      return temperaments;
+
+    default:
+      return NULL;
+    }
+}
+
 const gchar *
 get_system_locale_dir ()
 {
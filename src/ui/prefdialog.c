@@ -36,6 +36,7 @@
 #include "audio/fluid.h"
 #include "audio/audiointerface.h"
 #include "audio/temperament.h"
+#include "audio/miditransform.h"
 #include "audio/portaudioutil.h"
 #include "audio/portmidiutil.h"
 
@@ -69,6 +70,10 @@ struct callbackdata
   GtkWidget *fluidsynth_soundfont;
   GtkWidget *fluidsynth_reverb;
   GtkWidget *fluidsynth_chorus;
+  GtkWidget *resampled_bank;
+  GtkWidget *note_cache;
+  GtkWidget *adaptive_tuning;
+  GtkWidget *one_string_per_key;
 
 
   GtkWidget *temperament;
@@ -139,7 +144,12 @@ set_preferences (struct callbackdata *cbdata)
  
     ASSIGNBOOLEAN (damping);
     ASSIGNBOOLEAN (lowpitch);
+    ASSIGNBOOLEAN (resampled_bank);
+    ASSIGNBOOLEAN (note_cache);
+    ASSIGNBOOLEAN (adaptive_tuning);
+    ASSIGNBOOLEAN (one_string_per_key);
     ASSIGNINT (dynamic_compression);
+    midi_transform_compile (prefs);
   
   /* Now write it all to historicHarpsichordrc */
    if (HistoricHarpsichord.setup) // only save prefs as result of setup
@@ -399,6 +409,10 @@ preferences_change (void)
   INTENTRY_LIMITS (_("Compress Variations in Dynamics by %"), dynamic_compression, 0, 100);
   BOOLEANENTRY (_("Avoid abrupt damping"), damping);
   BOOLEANENTRY (_("Low Pitch"), lowpitch);
+  BOOLEANENTRY (_("Pre-resample the samples (more memory, less CPU)"), resampled_bank);
+  BOOLEANENTRY (_("Play notes from plucks rendered in advance (needs pre-resampled samples, no reverb or chorus)"), note_cache);
+  BOOLEANENTRY (_("Adaptive just intonation (not with pre-resampled samples)"), adaptive_tuning);
+  BOOLEANENTRY (_("One string per key (a key struck again re-plucks its string)"), one_string_per_key);
 
 
   gtk_widget_show_all (dialog);
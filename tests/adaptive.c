@@ -0,0 +1,66 @@
+/*
+ * adaptive.c
+ * Unit tests of the chord classification of adaptive just intonation.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/* the module itself, for its static functions */
+#include "audio/adaptive.c"
+#include "historicHarpsichord/historicHarpsichord.h"
+
+struct HistoricHarpsichordRoot HistoricHarpsichord;
+
+#define EPSILON (1e-6)
+
+#define C (0)
+#define E (4)
+#define G (7)
+#define A (9)
+#define B_FLAT (10)
+
+static void
+test_classify (void)
+{
+  /* complete chords */
+  g_assert_cmpint (classify (BIT (C) | BIT (E) | BIT (G)), ==, C);
+  g_assert_cmpint (classify (BIT (A) | BIT (C) | BIT (E)), ==, A);
+  g_assert_cmpint (classify (BIT (C) | BIT (E) | BIT (G) | BIT (B_FLAT)), ==, C);
+  /* a lone note is the root of its own chord */
+  g_assert_cmpint (classify (BIT (E)), ==, E);
+  /* the smallest chord with its root in the set wins: E G is E minor
+   * rather than C major */
+  g_assert_cmpint (classify (BIT (E) | BIT (G)), ==, E);
+  g_assert_cmpint (classify (BIT (C) | BIT (E)), ==, C);
+  /* no chord holds a cluster */
+  g_assert_cmpint (classify (BIT (0) | BIT (1) | BIT (2)), ==, NO_ROOT);
+}
+
+/* a major triad built up from its root is tuned pure */
+static void
+test_triad (void)
+{
+  adaptive_tuning_init ();
+  g_assert_cmpfloat (fabs (adaptive_tuning_note_on (60)), <, EPSILON);
+  g_assert_cmpfloat (fabs (adaptive_tuning_note_on (64) - (1200.0 * log2 (5.0 / 4.0) - 400.0)), <, EPSILON);
+  g_assert_cmpfloat (fabs (adaptive_tuning_note_on (67) - (1200.0 * log2 (3.0 / 2.0) - 700.0)), <, EPSILON);
+  /* once nothing sounds the next note is back at the static tuning */
+  adaptive_tuning_note_off (60);
+  adaptive_tuning_note_off (64);
+  adaptive_tuning_note_off (67);
+  g_assert_cmpfloat (fabs (adaptive_tuning_note_on (64)), <, EPSILON);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/adaptive/classify", test_classify);
+  g_test_add_func ("/adaptive/triad", test_triad);
+  return g_test_run ();
+}
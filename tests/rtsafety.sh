@@ -0,0 +1,61 @@
+#! /bin/sh
+#
+# Replays a few chords and runs the load test with the null audio driver,
+# reporting each run as a TAP test. A run fails if it dropped events or the
+# audio fell behind, and on an --enable-rtcheck build if the audio callback
+# made a call that may block.
+#
+# HH_PROGRAM, HH_VERSION and HH_SOUNDFONT are set by the Makefile; the
+# options gtester passes are ignored.
+
+home=$(mktemp -d) || exit 1
+trap 'rm -rf "$home"' EXIT
+HOME=$home
+export HOME
+
+# the preferences of the user running the tests are not to be used
+mkdir -p "$home/.historicHarpsichord-$HH_VERSION"
+cat > "$home/.historicHarpsichord-$HH_VERSION/HistoricHarpsichordrc" <<PREFS
+<?xml version="1.0"?>
+<HistoricHarpsichord><Config><fluidsynth_soundfont>$HH_SOUNDFONT</fluidsynth_soundfont></Config></HistoricHarpsichord>
+PREFS
+
+# writes a byte given in decimal
+byte ()
+{
+  printf "\\$(printf %o "$1")"
+}
+
+# a recording of chords, each event 50 ms after the one before
+recording=$home/chords.hhmidi
+{
+  printf 'HHMIDI'
+  byte 1; byte 0
+  for i in 1 2 3 4 5 6 7 8; do byte 0; done
+  for root in 48 53 55 60 65 67 72; do
+    for key in $root $((root + 4)) $((root + 7)); do
+      byte 208; byte 134; byte 3; byte 3; byte 144; byte $key; byte 100
+    done
+    for key in $root $((root + 4)) $((root + 7)); do
+      byte 208; byte 134; byte 3; byte 3; byte 128; byte $key; byte 0
+    done
+  done
+} > "$recording"
+
+echo "1..2"
+n=0
+run ()
+{
+  name=$1
+  shift
+  n=$((n + 1))
+  if "$HH_PROGRAM" "$@" > "$home/out" 2>&1; then
+    echo "ok $n - $name"
+  else
+    echo "not ok $n - $name"
+  fi
+  sed 's/^/# /' "$home/out"
+}
+
+run "replay" --replay "$recording" --replay-fast --test-driver null
+run "load test" --load-test --test-driver null
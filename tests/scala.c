@@ -0,0 +1,155 @@
+/*
+ * scala.c
+ * Unit tests of the Scala scale and keyboard mapping compiler.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/* the module itself, for its static functions */
+#include "audio/scala.c"
+
+struct HistoricHarpsichordRoot HistoricHarpsichord;
+
+#define EPSILON (1e-6)
+
+static gchar const equal_scl[] =
+  "! equal.scl\n"
+  "!\n"
+  "12 tone equal temperament\n"
+  " 12\n"
+  "!\n"
+  " 100.0\n 200.0\n 300.0\n 400.0\n 500.0\n 600.0\n"
+  " 700.0\n 800.0\n 900.0\n 1000.0\n 1100.0\n 2/1\n";
+
+/* a 5-limit just scale, the fifth a pure 3/2 */
+static gchar const just_scl[] =
+  "5-limit just intonation\n"
+  "12\n"
+  "16/15\n9/8\n6/5\n5/4\n4/3\n45/32\n3/2 the fifth\n8/5\n5/3\n16/9\n15/8\n2/1\n";
+
+static void
+test_parse_pitch (void)
+{
+  gdouble cents = 0.0;
+
+  g_assert (parse_pitch ("701.955", &cents));
+  g_assert_cmpfloat (fabs (cents - 701.955), <, EPSILON);
+  g_assert (parse_pitch ("3/2", &cents));
+  g_assert_cmpfloat (fabs (cents - 1200.0 * log2 (1.5)), <, EPSILON);
+  g_assert (parse_pitch ("2", &cents));
+  g_assert_cmpfloat (fabs (cents - 1200.0), <, EPSILON);
+  g_assert (parse_pitch ("100.0 a semitone", &cents));
+  g_assert_cmpfloat (fabs (cents - 100.0), <, EPSILON);
+  g_assert (parse_pitch ("-5.", &cents));
+  g_assert_cmpfloat (fabs (cents + 5.0), <, EPSILON);
+
+  g_assert (!parse_pitch ("", &cents));
+  g_assert (!parse_pitch ("fifth", &cents));
+  g_assert (!parse_pitch ("3/", &cents));
+  g_assert (!parse_pitch ("3/0", &cents));
+  g_assert (!parse_pitch ("0/1", &cents));
+  g_assert (!parse_pitch ("-3/2", &cents));
+}
+
+/* without a mapping degree 0 is on key 60 and key 69 is A440 */
+static void
+test_linear (void)
+{
+  gdouble pitch[128];
+  gchar *description = NULL;
+  gint key;
+
+  g_assert (scala_compile (equal_scl, NULL, &description, pitch));
+  g_assert_cmpstr (description, ==, "12 tone equal temperament");
+  g_free (description);
+  for (key = 0; key < 128; key++)
+    g_assert_cmpfloat (fabs (pitch[key] - 100.0 * key), <, EPSILON);
+
+  g_assert (scala_compile (just_scl, NULL, NULL, pitch));
+  g_assert_cmpfloat (fabs (pitch[69] - 6900.0), <, EPSILON);
+  /* C is a just major sixth below A, and G a pure fifth above C */
+  g_assert_cmpfloat (fabs (pitch[60] - (6900.0 - 1200.0 * log2 (5.0 / 3.0))), <, EPSILON);
+  g_assert_cmpfloat (fabs (pitch[67] - pitch[60] - 1200.0 * log2 (1.5)), <, EPSILON);
+  g_assert_cmpfloat (fabs (pitch[72] - pitch[60] - 1200.0), <, EPSILON);
+}
+
+/* a mapping of the white keys alone, the black keys left out */
+static void
+test_mapped (void)
+{
+  gchar const kbm[] =
+    "! white.kbm\n"
+    "12\n"                      /* the size of the pattern */
+    "0\n127\n"                  /* the keys retuned */
+    "60\n"                      /* the key of degree 0 */
+    "69\n440.0\n"               /* the reference key and its frequency */
+    "12\n"                      /* the degree of the formal octave */
+    "0\nx\n2\nx\n4\n5\nx\n7\nx\n9\nx\n11\n";
+  gdouble pitch[128];
+
+  g_assert (scala_compile (just_scl, kbm, NULL, pitch));
+  g_assert_cmpfloat (fabs (pitch[69] - 6900.0), <, EPSILON);
+  g_assert_cmpfloat (fabs (pitch[67] - pitch[60] - 1200.0 * log2 (1.5)), <, EPSILON);
+  /* the keys left out keep equal temperament */
+  g_assert_cmpfloat (fabs (pitch[61] - 6100.0), <, EPSILON);
+  g_assert_cmpfloat (fabs (pitch[70] - 7000.0), <, EPSILON);
+  /* the pattern repeats an octave down */
+  g_assert_cmpfloat (fabs (pitch[55] - pitch[67] + 1200.0), <, EPSILON);
+}
+
+/* the reference key need not be among the keys retuned */
+static void
+test_reference_outside (void)
+{
+  gchar const kbm[] =
+    "0\n"                       /* a linear mapping */
+    "0\n60\n"                   /* only the keys up to middle C are retuned */
+    "60\n"
+    "69\n440.0\n"
+    "0\n";
+  gdouble pitch[128];
+
+  g_assert (scala_compile (just_scl, kbm, NULL, pitch));
+  /* key 69 is not retuned, but the keys below are tuned as if it were A440 */
+  g_assert_cmpfloat (fabs (pitch[69] - 6900.0), <, EPSILON);
+  g_assert_cmpfloat (fabs (pitch[57] - 5700.0), <, EPSILON);
+  g_assert_cmpfloat (fabs (pitch[60] - (6900.0 - 1200.0 * log2 (5.0 / 3.0))), <, EPSILON);
+  g_assert_cmpfloat (fabs (pitch[64] - 6400.0), <, EPSILON);
+}
+
+static void
+test_malformed (void)
+{
+  gdouble pitch[128];
+
+  /* too few degrees for the count */
+  g_assert (!scala_compile ("short\n3\n100.0\n200.0\n", NULL, NULL, pitch));
+  /* no count */
+  g_assert (!scala_compile ("no count\n", NULL, NULL, pitch));
+  g_assert (!scala_compile ("", NULL, NULL, pitch));
+  /* a degree that is no pitch */
+  g_assert (!scala_compile ("bad degree\n2\n100.0\nfifth\n", NULL, NULL, pitch));
+  /* a mapping that is cut short */
+  g_assert (!scala_compile (equal_scl, "12\n0\n127\n", NULL, pitch));
+  /* a mapping with no frequency */
+  g_assert (!scala_compile (equal_scl, "0\n0\n127\n60\n69\n0\n0\n", NULL, pitch));
+  /* a reference key the pattern leaves out */
+  g_assert (!scala_compile (equal_scl, "2\n0\n127\n60\n61\n440.0\n12\n0\nx\n", NULL, pitch));
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/scala/parse-pitch", test_parse_pitch);
+  g_test_add_func ("/scala/compile/linear", test_linear);
+  g_test_add_func ("/scala/compile/mapped", test_mapped);
+  g_test_add_func ("/scala/compile/reference-outside", test_reference_outside);
+  g_test_add_func ("/scala/compile/malformed", test_malformed);
+  return g_test_run ();
+}
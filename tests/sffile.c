@@ -0,0 +1,190 @@
+/*
+ * sffile.c
+ * Unit tests of saving and loading SoundFonts with libsffile.
+ *
+ * HistoricHarpsichord - a synthesizer for an historic harpsichord sound
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "sffile.h"
+
+#define SAMPLE_POINTS (100)
+#define SAMPLE_GUARD (46)
+
+/* a font of one preset over one instrument over one sample, each with
+ * its terminal record */
+static SFGenRec preset_gens[] = {
+  {SF_GEN_KEYRANGE, 36 | (96 << 8)},
+  {SF_GEN_INSTRUMENT, 0},
+};
+static SFGenRec inst_gens[] = {
+  {SF_GEN_KEYRANGE, 36 | (96 << 8)},
+  {SF_GEN_SAMPLEID, 0},
+};
+static SFGenLayer preset_layer = { G_N_ELEMENTS (preset_gens), preset_gens, 0, NULL };
+static SFGenLayer inst_layer = { G_N_ELEMENTS (inst_gens), inst_gens, 0, NULL };
+
+static void
+build_font (SFInfo * sf, FILE * data)
+{
+  static SFPresetHdr presets[2];
+  static SFInstHdr insts[2];
+  static SFSampleInfo samples[2];
+  gint16 points[SAMPLE_POINTS];
+  gint i;
+
+  for (i = 0; i < SAMPLE_POINTS; i++)
+    points[i] = (gint16) ((i * 997) % 65536 - 32768);
+  g_assert_cmpint (fwrite (points, sizeof (points), 1, data), ==, 1);
+
+  memset (sf, 0, sizeof (*sf));
+  sf->version = 2;
+  sf->minorversion = 1;
+  sf->samplepos = 0;
+  sf->samplesize = sizeof (points);
+
+  strncpy (presets[0].hdr.name, "Harpsichord", sizeof (presets[0].hdr.name));
+  presets[0].preset = 6;
+  presets[0].hdr.nlayers = 1;
+  presets[0].hdr.layer = &preset_layer;
+  strncpy (presets[1].hdr.name, "EOP", sizeof (presets[1].hdr.name));
+  sf->npresets = 2;
+  sf->preset = presets;
+
+  strncpy (insts[0].hdr.name, "Back 8'", sizeof (insts[0].hdr.name));
+  insts[0].hdr.nlayers = 1;
+  insts[0].hdr.layer = &inst_layer;
+  strncpy (insts[1].hdr.name, "EOI", sizeof (insts[1].hdr.name));
+  sf->ninsts = 2;
+  sf->inst = insts;
+
+  strncpy (samples[0].name, "C4", sizeof (samples[0].name));
+  samples[0].startsample = 0;
+  samples[0].endsample = SAMPLE_POINTS;
+  samples[0].startloop = 10;
+  samples[0].endloop = 90;
+  samples[0].samplerate = 44100;
+  samples[0].originalPitch = 60;
+  samples[0].pitchCorrection = (byte) - 3;
+  samples[0].sampletype = 1;
+  strncpy (samples[1].name, "EOS", sizeof (samples[1].name));
+  sf->nsamples = 2;
+  sf->sample = samples;
+}
+
+static void
+assert_layers_equal (SFHeader * saved, SFHeader * loaded)
+{
+  gint i, j;
+
+  g_assert_cmpstr (loaded->name, ==, saved->name);
+  g_assert_cmpint (loaded->nlayers, ==, saved->nlayers);
+  for (i = 0; i < saved->nlayers; i++)
+    {
+      g_assert_cmpint (loaded->layer[i].nlists, ==, saved->layer[i].nlists);
+      g_assert_cmpint (loaded->layer[i].nmods, ==, saved->layer[i].nmods);
+      for (j = 0; j < saved->layer[i].nlists; j++)
+        {
+          g_assert_cmpint (loaded->layer[i].list[j].oper, ==, saved->layer[i].list[j].oper);
+          g_assert_cmpint (loaded->layer[i].list[j].amount, ==, saved->layer[i].list[j].amount);
+        }
+    }
+}
+
+/* a copy of the whole of the file */
+static GByteArray *
+read_all (FILE * fp)
+{
+  GByteArray *bytes = g_byte_array_new ();
+  guint8 buf[4096];
+  size_t n;
+
+  rewind (fp);
+  while ((n = fread (buf, 1, sizeof (buf), fp)) > 0)
+    g_byte_array_append (bytes, buf, n);
+  return bytes;
+}
+
+/* what is saved loads back the same, and saves again to the same bytes */
+static void
+test_round_trip (void)
+{
+  SFInfo sf, loaded;
+  FILE *data, *saved, *resaved;
+  GByteArray *first, *second;
+  gint16 points[SAMPLE_POINTS + SAMPLE_GUARD], expected[SAMPLE_POINTS];
+  gint i;
+
+  data = tmpfile ();
+  saved = tmpfile ();
+  resaved = tmpfile ();
+  g_assert (data && saved && resaved);
+
+  build_font (&sf, data);
+  g_assert_cmpint (save_soundfont (&sf, data, saved), ==, 0);
+
+  rewind (saved);
+  g_assert_cmpint (load_soundfont (&loaded, saved, 1), ==, 0);
+  g_assert_cmpint (loaded.version, ==, 2);
+  g_assert_cmpint (loaded.minorversion, ==, 1);
+  g_assert_cmpstr (loaded.sf_name, ==, "untitled");
+
+  g_assert_cmpint (loaded.npresets, ==, sf.npresets);
+  g_assert_cmpint (loaded.preset[0].preset, ==, 6);
+  g_assert_cmpint (loaded.preset[0].bank, ==, 0);
+  for (i = 0; i < sf.npresets; i++)
+    assert_layers_equal (&sf.preset[i].hdr, &loaded.preset[i].hdr);
+  g_assert_cmpint (loaded.ninsts, ==, sf.ninsts);
+  for (i = 0; i < sf.ninsts; i++)
+    assert_layers_equal (&sf.inst[i].hdr, &loaded.inst[i].hdr);
+
+  g_assert_cmpint (loaded.nsamples, ==, sf.nsamples);
+  g_assert_cmpstr (loaded.sample[0].name, ==, "C4");
+  g_assert_cmpint (loaded.sample[0].startsample, ==, 0);
+  g_assert_cmpint (loaded.sample[0].endsample, ==, SAMPLE_POINTS);
+  g_assert_cmpint (loaded.sample[0].startloop, ==, 10);
+  g_assert_cmpint (loaded.sample[0].endloop, ==, 90);
+  g_assert_cmpint (loaded.sample[0].samplerate, ==, 44100);
+  g_assert_cmpint (loaded.sample[0].originalPitch, ==, 60);
+  g_assert_cmpint (loaded.sample[0].pitchCorrection, ==, sf.sample[0].pitchCorrection);
+  g_assert_cmpint (loaded.sample[0].sampletype, ==, 1);
+  g_assert_cmpstr (loaded.sample[1].name, ==, "EOS");
+
+  /* the sample data is followed by its zero guard points */
+  g_assert_cmpint (loaded.samplesize, ==, sizeof (points));
+  g_assert_cmpint (fseek (saved, loaded.samplepos, SEEK_SET), ==, 0);
+  g_assert_cmpint (fread (points, sizeof (points), 1, saved), ==, 1);
+  rewind (data);
+  g_assert_cmpint (fread (expected, sizeof (expected), 1, data), ==, 1);
+  g_assert (memcmp (points, expected, sizeof (expected)) == 0);
+  for (i = SAMPLE_POINTS; i < SAMPLE_POINTS + SAMPLE_GUARD; i++)
+    g_assert_cmpint (points[i], ==, 0);
+
+  g_assert_cmpint (save_soundfont (&loaded, saved, resaved), ==, 0);
+  first = read_all (saved);
+  second = read_all (resaved);
+  g_assert_cmpuint (first->len, ==, second->len);
+  g_assert (memcmp (first->data, second->data, first->len) == 0);
+
+  g_byte_array_free (first, TRUE);
+  g_byte_array_free (second, TRUE);
+  free_soundfont (&loaded);
+  fclose (data);
+  fclose (saved);
+  fclose (resaved);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/sffile/round-trip", test_round_trip);
+  return g_test_run ();
+}